@@ -1,32 +1,67 @@
 #include "SmallXml.h"
+#include "XmlParser.h"
 #include <algorithm>
 #include <functional>
-#include <stack>
 
 #include <cstdio>
+#include <cstring>
 
 namespace SmallXml {
 
+/*
+  Steps of a path are read in place, the way xpathSplit cuts them:
+  empty steps between slashes are skipped.
+*/
+namespace {
+
+bool nextStep(std::string_view path, size_t & begin, size_t & end) {
+  begin = end;
+  while (begin < path.size() && '/' == path[begin])
+    ++begin;
+  end = begin;
+  while (end < path.size() && '/' != path[end])
+    ++end;
+
+  return begin != end;
+}
+
+void previousStep(std::string_view path, size_t & begin, size_t & end) {
+  end = begin;
+  while (0 < end && '/' == path[end - 1])
+    --end;
+  begin = end;
+  while (0 < begin && '/' != path[begin - 1])
+    --begin;
+}
+
+bool isLastStep(std::string_view path, size_t end) {
+  size_t begin = end;
+  return !nextStep(path, begin, end);
+}
+
+}
+
 /*
   Constructor with no argument
-  Create a node as element, and leave
-  text_ empty, set tag as "DEFAULT".
+  Create a node as element, set tag as "DEFAULT".
    */
 XmlNode::XmlNode()
   : type_(ELEMENT),
     parent_(NULL),
     prev_(NULL), next_(NULL),
     first_child_(NULL), last_child_(NULL),
-    text_(""), tag_("DEFAULT"),
-    attributes_(std::map<std::string, std::string>()) {
+    value_("DEFAULT"),
+    attributes_(AttributeMap()),
+    lazy_(false), lazy_begin_(0),
+    span_begin_(0), span_end_(0),
+    hash_(0) {
 }
 
 /*
   Create a node with a given type.
   In the cases of type,
-  Element - set tag_ as "DEFAULT"
-            set text_ as empty string
-  Comment - set tag_ and text_ as empty
+  Element - set tag as "DEFAULT"
+  Comment - set text as empty
   Declaration - default version encoding
    */
 XmlNode::XmlNode(NodeType type)
@@ -34,12 +69,15 @@ XmlNode::XmlNode(NodeType type)
     parent_(NULL),
     prev_(NULL), next_(NULL),
     first_child_(NULL), last_child_(NULL),
-    text_(""), tag_(""),
-    attributes_(std::map<std::string, std::string>()) {
+    value_(),
+    attributes_(AttributeMap()),
+    lazy_(false), lazy_begin_(0),
+    span_begin_(0), span_end_(0),
+    hash_(0) {
   
   switch (type_) {
     case ELEMENT:
-      tag_ = "DEFAULT";
+      value_.assign("DEFAULT", 7);
       break;
     case DECLARATION:
       SetVersion("1.1");
@@ -59,8 +97,8 @@ XmlNode::XmlNode(NodeType type)
 /*
   Constructor with ginven type and value
   In the cases of type,
-  Element - value is the name of tag, tag_
-  Comment - value is the the content, text_
+  Element - value is the name of tag
+  Comment - value is the the content
   Declaration - same as the above one
    */
 XmlNode::XmlNode(NodeType type, const std::string & value) 
@@ -68,7 +106,10 @@ XmlNode::XmlNode(NodeType type, const std::string & value)
     parent_(NULL),
     prev_(NULL), next_(NULL),
     first_child_(NULL), last_child_(NULL),
-    text_(""), tag_("") {
+    value_(),
+    lazy_(false), lazy_begin_(0),
+    span_begin_(0), span_end_(0),
+    hash_(0) {
   switch(type_) {
     case ELEMENT:
       set_tag(value);
@@ -92,38 +133,37 @@ XmlNode::XmlNode(NodeType type, const std::string & value)
 */
 XmlNode::XmlNode(const XmlNode & node) 
   : type_(node.type_),
-    parent_(node.parent_),
-    prev_(node.prev_), next_(node.next_),
+    parent_(NULL),
+    prev_(NULL), next_(NULL),
     first_child_(0), last_child_(0),
-    text_(node.text_), tag_(node.tag_),
-    attributes_(node.attributes_) {
-  XmlNode * scan = node.first_child_;
-  
-  while (NULL != scan) {
-    PushChild(*scan);
-    scan = scan->next_;
-  }
+    value_(node.value_),
+    attributes_(node.attributes_),
+    source_(node.source_),
+    lazy_(node.lazy_), lazy_begin_(node.lazy_begin_),
+    span_begin_(node.span_begin_), span_end_(node.span_end_),
+    hash_(node.hash_) {
+  // A lazy node has no children yet, the copy parses its own
+  copyChildren(node);
 }
 
 XmlNode & XmlNode::operator=(const XmlNode & node) {
   if (this == &node)
     return *this;
   
-  type_ = node.type_;
-  parent_ = node.parent_;
-  prev_ = node.prev_;
-  next_ = node.next_;
-  first_child_ = 0;
-  last_child_ = 0;
-  text_ = node.text_;
-  tag_ = node.tag_;
-  attributes_ = node.attributes_;
-  
-  XmlNode * scan = node.first_child_;
-  while (NULL != scan) {
-    PushChild(*scan);
-    scan = scan->next_;
-  }
+  // node may live below this, copy it before the children go
+  XmlNode copy(node);
+
+  // The node keeps its place in its own tree
+  touch();
+  releaseChildren();
+  copyValue(copy);
+
+  first_child_ = copy.first_child_;
+  last_child_ = copy.last_child_;
+  for (XmlNode * scan = first_child_; NULL != scan; scan = scan->next_)
+    scan->parent_ = this;
+  copy.first_child_ = NULL;
+  copy.last_child_ = NULL;
   
   return *this;
 }
@@ -132,17 +172,7 @@ XmlNode & XmlNode::operator=(const XmlNode & node) {
   Destructor
 */
 XmlNode::~XmlNode() {
-  XmlNode * node = first_child_;
-  XmlNode * tmp = NULL;
-  
-  while (node) {
-    tmp = node;
-    node = node->NextSibling();
-    delete tmp;
-  }
-  
-  first_child_ = NULL;
-  last_child_ = NULL;
+  releaseChildren();
 }
 
 /*
@@ -158,6 +188,10 @@ XmlNode * XmlNode::PushChild(const XmlNode & node) {
     
   if (DOCUMENT == node.type_)
     return NULL;
+
+  // New children go behind the ones still to be parsed
+  expand();
+  touch();
     
   // Make a copy
   XmlNode * p_tmp_node = new XmlNode(node);
@@ -190,6 +224,8 @@ XmlNode * XmlNode::InsertChildBefore(const XmlNode & node, XmlNode * before_this
   if (DOCUMENT == node.type_)
     return NULL;
 
+  touch();
+
   // make a copy
   XmlNode * p_tmp_node = new XmlNode(node);
   if (NULL == p_tmp_node)
@@ -218,6 +254,8 @@ XmlNode * XmlNode::InsertChildAfter(const XmlNode & child, XmlNode * after_this)
     
   if (DOCUMENT == child.type_)
     return NULL;
+
+  touch();
     
   // Copy child
   XmlNode * p_tmp_node = new XmlNode(child);
@@ -240,12 +278,185 @@ XmlNode * XmlNode::InsertChildAfter(const XmlNode & child, XmlNode * after_this)
   return p_tmp_node;
 }
 
+bool XmlNode::RemoveChild(XmlNode * child) {
+  XmlNode * detached = DetachChild(child);
+  if (NULL == detached)
+    return false;
+
+  delete detached;
+  return true;
+}
+
+XmlNode * XmlNode::DetachChild(XmlNode * child) {
+  if (NULL == child || this != child->parent_)
+    return NULL;
+
+  touch();
+  unlinkChild(child);
+  child->parent_ = NULL;
+  child->prev_ = NULL;
+  child->next_ = NULL;
+  return child;
+}
+
+XmlNode * XmlNode::AdoptChild(XmlNode * node) {
+  if (NULL == node || NULL != node->parent_)
+    return NULL;
+    
+  // Only elements have children
+  if (ELEMENT != type_ && DOCUMENT != type_)
+    return NULL;
+    
+  if (DOCUMENT == node->type_)
+    return NULL;
+
+  for (const XmlNode * scan = this; NULL != scan; scan = scan->parent_) {
+    if (node == scan)
+      return NULL;
+  }
+
+  // New children go behind the ones still to be parsed
+  expand();
+  touch();
+
+  node->parent_ = this;
+  node->prev_ = last_child_;
+  node->next_ = NULL;
+  if (NULL != last_child_)
+    last_child_->next_ = node;
+  else
+    first_child_ = node;
+  last_child_ = node;
+
+  return node;
+}
+
+/*
+  Checks walk the moved siblings and the ancestors of this, before
+  anything is changed. The ancestor of this which is a sibling of
+  first, if any, must not be moved.
+*/
+bool XmlNode::SpliceChildren(XmlNode * before_this, XmlNode * first, XmlNode * last) {
+  if (NULL == first || NULL == last || NULL == first->parent_ || first->parent_ != last->parent_)
+    return false;
+  if (NULL != before_this && this != before_this->parent_)
+    return false;
+  if (ELEMENT != type_ && DOCUMENT != type_)
+    return false;
+
+  XmlNode * from = first->parent_;
+  const XmlNode * inside = NULL;
+  for (const XmlNode * scan = this; NULL != scan; scan = scan->parent_) {
+    if (from == scan->parent_) {
+      inside = scan;
+      break;
+    }
+  }
+
+  XmlNode * scan = first;
+  for (; NULL != scan; scan = scan->next_) {
+    if (inside == scan || before_this == scan)
+      return false;
+    if (last == scan)
+      break;
+  }
+  if (NULL == scan)
+    return false;
+
+  expand();
+  touch();
+  from->touch();
+
+  // Out of the old list
+  if (NULL != first->prev_)
+    first->prev_->next_ = last->next_;
+  else
+    from->first_child_ = last->next_;
+  if (NULL != last->next_)
+    last->next_->prev_ = first->prev_;
+  else
+    from->last_child_ = first->prev_;
+
+  // Into the new one
+  XmlNode * after_this = (NULL == before_this) ? last_child_ : before_this->prev_;
+  first->prev_ = after_this;
+  last->next_ = before_this;
+  if (NULL != after_this)
+    after_this->next_ = first;
+  else
+    first_child_ = first;
+  if (NULL != before_this)
+    before_this->prev_ = last;
+  else
+    last_child_ = last;
+
+  for (scan = first; last->next_ != scan; scan = scan->next_)
+    scan->parent_ = this;
+
+  return true;
+}
+
+namespace {
+
+/*
+  A child and its sort key, looked up once. prefix holds the first
+  eight bytes of the value, big endian, so most comparisons don't
+  touch the value itself.
+*/
+struct AttributeKey {
+  uint64_t prefix;
+  const XmlValue * value;
+  XmlNode * node;
+};
+
+bool lessAttributeKey(const AttributeKey & a, const AttributeKey & b) {
+  if (a.prefix != b.prefix)
+    return a.prefix < b.prefix;
+
+  // Without the attribute is before any value
+  if (NULL == b.value)
+    return false;
+  return NULL == a.value || a.value->view() < b.value->view();
+}
+
+}
+
+void XmlNode::StableSortChildrenByAttribute(const std::string & name) {
+  expand();
+  if (first_child_ == last_child_)
+    return;
+  touch();
+
+  std::vector<AttributeKey> keys;
+  for (XmlNode * scan = first_child_; NULL != scan; scan = scan->next_) {
+    AttributeKey key = {0, NULL, scan};
+    AttributeMap::const_iterator found = scan->attributes_.find(name);
+    if (scan->attributes_.end() != found) {
+      key.value = &found->second;
+      for (size_t index = 0; index < 8; ++index) {
+        unsigned char c = (index < key.value->size()) ? key.value->data()[index] : 0;
+        key.prefix = (key.prefix << 8) | c;
+      }
+    }
+    keys.push_back(key);
+  }
+
+  std::stable_sort(keys.begin(), keys.end(), lessAttributeKey);
+
+  std::vector<XmlNode *> children(keys.size());
+  for (size_t index = 0; index < keys.size(); ++index)
+    children[index] = keys[index].node;
+  relinkChildren(children);
+}
+
 int XmlNode::NumOfChildren() const {
-  // Only Element has children
-  // Return 0 if type_ is not ELEMENT
-  if (ELEMENT != type_ || DOCUMENT != type_)
+  // Only Element and Document have children
+  // Return 0 if type_ is neither
+  if (ELEMENT != type_ && DOCUMENT != type_)
     return 0;
 
+  expand();
+
   int num = 0;
   XmlNode * p_scan = first_child_;
   while (NULL != p_scan) {
@@ -257,6 +468,7 @@ int XmlNode::NumOfChildren() const {
 }
 
 bool XmlNode::HasChild() const {
+  expand();
   return NULL != first_child_;
 }
 
@@ -266,18 +478,21 @@ void XmlNode::SetAttribute(const std::string & name,
   // Only Element & Declaration have children
   if (ELEMENT != type_ && DECLARATION != type_)
     return;
-  attributes_[XmlSpecialCharEncode(name)] = XmlSpecialCharEncode(value);
+  touch();
+  setValue(attributeSlot(name), XmlSpecialCharEncode(value));
 }
 
 void XmlNode::SetAttributes(const std::string & content) {
   if (ELEMENT != type_ && DECLARATION != type_)
     return;
-    
+
+  touch();
   int index = 0;
   
   int content_size = content.size();
   while (index < content_size) {
-    EatWhiteSpace(content, index);
+    while (index < content_size && isWhiteSpace(content[index]))
+      ++index;
     // parse name
     std::string name = "";
     while (index < content_size &&
@@ -309,6 +524,7 @@ void XmlNode::RemoveAttribute(const std::string & name) {
   if (ELEMENT != type_)
     return;
     
+  touch();
   attributes_.erase(name);
 }
 
@@ -317,23 +533,43 @@ std::string XmlNode::GetAttribute(const std::string & name) const {
   if (ELEMENT != type_ && DECLARATION != type_)
     return "";
 
-  std::string encoded_name = XmlSpecialCharEncode(name);
-  
-  std::map<std::string, std::string>::const_iterator it = attributes_.find(encoded_name);
-  if (it != attributes_.end()) {
-    return XmlSpecialCharDecode(it->second);
+  const XmlValue * stored = findAttribute(name);
+  if (NULL != stored) {
+    std::string result;
+    XmlSpecialCharDecode(stored->data(), stored->size(), result);
+    return result;
   }
   
   return "";
 }
 
+namespace {
+
+bool hasSpecialChar(const std::string & str) {
+  return std::string::npos != str.find_first_of("&<>\'\"");
+}
+
+}
+
+const XmlValue * XmlNode::findAttribute(const std::string & name) const {
+  AttributeMap::const_iterator it =
+      hasSpecialChar(name) ? attributes_.find(XmlSpecialCharEncode(name)) : attributes_.find(name);
+  return (it == attributes_.end()) ? NULL : &it->second;
+}
+
+XmlValue & XmlNode::attributeSlot(const std::string & name) {
+  if (hasSpecialChar(name))
+    return attributes_[XmlSpecialCharEncode(name)];
+  return attributes_[name];
+}
+
 std::vector<std::pair<std::string, std::string> > XmlNode::GetAttributes() const {
 
   std::vector<std::pair<std::string, std::string> > result;
   
-  std::map<std::string, std::string>::const_iterator it = attributes_.begin();
+  AttributeMap::const_iterator it = attributes_.begin();
   for (; it != attributes_.end(); ++it) {
-    result.push_back(std::pair<std::string, std::string>(it->first, it->second));
+    result.push_back(std::pair<std::string, std::string>(it->first, it->second.str()));
   }
   
   return result;
@@ -364,7 +600,7 @@ std::string XmlNode::GetEncoding() const {
   if (DECLARATION != type_)
     return "";
     
-  return GetAttribute("Encoding");
+  return GetAttribute("encoding");
 }
 
 /*
@@ -373,9 +609,12 @@ std::string XmlNode::GetEncoding() const {
    */
 std::string XmlNode::ToString(int indent) const {
   
+  std::string result;
+
   switch(type_) {
     case ELEMENT:
-      return ToStringAsElement(indent);
+      appendString(result, indent, false);
+      return result;
     case COMMENT:
       return ToStringAsComment(indent);
     case DECLARATION:
@@ -385,34 +624,276 @@ std::string XmlNode::ToString(int indent) const {
     case UNKNOWN:
       return ToStringAsUnknown(indent);
     case DOCUMENT:
-      return ToStringAsDOCUMENT(indent);
+      appendString(result, indent, false);
+      return result;
   }
 
   return "";
 }
 
+// A span has to lie inside the kept content, a source of values only
+// keeps none
+bool XmlNode::HasRawXml() const {
+  return NULL != source_ && span_begin_ != span_end_ && span_end_ <= source_->content.size();
+}
+
+std::string_view XmlNode::RawXml() const {
+  if (!HasRawXml())
+    return std::string_view();
+
+  return std::string_view(source_->content.data() + span_begin_, span_end_ - span_begin_);
+}
+
+std::string XmlNode::ToSourceString() const {
+  std::string result;
+  appendString(result, -1, true);
+  return result;
+}
+
+namespace {
+
+uint64_t mixHash(uint64_t hash, uint64_t value) {
+  hash = (hash ^ value) * 0x9E3779B97F4A7C15ULL;
+  hash ^= hash >> 29;
+  hash *= 0xBF58476D1CE4E5B9ULL;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+// Eight bytes at a time, the size first so that strings can follow
+// each other
+uint64_t hashString(uint64_t hash, std::string_view str) {
+  hash = mixHash(hash, str.size());
+  const char * data = str.data();
+  size_t size = str.size();
+  for (; size >= 8; data += 8, size -= 8) {
+    uint64_t word;
+    memcpy(&word, data, 8);
+    hash = mixHash(hash, word);
+  }
+
+  uint64_t tail = 0;
+  memcpy(&tail, data, size);
+  return mixHash(hash, tail);
+}
+
+}
+
+/*
+  Post order over the nodes without hash, subtrees which have one are
+  not entered. The children of a node are hashed before it, so when
+  the walk comes back up they all have one.
+*/
+uint64_t XmlNode::Hash() const {
+  const XmlNode * node = this;
+  while (0 == hash_) {
+    node->expand();
+    const XmlNode * child = node->first_child_;
+    while (NULL != child && 0 != child->hash_)
+      child = child->next_;
+    if (NULL != child) {
+      node = child;
+      continue;
+    }
+
+    uint64_t hash = mixHash(0, node->type_);
+    // As if tag and text were apart, an empty one for the other type
+    std::string_view value = node->value_.view();
+    std::string_view none(value.data(), 0);
+    std::string_view tag = (ELEMENT == node->type_) ? value : none;
+    std::string_view text = (ELEMENT == node->type_) ? none : value;
+    hash = hashString(hash, tag);
+    hash = hashString(hash, text);
+    hash = mixHash(hash, node->attributes_.size());
+    for (AttributeMap::const_iterator it = node->attributes_.begin();
+         it != node->attributes_.end(); ++it) {
+      hash = hashString(hash, it->first);
+      hash = hashString(hash, it->second);
+    }
+    for (child = node->first_child_; NULL != child; child = child->next_)
+      hash = mixHash(hash, child->hash_);
+    // 0 means no hash
+    node->hash_ = (0 == hash) ? 1 : hash;
+
+    if (node == this)
+      break;
+    const XmlNode * next = node->next_;
+    while (NULL != next && 0 != next->hash_)
+      next = next->next_;
+    node = (NULL != next) ? next : node->parent_;
+  }
+
+  return hash_;
+}
+
+bool XmlNode::DeepEquals(const XmlNode & node) const {
+  std::vector<std::pair<const XmlNode *, const XmlNode *> > stack;
+  stack.push_back(std::make_pair(this, &node));
+
+  while (!stack.empty()) {
+    const XmlNode * left = stack.back().first;
+    const XmlNode * right = stack.back().second;
+    stack.pop_back();
+
+    if (left == right)
+      continue;
+    // Different hashes tell subtrees apart, equal ones may collide
+    if (0 != left->hash_ && 0 != right->hash_ && left->hash_ != right->hash_)
+      return false;
+    if (!left->sameValue(*right))
+      return false;
+
+    const XmlNode * left_child = left->FirstChild();
+    const XmlNode * right_child = right->FirstChild();
+    for (; NULL != left_child && NULL != right_child;
+         left_child = left_child->next_, right_child = right_child->next_)
+      stack.push_back(std::make_pair(left_child, right_child));
+    if (left_child != right_child)
+      return false;
+  }
+
+  return true;
+}
+
+namespace {
+
+// How far Diff looks for a child found again on the other side
+const size_t kDiffLookahead = 16;
+
+// Children may be paired when they are of the same kind
+bool sameKind(const XmlNode & before, const XmlNode & after) {
+  return before.type() == after.type() &&
+         (XmlNode::ELEMENT != before.type() || before.tag() == after.tag());
+}
+
+}
+
+/*
+  A stack of pairs still to compare, a missing side is an addition or a
+  removal to report. Pairs are pushed in reverse, so they come out in
+  document order.
+
+  Children are walked in order on both sides after their common head
+  and tail are dropped. Equal hashes are passed over. At a difference,
+  a hash found again a few children further on one side ends a run
+  added to or removed from that side; otherwise the two children are
+  paired if they are of the same kind.
+*/
+std::vector<XmlDiff> XmlNode::Diff(const XmlNode & before, const XmlNode & after) {
+  std::vector<XmlDiff> diffs;
+  if (before.Hash() == after.Hash())
+    return diffs;
+
+  typedef std::pair<const XmlNode *, const XmlNode *> Pair;
+  std::vector<Pair> stack;
+  std::vector<Pair> pairs;
+  stack.push_back(Pair(&before, &after));
+
+  while (!stack.empty()) {
+    Pair pair = stack.back();
+    stack.pop_back();
+
+    if (NULL == pair.first || NULL == pair.second) {
+      XmlDiff diff = {NULL == pair.first ? XmlDiff::ADDED : XmlDiff::REMOVED,
+                      pair.first, pair.second};
+      diffs.push_back(diff);
+      continue;
+    }
+    if (!pair.first->sameValue(*pair.second)) {
+      XmlDiff diff = {XmlDiff::CHANGED, pair.first, pair.second};
+      diffs.push_back(diff);
+    }
+
+    // Both are hashed, so are their children. Drop the common head,
+    // then the common tail, up to the first node of the tail.
+    const XmlNode * left = pair.first->first_child_;
+    const XmlNode * right = pair.second->first_child_;
+    while (NULL != left && NULL != right && left->hash_ == right->hash_) {
+      left = left->next_;
+      right = right->next_;
+    }
+
+    const XmlNode * left_end = NULL;
+    const XmlNode * right_end = NULL;
+    while (left_end != left && right_end != right) {
+      const XmlNode * left_last = (NULL == left_end) ? pair.first->last_child_ : left_end->prev_;
+      const XmlNode * right_last = (NULL == right_end) ? pair.second->last_child_ : right_end->prev_;
+      if (left_last->hash_ != right_last->hash_)
+        break;
+      left_end = left_last;
+      right_end = right_last;
+    }
+
+    pairs.clear();
+    while (left != left_end && right != right_end) {
+      if (left->hash_ == right->hash_) {
+        left = left->next_;
+        right = right->next_;
+        continue;
+      }
+
+      const XmlNode * added = right->next_;
+      const XmlNode * removed = left->next_;
+      bool resumed = false;
+      for (size_t step = 0; step < kDiffLookahead && !resumed; ++step) {
+        if (added != right_end && added->hash_ == left->hash_) {
+          for (; right != added; right = right->next_)
+            pairs.push_back(Pair(NULL, right));
+          resumed = true;
+        } else if (removed != left_end && removed->hash_ == right->hash_) {
+          for (; left != removed; left = left->next_)
+            pairs.push_back(Pair(left, NULL));
+          resumed = true;
+        }
+        if (added != right_end)
+          added = added->next_;
+        if (removed != left_end)
+          removed = removed->next_;
+      }
+      if (resumed)
+        continue;
+
+      if (sameKind(*left, *right)) {
+        pairs.push_back(Pair(left, right));
+      } else {
+        pairs.push_back(Pair(left, NULL));
+        pairs.push_back(Pair(NULL, right));
+      }
+      left = left->next_;
+      right = right->next_;
+    }
+    for (; left != left_end; left = left->next_)
+      pairs.push_back(Pair(left, NULL));
+    for (; right != right_end; right = right->next_)
+      pairs.push_back(Pair(NULL, right));
+
+    stack.insert(stack.end(), pairs.rbegin(), pairs.rend());
+  }
+
+  return diffs;
+}
+
 void XmlNode::Clear() {
+  // Children, strings and attributes go to the pool
+  if (recycler_) {
+    recycler_->Recycle(*this);
+    type_ = TEXT;
+    return;
+  }
+
+  touch();
   
   // Set as a Default element
   type_ = TEXT;
-  tag_ = "";
-  text_ = "";
+  value_.clear();
   
   // Clear Attributes
   attributes_.clear();
+  source_.reset();
+  lazy_ = false;
   
   // Release Children
-  XmlNode * node = first_child_;
-  XmlNode * tmp = NULL;
-  
-  while (node) {
-    tmp = node;
-    node = node->NextSibling();
-    delete tmp;
-  }
-  
-  first_child_ = NULL;
-  last_child_ = NULL;
+  releaseChildren();
 }
 
 bool XmlNode::Read(const std::string & content) {
@@ -421,14 +902,45 @@ bool XmlNode::Read(const std::string & content) {
 }
 
 bool XmlNode::Read(const std::string & content, int & index) {
-  if (DOCUMENT == type_)
-    return ReadDocument(content, index);
-  else
-    return ReadNode(content, index);
+  if (recycler_)
+    return recycler_->Read(content, index, *this);
+
+  XmlParser parser;
+  return parser.Read(content, index, *this);
+}
+
+bool XmlNode::Read(const std::string & content, const ParseProjection & projection) {
+  if (recycler_)
+    return recycler_->Read(content, projection, *this);
+
+  XmlParser parser;
+  return parser.Read(content, projection, *this);
+}
+
+void XmlNode::RetainCapacity(bool retain) {
+  if (!retain)
+    recycler_.reset();
+  else if (!recycler_)
+    recycler_.reset(new XmlParser);
+}
+
+bool XmlNode::RetainsCapacity() const {
+  return NULL != recycler_;
+}
+
+size_t XmlNode::NumOfRetainedNodes() const {
+  return recycler_ ? recycler_->NumOfPooledNodes() : 0;
+}
+
+const XmlValuePool * XmlNode::ValuePool() const {
+  return (NULL != source_) ? source_->values.get() : NULL;
 }
 
 void XmlNode::set_type(const enum NodeType type) {
-  // TODE considering to change tag_ and text_ or not.
+  // The tag of an element is not the text of another type
+  touch();
+  if ((ELEMENT == type_) != (ELEMENT == type))
+    value_.clear();
   type_ = type;
 }
 
@@ -461,7 +973,7 @@ const XmlNode * XmlNode::PreviousElement(const std::string & tag) const {
   XmlNode * scan = prev_;
   while(NULL != scan) {
     if (ELEMENT == scan->type_ && 
-        tag_ == tag) {
+        XmlNode::tag() == tag) {
       return scan;    
     }
     
@@ -475,7 +987,7 @@ const XmlNode * XmlNode::NextElement(const std::string & tag) const {
   XmlNode * scan = next_;
   while (NULL != scan) {
     if (ELEMENT == scan->type_ &&
-        scan->tag_ == tag) {
+        scan->value_ == tag) {
       return scan;    
     }
     
@@ -486,134 +998,335 @@ const XmlNode * XmlNode::NextElement(const std::string & tag) const {
 }
 
 const XmlNode * XmlNode::FirstChild() const {
+  expand();
   return first_child_;
 }
 
-const XmlNode * XmlNode::LastChild() const {
-  return last_child_;
-}
+/*
+  The walks only follow links, the parent links lead back up, so no
+  stack is needed whatever the depth.
+*/
+const XmlNode * XmlNode::NextInPreorder(const XmlNode * root) const {
+  expand();
+  if (NULL != first_child_)
+    return first_child_;
+
+  for (const XmlNode * scan = this; NULL != scan && root != scan; scan = scan->parent_) {
+    if (NULL != scan->next_)
+      return scan->next_;
+  }
 
-// Depth first search
-const XmlNode * XmlNode::XPath(const std::string & path) const {
-  std::vector<std::string> paths_vec = xpathSplit(path);
-  std::queue<std::string> paths;
-  const XmlNode * tmp_node = NULL;
+  return NULL;
+}
 
-  if (0 == paths_vec.size())
-    return this;
+const XmlNode * XmlNode::FirstInPostorder() const {
+  const XmlNode * scan = this;
+  scan->expand();
+  while (NULL != scan->first_child_) {
+    scan = scan->first_child_;
+    scan->expand();
+  }
 
-  for (size_t index = 0; index < paths_vec.size(); ++index)
-    paths.push(paths_vec[index]);
+  return scan;
+}
 
-  paths_vec.clear();
+const XmlNode * XmlNode::NextInPostorder(const XmlNode * root) const {
+  if (root == this)
+    return NULL;
+  if (NULL != next_)
+    return next_->FirstInPostorder();
 
-  for (XmlNode *scan = first_child_; scan != NULL; scan = scan->next_) {
-    tmp_node = scan->xPathRec(paths);
-    if (NULL != tmp_node)
-      return tmp_node;
-  }
-  return NULL;
+  return parent_;
 }
 
-// Width first search
-const std::vector<const XmlNode * > XmlNode::XPaths_c(const std::string & path) const {
-  std::vector<const XmlNode * > vec[2];
+const XmlNode * XmlNode::LastChild() const {
+  expand();
+  return last_child_;
+}
 
-  vec[0].push_back(this);
-  unsigned int src_index = 0;
-  unsigned int des_index = 1;
+// Depth first search, the first match of xpath
+const XmlNode * XmlNode::XPath(const std::string & path) const {
+  XPathState state;
+  xpathStart(state, this, path);
+  return state.node;
+}
 
-  std::vector<std::string> tags = xpathSplit(path);
-  for (size_t index = 0; index < tags.size(); ++index) {
-    if (0 == vec[src_index].size())
-      break;
+// All matches, in document order
+const std::vector<const XmlNode * > XmlNode::XPaths_c(const std::string & path) const {
+  std::vector<const XmlNode * > vec;
+  XmlRange<ConstXPathIterator> found = xpath(path);
 
-    for (size_t index_vec = 0; index_vec < vec[src_index].size(); ++index_vec) {
-      const XmlNode *tmp_node = vec[src_index][index_vec]->FirstChild();
-      while (NULL != tmp_node) {
-        if (ELEMENT == tmp_node->type() && tmp_node->tag() == tags[index]) {
-          vec[des_index].push_back(tmp_node);
-        }
-        tmp_node = tmp_node->NextSibling();
-      }
-    }
+  for (ConstXPathIterator it = found.begin(); it != found.end(); ++it)
+    vec.push_back(&*it);
 
-    vec[src_index].clear();
-    src_index = des_index;
-    des_index = (src_index + 1) % 2;
-  }
-  
-  return vec[src_index];
+  return vec;
 }
 
 std::vector<XmlNode * > XmlNode::XPaths(const std::string & path) {
   std::vector<XmlNode * > vec;
-  std::vector<const XmlNode * > c_vec = XPaths_c(path);
+  XmlRange<XPathIterator> found = xpath(path);
 
-  for (size_t index = 0; index < c_vec.size(); ++index) {
-    vec.push_back(const_cast<XmlNode *>(c_vec[index]));
-  }
+  for (XPathIterator it = found.begin(); it != found.end(); ++it)
+    vec.push_back(&*it);
 
   return vec;
 }
 
-std::string XmlNode::text() const {
-  return text_;
+XmlRange<XmlNode::ChildIterator> XmlNode::children() {
+  expand();
+  return XmlRange<ChildIterator>(ChildIterator(this, first_child_), ChildIterator(this, NULL));
 }
 
-void XmlNode::set_text(const std::string & text) {
-  if (DECLARATION == type_)
-    return;
-  
-  // For element, text is a child of parent
-  if (ELEMENT == type_) {
-    PushChild(XmlNode(TEXT, XmlSpecialCharEncode(trim(text))));
-    return;
-  }
-  
-  text_ = XmlSpecialCharEncode(trim(text));
+XmlRange<XmlNode::ConstChildIterator> XmlNode::children() const {
+  expand();
+  return XmlRange<ConstChildIterator>(ConstChildIterator(this, first_child_),
+                                      ConstChildIterator(this, NULL));
 }
 
-std::string XmlNode::tag() const {
-  return tag_;
+XmlRange<XmlNode::PreorderIterator> XmlNode::descendants() {
+  return XmlRange<PreorderIterator>(PreorderIterator(this, FirstChild()),
+                                    PreorderIterator(this, NULL));
 }
 
-void XmlNode::set_tag(const std::string & tag) {
-  if (ELEMENT != type_)
-    return;
-    
-  tag_ = XmlSpecialCharEncode(trim(tag));
+XmlRange<XmlNode::ConstPreorderIterator> XmlNode::descendants() const {
+  return XmlRange<ConstPreorderIterator>(ConstPreorderIterator(this, FirstChild()),
+                                         ConstPreorderIterator(this, NULL));
 }
 
-std::string XmlNode::GetDecodedTag() const {
-  return XmlSpecialCharDecode(tag_);
+XmlRange<XmlNode::ElementIterator> XmlNode::elements(std::string_view tag) {
+  expand();
+  return XmlRange<ElementIterator>(ElementIterator(this, first_child_, tag),
+                                   ElementIterator(this, NULL, tag));
+}
+
+XmlRange<XmlNode::ConstElementIterator> XmlNode::elements(std::string_view tag) const {
+  expand();
+  return XmlRange<ConstElementIterator>(ConstElementIterator(this, first_child_, tag),
+                                        ConstElementIterator(this, NULL, tag));
+}
+
+XmlRange<XmlNode::AttributeIterator> XmlNode::attributes() const {
+  return XmlRange<AttributeIterator>(attributes_.begin(), attributes_.end());
+}
+
+XmlRange<XmlNode::XPathIterator> XmlNode::xpath(std::string_view path) {
+  return XmlRange<XPathIterator>(XPathIterator(this, path), XPathIterator());
+}
+
+XmlRange<XmlNode::ConstXPathIterator> XmlNode::xpath(std::string_view path) const {
+  return XmlRange<ConstXPathIterator>(ConstXPathIterator(this, path), ConstXPathIterator());
+}
+
+std::string XmlNode::text() const {
+  if (ELEMENT == type_)
+    return "";
+  return value_.str();
+}
+
+void XmlNode::set_text(const std::string & text) {
+  if (DECLARATION == type_)
+    return;
+  
+  // For element, text is a child of parent, in the same pool
+  if (ELEMENT == type_) {
+    XmlNode child(TEXT);
+    if (NULL != ValuePool())
+      child.source_ = source_;
+    child.setValue(XmlSpecialCharEncode(trim(text)));
+    PushChild(child);
+    return;
+  }
+  
+  touch();
+  setValue(XmlSpecialCharEncode(trim(text)));
+}
+
+std::string XmlNode::tag() const {
+  if (ELEMENT != type_)
+    return "";
+  return value_.str();
+}
+
+void XmlNode::set_tag(const std::string & tag) {
+  if (ELEMENT != type_)
+    return;
+    
+  touch();
+  setValue(XmlSpecialCharEncode(trim(tag)));
+}
+
+std::string XmlNode::GetDecodedTag() const {
+  return XmlSpecialCharDecode(tag());
 }
 
 std::string XmlNode::GetDecodedText() const {
-  return XmlSpecialCharDecode(text_);
+  return XmlSpecialCharDecode(text());
 }
 
 // General string to xml string
 std::string XmlNode::XmlSpecialCharEncode(std::string str) {
+  std::string result;
+  result.reserve(str.size());
+  XmlSpecialCharEncode(str.data(), str.size(), result);
 
-  str = replaceAll(str, "&" , "&amp;");
-  str = replaceAll(str, "<" , "&lt;");
-  str = replaceAll(str, ">" , "&gt;");
-  str = replaceAll(str, "\'", "&apos;");
-  str = replaceAll(str, "\"", "&quot;");
-
-  return str;
+  return result;
 }
 
 // Xml string to General string
 std::string XmlNode::XmlSpecialCharDecode(std::string str) {
-  str = replaceAll(str, "&lt;"  , "<");
-  str = replaceAll(str, "&gt;"  , ">");
-  str = replaceAll(str, "&apos;", "\'");
-  str = replaceAll(str, "&quot;", "\"");
-  str = replaceAll(str, "&amp;" , "&");
+  std::string result;
+  result.reserve(str.size());
+  XmlSpecialCharDecode(str.data(), str.size(), result);
 
-  return str;
+  return result;
+}
+
+// One pass, unchanged runs are appended as a whole
+void XmlNode::XmlSpecialCharEncode(const char * data, size_t size, std::string & out) {
+  const char * end = data + size;
+  const char * run = data;
+
+  for (const char * scan = data; scan != end; ++scan) {
+    const char * entity = NULL;
+    switch (*scan) {
+      case '&':
+        entity = "&amp;";
+        break;
+      case '<':
+        entity = "&lt;";
+        break;
+      case '>':
+        entity = "&gt;";
+        break;
+      case '\'':
+        entity = "&apos;";
+        break;
+      case '\"':
+        entity = "&quot;";
+        break;
+    }
+
+    if (NULL != entity) {
+      out.append(run, scan - run);
+      out.append(entity);
+      run = scan + 1;
+    }
+  }
+
+  out.append(run, end - run);
+}
+
+namespace {
+
+const char * kEntities[] = {"&lt;", "&gt;", "&apos;", "&quot;", "&amp;"};
+const char kEntityCharacters[] = {'<', '>', '\'', '\"', '&'};
+const size_t kEntitySizes[] = {4, 4, 6, 6, 5};
+const size_t kNumOfEntities = 5;
+
+/*
+  Index of the entity starting at scan, or kNumOfEntities
+*/
+size_t matchEntity(const char * scan, const char * end) {
+  size_t index = 0;
+  for (; index < kNumOfEntities; ++index) {
+    if (static_cast<size_t>(end - scan) >= kEntitySizes[index] &&
+        0 == memcmp(scan, kEntities[index], kEntitySizes[index]))
+      break;
+  }
+
+  return index;
+}
+
+}
+
+void XmlNode::XmlSpecialCharDecode(const char * data, size_t size, std::string & out) {
+
+  const char * end = data + size;
+  const char * run = data;
+  const char * scan = data;
+
+  while (scan != end) {
+    if ('&' != *scan) {
+      ++scan;
+      continue;
+    }
+
+    size_t index = matchEntity(scan, end);
+    if (kNumOfEntities == index) {
+      ++scan;
+      continue;
+    }
+
+    out.append(run, scan - run);
+    out.push_back(kEntityCharacters[index]);
+    scan += kEntitySizes[index];
+    run = scan;
+  }
+
+  out.append(run, end - run);
+}
+
+size_t XmlNode::XmlSpecialCharDecodeInPlace(char * data, size_t size) {
+  char * end = data + size;
+  char * scan = static_cast<char *>(memchr(data, '&', size));
+  if (NULL == scan)
+    return size;
+
+  char * out = scan;
+  while (scan != end) {
+    size_t index = ('&' == *scan) ? matchEntity(scan, end) : kNumOfEntities;
+    if (kNumOfEntities == index) {
+      *out++ = *scan++;
+      continue;
+    }
+
+    *out++ = kEntityCharacters[index];
+    scan += kEntitySizes[index];
+  }
+
+  return out - data;
+}
+
+void XmlNode::XmlSpecialCharNormalize(const char * data, size_t size, std::string & out) {
+  const char * end = data + size;
+  const char * run = data;
+  const char * scan = data;
+
+  while (scan != end) {
+    const char * entity = NULL;
+    switch (*scan) {
+      case '&':
+        // A known entity is already in stored form
+        if (kNumOfEntities != matchEntity(scan, end)) {
+          ++scan;
+          continue;
+        }
+        entity = "&amp;";
+        break;
+      case '<':
+        entity = "&lt;";
+        break;
+      case '>':
+        entity = "&gt;";
+        break;
+      case '\'':
+        entity = "&apos;";
+        break;
+      case '\"':
+        entity = "&quot;";
+        break;
+      default:
+        ++scan;
+        continue;
+    }
+
+    out.append(run, scan - run);
+    out.append(entity);
+    ++scan;
+    run = scan;
+  }
+
+  out.append(run, end - run);
 }
 
 
@@ -627,20 +1340,18 @@ std::string XmlNode::showIndent(int indent) {
 
 // trim from start
 std::string XmlNode::lTrim(std::string str) {
-  std::string::iterator it = 
-    find_if(str.begin(),
-            str.end(),
-            std::not1(std::ptr_fun(std::isspace)));
+  std::string::iterator it = str.begin();
+  while (it != str.end() && isWhiteSpace(*it))
+    ++it;
   str.erase(str.begin(), it);
   return str;
 }
 
 // trim from end
 std::string XmlNode::rTrim(std::string str) {
-  std::string::reverse_iterator it = 
-    find_if(str.rbegin(), 
-            str.rend(),
-            std::not1(std::ptr_fun(std::isspace)));
+  std::string::reverse_iterator it = str.rbegin();
+  while (it != str.rend() && isWhiteSpace(*it))
+    ++it;
   str.erase(it.base(), str.end());
   return str;
 }
@@ -664,7 +1375,7 @@ std::string XmlNode::replaceAll(std::string origin, // the Origin string
     
   int i = 0;
   // It's funny. I should cast unsigned int to int
-  while (i < static_cast<int>(origin.size()) - from_size) {
+  while (i <= static_cast<int>(origin.size()) - from_size) {
     if (0 == origin.compare(i, from_size, from)) {
       origin.replace(i, from_size, to);
       i += to_size;
@@ -676,10 +1387,6 @@ std::string XmlNode::replaceAll(std::string origin, // the Origin string
   return origin;                       
 }
 
-bool XmlNode::isWhiteSpace(const char c) {
-  return ( isspace( (unsigned char) c ) || c == '\n' || c == '\r' );
-}
-
 std::vector<std::string> XmlNode::xpathSplit(const std::string & path) {
   std::vector<std::string> vec;
   size_t start = 0;
@@ -704,42 +1411,33 @@ std::vector<std::string> XmlNode::xpathSplit(const std::string & path) {
 /////////////////////////////////////////////
 // Private member functions
 
-std::string XmlNode::ToStringAsElement(int indent) const {
-  std::string new_line_sep = (-1 == indent) ? "" : "\n";
-
-  // Init result with open tag
-  std::string result = showIndent(indent) + "<" + tag_;
+/*
+  Open and close tags of an element, as ToString writes them
+*/
+void XmlNode::appendOpenTag(std::string & out, int indent) const {
+  out += showIndent(indent) + "<";
+  out += value_.view();
   
   // Traverse Attributes
-  for (std::map<std::string, std::string>::const_iterator it = attributes_.begin();
+  for (AttributeMap::const_iterator it = attributes_.begin();
        it != attributes_.end();
        ++it) {
-    result += " " + it->first + "=\"" + it->second + "\"";
+    out += " " + it->first + "=\"";
+    out += it->second.view();
+    out += "\"";
   }
   
-  result += ">" + new_line_sep;
-  
-  /*
-   In the latest design, I push the text as a child of element,
-   thus, these code is not needed any more.
-  // Append text
-  if (!text_.empty())
-    result += showIndent(indent + 1) + text_ + "\n";
-  */
-  
-  // Append children
-  XmlNode * p_child;
-  int child_indent = (-1 == indent) ? -1 : indent + 1;
-  for (p_child = this->first_child_; 
-       NULL != p_child; 
-       p_child = p_child->NextSibling()) {
-    result += p_child->ToString(child_indent);
-  }
-
-  // Append close tag
-  result += showIndent(indent) + "</" + tag_ + ">" + new_line_sep;
+  out += ">";
+  if (-1 != indent)
+    out += "\n";
+}
 
-  return result;
+void XmlNode::appendCloseTag(std::string & out, int indent) const {
+  out += showIndent(indent) + "</";
+  out += value_.view();
+  out += ">";
+  if (-1 != indent)
+    out += "\n";
 }
 
 std::string XmlNode::ToStringAsComment(int indent) const {
@@ -747,7 +1445,7 @@ std::string XmlNode::ToStringAsComment(int indent) const {
 
   // In XML 1.1, '--' is not allowed in text.
   // While, it should be check when init a comment.
-  std::string result = showIndent(indent) + "<!-- " + text_ + " -->" + new_line_sep;
+  std::string result = showIndent(indent) + "<!-- " + value_.str() + " -->" + new_line_sep;
   
   return result;
 }
@@ -767,7 +1465,7 @@ std::string XmlNode::ToStringAsDeclaration(int indent) const {
 }
 
 std::string XmlNode::ToStringAsUnknown(int indent) const {
-  std::string result = (text_.empty()) ? "" : showIndent(indent) + text_;
+  std::string result = (value_.empty()) ? "" : showIndent(indent) + value_.str();
   result += "\n";
   
   return result;
@@ -776,295 +1474,329 @@ std::string XmlNode::ToStringAsUnknown(int indent) const {
 std::string XmlNode::ToStringAsText(int indent) const {
   std::string new_line_sep = (-1 == indent) ? "" : "\n";
 
-  std::string result = (text_.empty()) ? "" : showIndent(indent) + text_;
+  std::string result = (value_.empty()) ? "" : showIndent(indent) + value_.str();
   result += new_line_sep;
   
   return result;
 }
 
-std::string XmlNode::ToStringAsDOCUMENT(int indent) const {
-  std::string result = "";
-  
-  XmlNode * scan = first_child_;
-  while (NULL != scan) {
-    result += scan->ToString(indent);
-    scan = scan->next_;
-  }
-  
-  return result;
-}
-
-XmlNode * XmlNode::ParseNext(const std::string & content, // Content to Parse
-                             int & start,                   // Parse index
-                             NodeParseFlag & flag,        // flag of result
-                             std::string & id) {          // id for element parsing
-  EatWhiteSpace(content, start);
-  
-  if (0 > start || start >= content.size()) {
-    return NULL;
-  }
+/*
+  Write the subtree in document order, the children of an element one
+  indent deeper than it, those of a document at its own indent. There
+  is no recursion: the walk goes down first child links, and back up
+  parent links, closing each element it leaves. Deep trees only cost
+  the string.
+
+  With raw, a node with a source span is copied as it was read, and
+  the walk does not go below it.
+*/
+void XmlNode::appendString(std::string & out, int indent, bool raw) const {
+  const XmlNode * scan = this;
+
+  while (true) {
+    bool container = false;
+    if (raw && scan->HasRawXml()) {
+      out.append(scan->source_->content, scan->span_begin_,
+                 scan->span_end_ - scan->span_begin_);
+    } else if (ELEMENT == scan->type_) {
+      scan->appendOpenTag(out, indent);
+      container = true;
+    } else if (DOCUMENT == scan->type_) {
+      container = true;
+    } else {
+      out += scan->ToString(indent);
+    }
 
-  XmlNode * result_node = NULL;
-  
-  // TEXT
-  if ('<' != content[start]) {
-    std::string text = "";
-    do {
-      text += content[start];
-    } while (++start < content.size() && '<' != content[start]);
-    
-    result_node = new XmlNode(TEXT, text);
-    flag = SELF_CLOSE_TAG;
-    id = "";
-    return result_node;
-  }
-  
-  start++;
-  // Comment
-    if (MatchedStr(content, start, "!--")) {
-    std::string text = "";
-    do {
-      if (MatchedStr(content, start, "-->")) {
-        result_node = new XmlNode(COMMENT, text);
-        flag = SELF_CLOSE_TAG;
-        id = "";
-        return result_node;
-      }
-      text += content[start++];
-    } while (start < content.size());
-    return NULL;
-  }
-  
-  // Declaration
-  if (MatchedStr(content, start, "?xml")) {
-    std::string text = "";
-    do {
-      if (MatchedStr(content, start, "?>")) {
-        result_node = new XmlNode(DECLARATION);
-        result_node->SetAttributes(text);
-        flag = SELF_CLOSE_TAG;
-        id = "";
-        return result_node;
+    if (container) {
+      scan->expand();
+      if (NULL != scan->first_child_) {
+        if (ELEMENT == scan->type_ && -1 != indent)
+          ++indent;
+        scan = scan->first_child_;
+        continue;
       }
-      text += content[start++];
-    } while (start < content.size());
-    return NULL;
-  }
-  
-  // ELEMENT
-  // Close tag
-  if (MatchedStr(content, start, "/")) {
-    id = "";
-    do {
-      if (MatchedStr(content, start, ">")) {
-        flag = CLOSE_TAG;
-        id = XmlSpecialCharEncode(trim(id));
-        return result_node;
+    }
+
+    // Leave scan, and every ancestor it is the last child of
+    while (true) {
+      if (ELEMENT == scan->type_ && !(raw && scan->HasRawXml()))
+        scan->appendCloseTag(out, indent);
+      if (this == scan)
+        return;
+      if (NULL != scan->next_) {
+        scan = scan->next_;
+        break;
       }
-      id += content[start]; 
-    } while (++start < content.size());
-    return NULL;
-  }
-  
-  // OPEN TAG
-  std::string tag_str = "";
-  // Parse Tag;
-  while (start < content.size() &&
-         !isWhiteSpace(content[start]) &&
-         '>' != content[start]) {
-    tag_str += content[start++];
-  }
-  
-  // Parse Attribute
-  std::string attribute_str = "";
-  if ('>' != content[start]) {
-    while (++start < content.size() &&
-           '>' != content[start]) {
-      attribute_str += content[start];       
+
+      scan = scan->parent_;
+      if (ELEMENT == scan->type_ && -1 != indent)
+        --indent;
     }
   }
-  if (start < content.size() && !tag_str.empty()) {
-    result_node = new XmlNode(ELEMENT, tag_str);
-    result_node->SetAttributes(attribute_str);
-    flag = OPEN_TAG;
-    id = "";
+}
+
+/*
+  Children of a lazy node are parsed the first time they are needed,
+  then the node is a plain node. A failed parse keeps the children
+  found before the error.
+*/
+void XmlNode::expand() const {
+  if (!lazy_)
+    return;
+
+  XmlParser parser;
+  parser.Expand(const_cast<XmlNode &>(*this));
+}
+
+/*
+  Nodes without span have no span above them either, the walk
+  stops at the first one.
+*/
+void XmlNode::touch() {
+  for (XmlNode * scan = this;
+       NULL != scan && (scan->span_begin_ != scan->span_end_ || 0 != scan->hash_);
+       scan = scan->parent_) {
+    scan->span_begin_ = 0;
+    scan->span_end_ = 0;
+    scan->hash_ = 0;
   }
-  ++start;
-  
-  return result_node;
 }
 
-bool XmlNode::MatchedStr(
-  const std::string & content, 
-  int & index,
-  const std::string & query) const {
+bool XmlNode::sameValue(const XmlNode & node) const {
+  return type_ == node.type_ && value_ == node.value_ &&
+         attributes_ == node.attributes_;
+}
 
-  if (query.empty())
-    return true;
+void XmlNode::unlinkChild(XmlNode * child) {
+  if (NULL != child->prev_)
+    child->prev_->next_ = child->next_;
+  else
+    first_child_ = child->next_;
 
-  if (index + query.size() - 1 >= content.size())
-    return false;
+  if (NULL != child->next_)
+    child->next_->prev_ = child->prev_;
+  else
+    last_child_ = child->prev_;
+}
 
-  int old_index = index;
-  EatWhiteSpace(content, index);
-  for (size_t query_i = 0; query_i < query.size(); ++query_i) {
-    if (query[query_i] != content[index++]) {
-      index = old_index;
-      return false;
-    }
+void XmlNode::relinkChildren(const std::vector<XmlNode *> & children) {
+  XmlNode * prev = NULL;
+  for (size_t index = 0; index < children.size(); ++index) {
+    children[index]->prev_ = prev;
+    children[index]->next_ = (index + 1 < children.size()) ? children[index + 1] : NULL;
+    prev = children[index];
   }
 
-  return true;
+  first_child_ = children.empty() ? NULL : children.front();
+  last_child_ = prev;
 }
 
-bool XmlNode::ReadNode(std::string content, int & index) {
-    
-  std::stack<XmlNode *> parse_stack;
-  
-  NodeParseFlag flag = UNDEFINE;
-  std::string id_str = "";
-  int content_size = content.size();
-  
-  XmlNode * tmp_node_ptr = ParseNext(content, index, flag, id_str);
-  
-  // Init this node as empty text;
-  Clear();
-  
-  if (UNDEFINE == flag)
-    return false;
-  
-  // Copy the first parsed node to this.
-  if (NULL != tmp_node_ptr) {
-    *this = *tmp_node_ptr;
-    delete tmp_node_ptr;
-    tmp_node_ptr = NULL;
-  }
-  
-  if (SELF_CLOSE_TAG == flag) { // It doesn't has children
-    return true;
-  }
-  
-  if (OPEN_TAG == flag){
-    parse_stack.push(this);
-  }
-  
-  while (0 != parse_stack.size() && index < content.size()) {
-    tmp_node_ptr = NULL;
-    flag = UNDEFINE;
-    tmp_node_ptr = ParseNext(content, index, flag, id_str);
-    
-    // A self closed tag, a child of top element
-    if (SELF_CLOSE_TAG == flag) {
-      XmlNode * node_ptr = parse_stack.top();
-      if (NULL != node_ptr) {
-        node_ptr->PushChild(*tmp_node_ptr);
-        delete tmp_node_ptr;
-        tmp_node_ptr = NULL;
-        continue;
-      } else {
-        delete tmp_node_ptr;
-        return false;
-      }
-    }
-    
-    // A Open tag
-    if (OPEN_TAG == flag) {
-      parse_stack.push(tmp_node_ptr);
-      continue;
-    }
-    
-    // Close tag of an element
-    if (CLOSE_TAG == flag) {
-      XmlNode * node_ptr = parse_stack.top();
-      if (id_str != node_ptr->tag_) {
-        // Clean the stack, release memory
-        while (this != parse_stack.top()) {
-          XmlNode * ptr = parse_stack.top();
-          parse_stack.pop();
-          delete ptr;
-        }
-        return false;
-      }
-      
-      if (node_ptr == this) {
-        return true;
-      }
-      
-      // id matchs, it is not this pointer
-      parse_stack.pop();
-      if (NULL != parse_stack.top()) {
-        parse_stack.top()->PushChild(*node_ptr);
-        delete node_ptr;
-      }
+/*
+  Children are deleted one level at a time: before a child is deleted,
+  its own children are moved up behind it, so it has none left and its
+  destructor does not go deeper. Every node is moved at most once per
+  level it climbs, and the stack never grows with the depth.
+*/
+void XmlNode::releaseChildren() {
+  XmlNode * scan = first_child_;
+  first_child_ = NULL;
+  last_child_ = NULL;
+
+  while (NULL != scan) {
+    if (NULL != scan->first_child_) {
+      scan->last_child_->next_ = scan->next_;
+      scan->next_ = scan->first_child_;
+      scan->first_child_ = NULL;
+      scan->last_child_ = NULL;
     }
 
+    XmlNode * tmp = scan;
+    scan = scan->next_;
+    delete tmp;
   }
-  
-  return true;
 }
 
-bool XmlNode::ReadDocument(std::string content, int & index) {
-  int content_size = content.size();
-  
-  while (index < content_size) {
-    XmlNode tmp_node;
-    if (tmp_node.Read(content, index)) {
-      PushChild(tmp_node);
-    }
+/*
+  Short values are kept inline anyway
+*/
+void XmlNode::setValue(const std::string & value) {
+  setValue(value_, value);
+}
+
+void XmlNode::setValue(XmlValue & stored, const std::string & value) const {
+  if (value.size() > XmlValue::kInlineSize && NULL != ValuePool()) {
+    stored.slice(source_->values->Intern(value));
+    return;
   }
-  
-  return true;
+
+  stored.assign(value);
 }
 
-void XmlNode::EatWhiteSpace(const std::string & content, int & start) const {
-  if (0 > start)
-    start = 0;
+bool XmlNode::hasSlice() const {
+  if (XmlValue::SLICE == value_.kind())
+    return true;
+  for (AttributeMap::const_iterator it = attributes_.begin(); it != attributes_.end(); ++it) {
+    if (XmlValue::SLICE == it->second.kind())
+      return true;
+  }
+  return false;
+}
 
-  while (start < content.size()) {
-   char c = content[start];
-   if (isWhiteSpace(c)) {
-      ++start;  
-    }
-    else {
-      break;
+/*
+  Everything but the links
+*/
+void XmlNode::copyValue(const XmlNode & node) {
+  type_ = node.type_;
+  value_ = node.value_;
+  attributes_ = node.attributes_;
+  source_ = node.source_;
+  lazy_ = node.lazy_;
+  lazy_begin_ = node.lazy_begin_;
+  span_begin_ = node.span_begin_;
+  span_end_ = node.span_end_;
+  hash_ = node.hash_;
+}
+
+/*
+  Copy the children of node below this, with an explicit stack of
+  (original, copy) pairs instead of recursion, like
+  XmlSnapshot::Node::ToXmlNode. Copies are linked directly, so the
+  spans they carry stay.
+*/
+void XmlNode::copyChildren(const XmlNode & node) {
+  std::vector<std::pair<const XmlNode *, XmlNode *> > stack;
+  stack.push_back(std::make_pair(&node, this));
+
+  while (!stack.empty()) {
+    const XmlNode * from = stack.back().first;
+    XmlNode * to = stack.back().second;
+    stack.pop_back();
+
+    for (const XmlNode * child = from->first_child_; NULL != child; child = child->next_) {
+      XmlNode * p_child = new XmlNode(TEXT);
+      p_child->copyValue(*child);
+      p_child->parent_ = to;
+      p_child->prev_ = to->last_child_;
+      if (NULL != to->last_child_)
+        to->last_child_->next_ = p_child;
+      else
+        to->first_child_ = p_child;
+      to->last_child_ = p_child;
+
+      if (NULL != child->first_child_)
+        stack.push_back(std::make_pair(child, p_child));
     }
   }
 }
 
-const XmlNode * XmlNode::xPathRec(std::queue<std::string> paths)const {
-  const XmlNode * return_node = NULL;
+/*
+  With no step at all, the only match is root
+*/
+void XmlNode::xpathStart(XPathState & state, const XmlNode * root, std::string_view path) {
+  state.root = root;
+  state.path = path;
+  state.depth = 0;
+  state.step_begin = 0;
+  state.step_end = 0;
+
+  if (!nextStep(path, state.step_begin, state.step_end)) {
+    state.node = root;
+    return;
+  }
 
-  if (0 == paths.size())
-    return NULL;
+  state.node = root->FirstChild();
+  xpathFind(state, false);
+}
 
-  if (1 == paths.size() &&
-      ELEMENT == type_ &&
-      tag_ == paths.front()) {
-    return this;
+/*
+  Depth first, without recursion. A candidate which matches its step
+  is entered, otherwise the search goes on with the next sibling,
+  climbing back as long as there is none.
+*/
+void XmlNode::xpathFind(XPathState & state, bool skip) {
+  if (state.node == state.root) {
+    state.node = NULL;
+    return;
   }
-  
-  if (ELEMENT == type_ && 
-      tag_ == paths.front()) {
-    paths.pop();
-    for (XmlNode *scan = first_child_;
-        scan != NULL;
-        scan = scan->next_) {
-      return_node = scan->xPathRec(paths);
-    
-      if (NULL != return_node)
-        return return_node;
+
+  const XmlNode * scan = state.node;
+  while (NULL != scan) {
+    std::string_view step = state.path.substr(state.step_begin, state.step_end - state.step_begin);
+    if (!skip && ELEMENT == scan->type_ && scan->value_ == step) {
+      if (isLastStep(state.path, state.step_end)) {
+        state.node = scan;
+        return;
+      }
+
+      scan->expand();
+      if (NULL != scan->first_child_) {
+        scan = scan->first_child_;
+        ++state.depth;
+        nextStep(state.path, state.step_begin, state.step_end);
+        continue;
+      }
+    }
+    skip = false;
+
+    while (NULL == scan->next_) {
+      if (0 == state.depth) {
+        state.node = NULL;
+        return;
+      }
+      scan = scan->parent_;
+      --state.depth;
+      previousStep(state.path, state.step_begin, state.step_end);
     }
+    scan = scan->next_;
   }
 
-  return NULL;
+  state.node = NULL;
 }
-
 }
 
 #ifdef DEMO_SMALLXML
 
 #include <iostream>
 
+#ifdef DEMO_SNAPSHOT
+#include "XmlSnapshot.h"
+#endif
+
+#ifdef DEMO_WRITER
+#include "XmlWriter.h"
+#endif
+
+#ifdef DEMO_INDEX
+#include <ctime>
+#endif
+
+#ifdef DEMO_INSITU
+#include "XmlInSitu.h"
+#endif
+
+#ifdef DEMO_MATCHER
+#include "XmlMatcher.h"
+#endif
+
+#ifdef DEMO_FILE
+#include <cstdio>
+#include "XmlFile.h"
+#endif
+
+#ifdef DEMO_LOADER
+#include <cstdio>
+#include "XmlLoader.h"
+#endif
+
+#ifdef DEMO_BINDING
+#include "XmlBinding.h"
+#endif
+
+#ifdef DEMO_VERSIONED
+#include <thread>
+#include "XmlVersioned.h"
+#endif
+
 using namespace std;
 using namespace SmallXml;
 
@@ -1078,6 +1810,48 @@ void test_parser();
 void test_find();
 // Text XPath
 void test_xpath();
+// Test Snapshot save and load
+void test_snapshot();
+// Test XmlWriter
+void test_writer();
+// Test structural index and compare throughput
+void test_index();
+// Test in situ parsing
+void test_insitu();
+// Test source spans
+void test_spans();
+// Test traversal of deep documents
+void test_traversal();
+// Test ranges
+void test_ranges();
+// Test removing and moving children
+void test_remove();
+// Test sorting children
+void test_sort();
+// Test streaming match
+void test_matcher();
+// Test typed values
+void test_typed();
+// Test hash, equality and diff
+void test_diff();
+// Test compressed files
+void test_file();
+// Test loading many files
+void test_loader();
+// Test struct binding
+void test_binding();
+// Test paths split at compile time
+void test_static_path();
+// Test versioned documents
+void test_versioned();
+// Test retained capacity
+void test_retain();
+// Test compact node values
+void test_value();
+// Test the value pool
+void test_value_pool();
+// Test encodings
+void test_encoding();
 
 
 int main(int argc, char ** argv) {
@@ -1102,6 +1876,90 @@ int main(int argc, char ** argv) {
   test_xpath();
 #endif
 
+#ifdef DEMO_SNAPSHOT
+  test_snapshot();
+#endif
+
+#ifdef DEMO_WRITER
+  test_writer();
+#endif
+
+#ifdef DEMO_INDEX
+  test_index();
+#endif
+
+#ifdef DEMO_INSITU
+  test_insitu();
+#endif
+
+#ifdef DEMO_SPANS
+  test_spans();
+#endif
+
+#ifdef DEMO_TRAVERSAL
+  test_traversal();
+#endif
+
+#ifdef DEMO_RANGES
+  test_ranges();
+#endif
+
+#ifdef DEMO_REMOVE
+  test_remove();
+#endif
+
+#ifdef DEMO_SORT
+  test_sort();
+#endif
+
+#ifdef DEMO_MATCHER
+  test_matcher();
+#endif
+
+#ifdef DEMO_TYPED
+  test_typed();
+#endif
+
+#ifdef DEMO_DIFF
+  test_diff();
+#endif
+
+#ifdef DEMO_FILE
+  test_file();
+#endif
+
+#ifdef DEMO_LOADER
+  test_loader();
+#endif
+
+#ifdef DEMO_BINDING
+  test_binding();
+#endif
+
+#ifdef DEMO_STATIC_PATH
+  test_static_path();
+#endif
+
+#ifdef DEMO_VERSIONED
+  test_versioned();
+#endif
+
+#ifdef DEMO_RETAIN
+  test_retain();
+#endif
+
+#ifdef DEMO_VALUE
+  test_value();
+#endif
+
+#ifdef DEMO_VALUE_POOL
+  test_value_pool();
+#endif
+
+#ifdef DEMO_ENCODING
+  test_encoding();
+#endif
+
   return 0;
 }
 
@@ -1117,6 +1975,12 @@ void test_ToString() {
   elem2.SetAttribute("hello", "world");
   elem2.SetAttribute("syracuse", "syracuse ny");
   cout << elem2.ToString();
+
+  // The text child of an element is encoded once, like a text node
+  XmlNode special(XmlNode::ELEMENT, "Special");
+  special.set_text("a < b & c");
+  cout << special.ToString(-1) << "\n";
+  cout << "Decoded: " << special.FirstChild()->GetDecodedText() << "\n";
   
   cout << "Comment\n";
   XmlNode elem3(XmlNode::COMMENT, "Some Comment");
@@ -1158,6 +2022,10 @@ void test_inserts() {
   elem0.InsertChildAfter(elem4, p_new_elem1);
   cout << elem0.ToString(1);
   cout << "\nNow parent has " << elem0.NumOfChildren() << " children.\n";
+  XmlNode doc(XmlNode::DOCUMENT);
+  doc.Read("<?xml version=\"1.0\"?><a>text</a><!-- end -->");
+  cout << "A document with " << doc.NumOfChildren() << " children, its text has "
+       << doc.XPath("/a")->FirstChild()->NumOfChildren() << ".\n";
   cout << "\nParent has attribute \"href\" => \"" << elem0.GetAttribute("href") << "\"\n";
 }
 
@@ -1236,6 +2104,17 @@ void test_parser() {
   cout << "size = " << conj.size() << "\n";
   cout << "index = " << index << "\n";
 
+  cout << "\nProjection, \"*\" and a named step\n";
+  string catalog = "<catalog><item><name>a</name><price>1</price><id>7</id></item>"
+                   "<info><price>2</price><name>b</name></info></catalog>";
+  XmlNode wild_first(XmlNode::DOCUMENT);
+  wild_first.Read(catalog, ParseProjection{"/catalog/*/price", "/catalog/item/name"});
+  cout << wild_first.ToString(-1) << "\n";
+  XmlNode named_first(XmlNode::DOCUMENT);
+  named_first.Read(catalog, ParseProjection{"/catalog/item/name", "/catalog/*/price"});
+  cout << named_first.ToString(-1) << "\n";
+  cout << "Same trees: " << (wild_first.ToString(-1) == named_first.ToString(-1) ? "yes" : "no") << "\n";
+
   return;
 }
 
@@ -1323,4 +2202,889 @@ void test_xpath() {
     cout << "NOT FOUND\n";
 }
 
+#ifdef DEMO_SNAPSHOT
+void test_snapshot() {
+  cout << "\n----- Test Snapshot -----\n";
+  string xml = "<?xml version=\"1.1\" encoding=\"UTF-8\"?>"
+               "<SU city=\"Syracuse\"><LCSmith><EECS>EECS Content</EECS></LCSmith>"
+               "<!-- Quad --><Whitman school=\"management\"></Whitman></SU>";
+  XmlNode doc(XmlNode::DOCUMENT);
+  doc.Read(xml);
+  cout << doc.ToString();
+
+  if (!XmlSnapshot::SaveSnapshot(doc, "Demo_Snapshot.sxs")) {
+    cout << "SaveSnapshot failed\n";
+    return;
+  }
+
+  XmlSnapshot snapshot;
+  if (!snapshot.LoadSnapshot("Demo_Snapshot.sxs")) {
+    cout << "LoadSnapshot failed\n";
+    return;
+  }
+
+  XmlSnapshot::Node root = snapshot.Root();
+  cout << "Nodes in snapshot: " << snapshot.NumOfNodes() << "\n";
+  cout << "Same ToString(): " << (root.ToString() == doc.ToString() ? "yes" : "no") << "\n";
+  cout << "Same ToString(-1): " << (root.ToString(-1) == doc.ToString(-1) ? "yes" : "no") << "\n";
+
+  XmlSnapshot::Node su = root.FirstChild().NextSibling();
+  cout << "Tag of second child: " << su.tag() << "\n";
+  cout << "city => " << su.GetAttribute("city") << "\n";
+  cout << su.LastChild().ToString(1);
+
+  XmlNode rebuilt;
+  su.ToXmlNode(rebuilt);
+  cout << "Rebuilt XPath /LCSmith/EECS\n";
+  const XmlNode * p_found = rebuilt.XPath("/LCSmith/EECS");
+  cout << (NULL != p_found ? p_found->ToString() : "NOT FOUND\n");
+
+  // Damage every byte in front of the string table, one at a time. A
+  // copy either fails to load or is walked without leaving the file.
+  FILE * file = fopen("Demo_Snapshot.sxs", "rb");
+  string saved;
+  char buffer[4096];
+  size_t read_size = 0;
+  while (NULL != file && 0 < (read_size = fread(buffer, 1, sizeof(buffer), file)))
+    saved.append(buffer, read_size);
+  if (NULL != file)
+    fclose(file);
+
+  XmlSnapshot::Header header;
+  memcpy(&header, saved.data(), sizeof(header));
+  int rejected = 0;
+  int loaded = 0;
+  for (size_t pos = 0; pos < header.strings_offset; ++pos) {
+    string damaged = saved;
+    damaged[pos] ^= 0x5a;
+    file = fopen("Demo_Snapshot_Damaged.sxs", "wb");
+    fwrite(damaged.data(), 1, damaged.size(), file);
+    fclose(file);
+
+    XmlSnapshot damaged_snapshot;
+    if (!damaged_snapshot.LoadSnapshot("Demo_Snapshot_Damaged.sxs")) {
+      ++rejected;
+      continue;
+    }
+    ++loaded;
+    XmlNode damaged_node;
+    damaged_snapshot.Root().ToXmlNode(damaged_node);
+    damaged_snapshot.Root().ToString();
+  }
+  cout << "Damaged copies rejected: " << rejected << ", loaded: " << loaded << "\n";
+
+  // The last child link of the root, pointing back at the root
+  string cycle = saved;
+  uint32_t root_index = 0;
+  memcpy(&cycle[header.nodes_offset + offsetof(XmlSnapshot::NodeRecord, last_child)],
+         &root_index, sizeof(root_index));
+  file = fopen("Demo_Snapshot_Damaged.sxs", "wb");
+  fwrite(cycle.data(), 1, cycle.size(), file);
+  fclose(file);
+  XmlSnapshot cycle_snapshot;
+  cout << "Cycle loaded: "
+       << (cycle_snapshot.LoadSnapshot("Demo_Snapshot_Damaged.sxs") ? "yes" : "no") << "\n";
+
+  // Saving over a loaded snapshot replaces the file, the loaded one
+  // still reads the old tree
+  XmlNode other(XmlNode::DOCUMENT);
+  other.Read("<other>Replaced</other>");
+  XmlSnapshot::SaveSnapshot(other, "Demo_Snapshot.sxs");
+  cout << "Loaded before saving again: " << snapshot.Root().ToString(-1) << "\n";
+  XmlSnapshot replaced;
+  replaced.LoadSnapshot("Demo_Snapshot.sxs");
+  cout << "Loaded after saving again: " << replaced.Root().ToString(-1) << "\n";
+}
+#endif
+
+#ifdef DEMO_WRITER
+void test_writer() {
+  cout << "\n----- Test XmlWriter -----\n";
+  string written;
+  XmlStringSink sink(written);
+  XmlWriter writer(sink, 0, 16);
+  writer.Declaration();
+  writer.StartElement("SU");
+  writer.Attribute("city", "Syracuse & NY");
+  writer.StartElement("LCSmith");
+  writer.Text("  The 1st LCSmith ");
+  writer.StartElement("EECS");
+  writer.EndElement();
+  writer.EndElement();
+  writer.Comment("Quad");
+  writer.EndElement();
+  cout << "Finish: " << (writer.Finish() ? "ok" : "failed") << "\n";
+  cout << written;
+
+  XmlNode doc(XmlNode::DOCUMENT);
+  doc.PushChild(XmlNode(XmlNode::DECLARATION));
+  XmlNode * p_su = doc.PushChild(XmlNode(XmlNode::ELEMENT, "SU"));
+  p_su->SetAttribute("city", "Syracuse & NY");
+  XmlNode * p_lcsmith = p_su->PushChild(XmlNode(XmlNode::ELEMENT, "LCSmith"));
+  p_lcsmith->set_text("  The 1st LCSmith ");
+  p_lcsmith->PushChild(XmlNode(XmlNode::ELEMENT, "EECS"));
+  p_su->PushChild(XmlNode(XmlNode::COMMENT, "Quad"));
+  cout << "Same as ToString(): " << (written == doc.ToString() ? "yes" : "no") << "\n";
+
+  cout << "Attribute after content\n";
+  string broken;
+  XmlStringSink broken_sink(broken);
+  XmlWriter broken_writer(broken_sink, -1);
+  broken_writer.StartElement("a");
+  broken_writer.Text("text");
+  cout << (broken_writer.Attribute("late", "1") ? "accepted" : "rejected") << "\n";
+  cout << "Unclosed element\n";
+  XmlWriter unclosed_writer(broken_sink, -1);
+  unclosed_writer.StartElement("a");
+  cout << (unclosed_writer.Finish() ? "accepted" : "rejected") << "\n";
+}
+#endif
+
+#ifdef DEMO_INDEX
+// MB per second of size bytes handled rounds times since start
+double throughput(size_t size, int rounds, clock_t start) {
+  double seconds = double(clock() - start) / CLOCKS_PER_SEC;
+  return (0 >= seconds) ? 0 : rounds * size / 1e6 / seconds;
+}
+
+void test_index() {
+  cout << "\n----- Test Structural Index -----\n";
+  string xml = "<?xml version=\"1.1\" encoding=\"UTF-8\"?><!-- <SU> -->"
+               "<SU city=\"Syracuse > NY\"><LCSmith><EECS>EECS Content</EECS></LCSmith>"
+               "<![CDATA[ <Quad> ]]><Whitman school='management'/></SU>";
+  XmlStructuralIndex index;
+  cout << "Build: " << (index.Build(xml.data(), xml.size()) ? "ok" : "failed") << "\n";
+  cout << "Markup found: " << index.marks().size() / 2 << "\n";
+  for (size_t mark = 0; mark < index.marks().size(); mark += 2) {
+    cout << "  " << xml.substr(index.marks()[mark],
+                               index.marks()[mark + 1] - index.marks()[mark] + 1) << "\n";
+  }
+
+  XmlNode plain(XmlNode::DOCUMENT);
+  XmlNode indexed(XmlNode::DOCUMENT);
+  XmlParser(PARSE_DEFAULT).Read(xml, plain);
+  XmlParser(PARSE_DEFAULT | PARSE_STRUCTURAL_INDEX).Read(xml, indexed);
+  cout << indexed.ToString();
+  cout << "Same as plain parse: " << (plain.ToString() == indexed.ToString() ? "yes" : "no") << "\n";
+
+  // Throughput on the same corpus
+  string corpus = "<catalog>";
+  for (int item = 0; item < 20000; ++item) {
+    corpus += "<item id=\"" + to_string(item) + "\" note=\"a > b\">"
+              "<name>Item &amp; more</name><!-- price --><price>1.5</price></item>";
+  }
+  corpus += "</catalog>";
+  const int rounds = 10;
+  XmlToken token;
+
+  clock_t start = clock();
+  for (int round = 0; round < rounds; ++round) {
+    XmlTokenizer tokenizer;
+    tokenizer.Reset(corpus.data(), corpus.size());
+    while (tokenizer.Next(token)) {}
+  }
+  double scan = throughput(corpus.size(), rounds, start);
+
+  start = clock();
+  for (int round = 0; round < rounds; ++round) {
+    XmlTokenizer tokenizer;
+    index.Build(corpus.data(), corpus.size());
+    tokenizer.Reset(corpus.data(), corpus.size(), 0, &index);
+    while (tokenizer.Next(token)) {}
+  }
+  double two_stage = throughput(corpus.size(), rounds, start);
+
+  start = clock();
+  for (int round = 0; round < rounds; ++round) {
+    XmlTokenizer tokenizer;
+    tokenizer.Reset(corpus.data(), corpus.size(), 0, &index);
+    tokenizer.Next(token);
+    tokenizer.SkipElement();
+  }
+  double skip = throughput(corpus.size(), rounds, start);
+
+  XmlParser plain_parser(PARSE_DEFAULT);
+  XmlParser indexed_parser(PARSE_DEFAULT | PARSE_STRUCTURAL_INDEX);
+  start = clock();
+  for (int round = 0; round < rounds; ++round)
+    plain_parser.Read(corpus, plain);
+  double plain_parse = throughput(corpus.size(), rounds, start);
+  start = clock();
+  for (int round = 0; round < rounds; ++round)
+    indexed_parser.Read(corpus, indexed);
+  double indexed_parse = throughput(corpus.size(), rounds, start);
+
+  cout << "Corpus of " << corpus.size() << " bytes, MB/s\n";
+  cout << "  tokenize, scanning:      " << scan << "\n";
+  cout << "  tokenize, index + walk:  " << two_stage << "\n";
+  cout << "  skip root, on the index: " << skip << "\n";
+  cout << "  parse, scanning:         " << plain_parse << "\n";
+  cout << "  parse, index + walk:     " << indexed_parse << "\n";
+  cout << "Same trees: " << (plain.ToString(-1) == indexed.ToString(-1) ? "yes" : "no") << "\n";
+
+  // The index pays off when most of the content is skipped
+  string bodies = "<catalog>";
+  for (int item = 0; item < 2000; ++item) {
+    bodies += "<item><id>" + to_string(item) + "</id><body>";
+    for (int paragraph = 0; paragraph < 20; ++paragraph)
+      bodies += "<p class=\"x\">Some text &amp; more text in a paragraph</p>";
+    bodies += "</body></item>";
+  }
+  bodies += "</catalog>";
+  ParseProjection ids{"/catalog/item/id"};
+  start = clock();
+  for (int round = 0; round < rounds; ++round)
+    plain_parser.Read(bodies, ids, plain);
+  double plain_projection = throughput(bodies.size(), rounds, start);
+  start = clock();
+  for (int round = 0; round < rounds; ++round)
+    indexed_parser.Read(bodies, ids, indexed);
+  double indexed_projection = throughput(bodies.size(), rounds, start);
+
+  cout << "Corpus of " << bodies.size() << " bytes, ids only, MB/s\n";
+  cout << "  projection, scanning:     " << plain_projection << "\n";
+  cout << "  projection, on the index: " << indexed_projection << "\n";
+  cout << "Same trees: " << (plain.ToString(-1) == indexed.ToString(-1) ? "yes" : "no") << "\n";
+}
+#endif
+
+#ifdef DEMO_INSITU
+void test_insitu() {
+  cout << "\n----- Test In Situ -----\n";
+  string xml = "<?xml version=\"1.1\" encoding=\"UTF-8\"?>"
+               "<SU city=\"Syracuse &amp; NY\"><LCSmith>The 1st &lt;LCSmith&gt;</LCSmith>"
+               "<!-- Quad --><Whitman school='management'/></SU>";
+
+  // The buffer is ours to give away, with room for a terminator
+  vector<char> buffer(xml.begin(), xml.end());
+  buffer.push_back('\0');
+
+  XmlInSituDocument doc;
+  cout << "ReadInSitu: " << (doc.ReadInSitu(&buffer[0], xml.size()) ? "ok" : "failed") << "\n";
+  cout << "Nodes: " << doc.NumOfNodes() << "\n";
+
+  const XmlInSituDocument::Node * su = doc.Root()->FirstChild()->NextSibling();
+  cout << "Tag: " << su->tag() << "\n";
+  cout << "city => " << su->GetAttribute("city") << "\n";
+  cout << "Text of LCSmith: " << su->FirstChild()->FirstChild()->text() << "\n";
+  for (const XmlInSituDocument::Node * scan = su->FirstChild();
+       NULL != scan;
+       scan = scan->NextSibling()) {
+    cout << "  " << scan->type() << " " << scan->tag() << " " << scan->text() << "\n";
+  }
+  const XmlInSituDocument::Node * whitman = su->FirstChild()->NextElement("Whitman");
+  cout << "school => " << whitman->GetAttribute("school") << "\n";
+  cout << "Points into the buffer: "
+       << (whitman->tag() > &buffer[0] && whitman->tag() < &buffer[0] + buffer.size() ? "yes" : "no") << "\n";
+
+  cout << "Mismatched close tag\n";
+  string broken = "<a><b></a>";
+  vector<char> broken_buffer(broken.begin(), broken.end());
+  broken_buffer.push_back('\0');
+  cout << (doc.ReadInSitu(&broken_buffer[0], broken.size()) ? "accepted" : "rejected") << "\n";
+}
+#endif
+
+#ifdef DEMO_SPANS
+void test_spans() {
+  cout << "\n----- Test Source Spans -----\n";
+  string xml = "<?xml version=\"1.1\"?>\n"
+               "<SU city='Syracuse &amp; NY'>\n"
+               "  <LCSmith   room=\"114\"><EECS>EECS Content</EECS></LCSmith>\n"
+               "  <!-- Quad -->\n"
+               "  <Whitman school='management'/>\n"
+               "</SU>\n";
+  XmlNode doc(XmlNode::DOCUMENT);
+  XmlParser(PARSE_DEFAULT | PARSE_SOURCE_SPANS).Read(xml, doc);
+  cout << "Document is the source: " << (doc.RawXml() == xml ? "yes" : "no") << "\n";
+
+  XmlNode * p_lcsmith = doc.XPath("/SU/LCSmith");
+  XmlNode * p_whitman = doc.XPath("/SU/Whitman");
+  cout << "RawXml of LCSmith: " << p_lcsmith->RawXml() << "\n";
+  cout << "ToString of LCSmith: " << p_lcsmith->ToString(-1) << "\n";
+
+  p_whitman->SetAttribute("school", "Whitman School");
+  cout << "After editing Whitman\n";
+  cout << "  Whitman has raw xml: " << (p_whitman->HasRawXml() ? "yes" : "no") << "\n";
+  cout << "  SU has raw xml: " << (doc.XPath("/SU")->HasRawXml() ? "yes" : "no") << "\n";
+  cout << "  LCSmith has raw xml: " << (p_lcsmith->HasRawXml() ? "yes" : "no") << "\n";
+  cout << doc.ToSourceString() << "\n";
+
+  // Without PARSE_SOURCE_SPANS nothing has raw xml, not even a lazy
+  // document
+  XmlNode lazy(XmlNode::DOCUMENT);
+  XmlParser(PARSE_DEFAULT | PARSE_LAZY).Read(xml, lazy);
+  lazy.XPath("/SU/LCSmith")->set_tag("Hall");
+  cout << "Lazy document has raw xml: " << (lazy.HasRawXml() ? "yes" : "no") << "\n";
+  cout << lazy.ToSourceString() << "\n";
+}
+#endif
+
+#ifdef DEMO_TRAVERSAL
+void test_traversal() {
+  cout << "\n----- Test Traversal -----\n";
+  XmlNode doc(XmlNode::DOCUMENT);
+  doc.Read("<SU><LCSmith><EECS/></LCSmith><!-- Quad --><Whitman/></SU>");
+
+  cout << "Preorder:";
+  for (XmlNode::PreorderIterator it(&doc), end; it != end; ++it)
+    cout << " " << it->type() << ":" << it->tag();
+  cout << "\nPostorder:";
+  for (XmlNode::PostorderIterator it(&doc), end; it != end; ++it)
+    cout << " " << it->type() << ":" << it->tag();
+  cout << "\n";
+
+  // Far deeper than any call stack would allow
+  const int depth = 100000;
+  string deep;
+  string path;
+  for (int level = 0; level < depth; ++level) {
+    deep += "<level>";
+    path += "/level";
+  }
+  deep += "<leaf>bottom</leaf>";
+  for (int level = 0; level < depth; ++level)
+    deep += "</level>";
+  path += "/leaf";
+
+  XmlNode * p_deep = new XmlNode(XmlNode::DOCUMENT);
+  cout << "Read " << depth << " levels: " << (p_deep->Read(deep) ? "ok" : "failed") << "\n";
+  const XmlNode * p_leaf = p_deep->XPath(path);
+  cout << "XPath: " << (NULL != p_leaf ? p_leaf->ToString(-1) : "NOT FOUND") << "\n";
+
+  XmlNode * p_copy = new XmlNode(*p_deep);
+  cout << "Copy writes the same: " << (p_copy->ToString(-1) == deep ? "yes" : "no") << "\n";
+
+  size_t count = 0;
+  for (XmlNode::PostorderIterator it(p_copy), end; it != end; ++it)
+    ++count;
+  cout << "Nodes: " << count << "\n";
+
+  // A lazy read of the same levels steps over each body it has
+  // skipped once, expanding all of them is not quadratic
+  int lazy_options[] = {PARSE_DEFAULT | PARSE_LAZY,
+                        PARSE_DEFAULT | PARSE_LAZY | PARSE_STRUCTURAL_INDEX};
+  for (int index = 0; index < 2; ++index) {
+    XmlParser lazy_parser(lazy_options[index]);
+    XmlNode * p_lazy = new XmlNode(XmlNode::DOCUMENT);
+    cout << "Lazy read" << (0 == index ? "" : " on the index") << ": "
+         << (lazy_parser.Read(deep, *p_lazy) ? "ok" : "failed") << "\n";
+    p_leaf = p_lazy->XPath(path);
+    cout << "XPath: " << (NULL != p_leaf ? p_leaf->ToString(-1) : "NOT FOUND") << "\n";
+    cout << "Expanded writes the same: " << (p_lazy->ToString(-1) == deep ? "yes" : "no") << "\n";
+    delete p_lazy;
+  }
+
+  delete p_copy;
+  delete p_deep;
+  cout << "Released\n";
+}
+#endif
+
+#ifdef DEMO_RANGES
+void test_ranges() {
+  cout << "\n----- Test Ranges -----\n";
+  XmlNode doc(XmlNode::DOCUMENT);
+  doc.Read("<SU city=\"Syracuse\" state=\"NY\"><LCSmith><EECS/></LCSmith><!-- Quad -->"
+           "<Whitman/><LCSmith><Physics/></LCSmith></SU>");
+  XmlNode & su = *doc.FirstChild();
+
+  cout << "children:";
+  for (const XmlNode & child : su.children())
+    cout << " " << child.type() << ":" << child.tag();
+  cout << "\nelements(\"LCSmith\") backwards:";
+  XmlRange<XmlNode::ElementIterator> halls = su.elements("LCSmith");
+  for (XmlNode::ElementIterator it = halls.end(); it != halls.begin();) {
+    --it;
+    cout << " " << it->FirstChild()->tag();
+  }
+  cout << "\ndescendants:";
+  for (const XmlNode & node : su.descendants())
+    cout << " " << node.tag();
+  cout << "\nattributes:";
+  for (const pair<const string, XmlValue> & attribute : su.attributes())
+    cout << " " << attribute.first << "=" << attribute.second.view();
+  cout << "\nxpath(\"/LCSmith\"):";
+  for (const XmlNode & hall : su.xpath("/LCSmith"))
+    cout << " " << hall.FirstChild()->tag();
+  cout << "\n";
+
+  XmlRange<XmlNode::ChildIterator> children = su.children();
+  cout << "Elements: " << count_if(children.begin(), children.end(),
+                                   [](const XmlNode & node) { return XmlNode::ELEMENT == node.type(); })
+       << "\n";
+  XmlNode::ChildIterator whitman = find_if(children.begin(), children.end(),
+                                           [](const XmlNode & node) { return "Whitman" == node.tag(); });
+  whitman->SetAttribute("school", "management");
+  cout << su.ToString(-1) << "\n";
+}
+#endif
+
+#ifdef DEMO_REMOVE
+void test_remove() {
+  cout << "\n----- Test Remove & Splice -----\n";
+  XmlNode doc(XmlNode::DOCUMENT);
+  doc.Read("<SU><LCSmith/><!-- Quad --><Whitman/><Maxwell/><Hall/><Hall/></SU><Archive/>");
+  XmlNode * p_su = doc.FirstChild();
+  XmlNode * p_archive = doc.LastChild();
+
+  cout << "RemoveChild(comment): " << (p_su->RemoveChild(p_su->FirstChild()->NextSibling()) ? "ok" : "failed") << "\n";
+  cout << "RemoveChild(not a child): " << (p_su->RemoveChild(p_archive) ? "ok" : "failed") << "\n";
+  cout << "RemoveChildrenIf(Hall): "
+       << p_su->RemoveChildrenIf([](const XmlNode & node) { return "Hall" == node.tag(); }) << "\n";
+  cout << doc.ToString(-1) << "\n";
+
+  XmlNode * p_whitman = p_su->DetachChild(p_su->XPath("/Whitman"));
+  p_whitman->SetAttribute("school", "management");
+  p_archive->AdoptChild(p_whitman);
+  cout << "Detached Whitman into Archive\n" << doc.ToString(-1) << "\n";
+
+  cout << "SpliceChildren(SU into Archive): "
+       << (p_archive->SpliceChildren(p_whitman, p_su->FirstChild(), p_su->LastChild()) ? "ok" : "failed") << "\n";
+  cout << doc.ToString(-1) << "\n";
+  cout << "SpliceChildren(Archive into its child): "
+       << (p_whitman->SpliceChildren(NULL, p_archive, p_archive) ? "ok" : "failed") << "\n";
+}
+#endif
+
+#ifdef DEMO_SORT
+void test_sort() {
+  cout << "\n----- Test Sort -----\n";
+  XmlNode doc(XmlNode::DOCUMENT);
+  doc.Read("<SU><Hall id=\"3\">Whitman</Hall><Hall id=\"1\">LCSmith</Hall><Quad/>"
+           "<Hall id=\"2\">Maxwell</Hall><Hall id=\"1\">Hinds</Hall></SU>");
+  XmlNode * p_su = doc.FirstChild();
+  XmlNode * p_first = p_su->FirstChild();
+
+  p_su->StableSortChildrenByAttribute("id");
+  cout << "By id: " << p_su->ToString(-1) << "\n";
+  p_su->SortChildren([](const XmlNode & a, const XmlNode & b) { return a.tag() > b.tag(); });
+  cout << "By tag, descending: " << p_su->ToString(-1) << "\n";
+  p_su->SortChildrenByKey([](const XmlNode & node) {
+    return (NULL == node.FirstChild()) ? string() : node.FirstChild()->GetDecodedText();
+  });
+  cout << "By text: " << p_su->ToString(-1) << "\n";
+  cout << "Same nodes: " << (p_su->LastChild() == p_first ? "yes" : "no") << "\n";
+}
+#endif
+
+#ifdef DEMO_MATCHER
+void test_matcher() {
+  cout << "\n----- Test Streaming Match -----\n";
+  string content = "<?xml version=\"1.0\"?><catalog><header><title>Books &amp; more</title></header>"
+                   "<item id=\"1\" type=\"book\"><name>SICP</name></item>"
+                   "<!-- <item id=\"0\" type=\"book\"/> -->"
+                   "<item id=\"2\" type=\"cd\"><name>Kind of Blue</name></item>"
+                   "<shelf><item id=\"3\" type=\"book\"/></shelf></catalog>";
+
+  XmlStreamMatcher matcher;
+  matcher.Add("//item[@type='book']/@id", [](const XmlStreamMatch & match) {
+    cout << "book id=" << match.value << " at depth " << match.depth << "\n";
+  });
+  matcher.Add("/catalog/item/name", [](const XmlStreamMatch & match) {
+    cout << "name at offset " << match.offset << "\n";
+  });
+  matcher.Add("/catalog/header", [](const XmlStreamMatch & match) {
+    cout << match.tag << ": " << match.node->ToString(-1) << "\n";
+  }, true);
+  cout << "Add(\"item\"): " << matcher.Add("item", [](const XmlStreamMatch &) {}) << "\n";
+
+  // Seven bytes at a time, cutting tags, comments and entities
+  for (size_t pos = 0; pos < content.size(); pos += 7)
+    matcher.Feed(content.data() + pos, min<size_t>(7, content.size() - pos));
+  cout << "Finish: " << (matcher.Finish() ? "ok" : "failed") << "\n";
+
+  cout << "Match(malformed): " << (matcher.Match("<catalog><item></catalog>") ? "ok" : "failed") << "\n";
+}
+#endif
+
+#ifdef DEMO_TYPED
+void test_typed() {
+  cout << "\n----- Test Typed Values -----\n";
+  XmlNode doc(XmlNode::DOCUMENT);
+  doc.Read("<Hall rooms=\" 120 \" rate=\"0.85\" coed=\"true\" code=\"12a\"><Floors>4</Floors></Hall>");
+  XmlNode * p_hall = doc.FirstChild();
+
+  int64_t rooms = 0;
+  double rate = 0;
+  bool coed = false;
+  int floors = 0;
+  int code = -1;
+  bool ok = p_hall->GetAttributeAs("rooms", rooms);
+  cout << "rooms: " << (ok ? "ok " : "failed ") << rooms << "\n";
+  ok = p_hall->GetAttributeAs("rate", rate);
+  cout << "rate: " << (ok ? "ok " : "failed ") << rate << "\n";
+  ok = p_hall->GetAttributeAs("coed", coed);
+  cout << "coed: " << (ok ? "ok " : "failed ") << coed << "\n";
+  ok = p_hall->FirstChild()->GetTextAs(floors);
+  cout << "floors: " << (ok ? "ok " : "failed ") << floors << "\n";
+  ok = p_hall->GetAttributeAs("code", code);
+  cout << "code: " << (ok ? "ok " : "failed ") << code << "\n";
+  ok = p_hall->GetAttributeAs("missing", code);
+  cout << "missing: " << (ok ? "ok " : "failed ") << code << "\n";
+
+  p_hall->SetAttribute("rooms", rooms + 1);
+  p_hall->SetAttribute("rate", rate / 2);
+  p_hall->SetAttribute("coed", !coed);
+  cout << doc.ToString(-1) << "\n";
+}
+#endif
+
+#ifdef DEMO_DIFF
+void test_diff() {
+  cout << "\n----- Test Hash & Diff -----\n";
+  string content = "<SU><Hall id=\"1\">LCSmith</Hall><Hall id=\"2\">Maxwell</Hall>"
+                   "<Hall id=\"3\">Whitman</Hall><!-- Quad --></SU>";
+  XmlNode before(XmlNode::DOCUMENT);
+  XmlNode after(XmlNode::DOCUMENT);
+  before.Read(content);
+  after.Read(content);
+  cout << "Same hash: " << (before.Hash() == after.Hash() ? "yes" : "no") << "\n";
+  cout << "DeepEquals: " << (before.DeepEquals(after) ? "yes" : "no") << "\n";
+
+  XmlNode * p_su = after.FirstChild();
+  p_su->XPath("/Hall")->NextSibling()->SetAttribute("id", "20");
+  p_su->RemoveChild(p_su->LastChild());
+  XmlNode hall(XmlNode::ELEMENT, "Hall");
+  hall.SetAttribute("id", "4");
+  p_su->PushChild(hall);
+  cout << "Same hash: " << (before.Hash() == after.Hash() ? "yes" : "no") << "\n";
+  cout << "DeepEquals: " << (before.DeepEquals(after) ? "yes" : "no") << "\n";
+
+  // Both hashed, equal trees are still compared node by node
+  XmlNode copy(after);
+  copy.Hash();
+  cout << "DeepEquals of a hashed copy: " << (copy.DeepEquals(after) ? "yes" : "no") << "\n";
+
+  const char * kinds[] = {"CHANGED", "ADDED", "REMOVED"};
+  vector<XmlDiff> diffs = XmlNode::Diff(before, after);
+  for (size_t index = 0; index < diffs.size(); ++index) {
+    const XmlNode * node = (NULL != diffs[index].after) ? diffs[index].after : diffs[index].before;
+    cout << kinds[diffs[index].kind] << " " << node->ToString(-1) << "\n";
+  }
+}
+#endif
+
+#ifdef DEMO_FILE
+void test_file() {
+  cout << "\n----- Test Compressed Files -----\n";
+  FILE * file = fopen("Demo_File.xml.gz", "wb");
+  if (NULL == file) {
+    cout << "Can't open Demo_File.xml.gz\n";
+    return;
+  }
+  {
+    XmlFileSink file_sink(file);
+    XmlGzipSink sink(file_sink);
+    XmlWriter writer(sink, -1);
+    writer.StartElement("Catalog");
+    for (int index = 0; index < 1000; ++index) {
+      writer.StartElement("Item");
+      writer.Attribute("id", to_string(index));
+      writer.Text("Some Content");
+      writer.EndElement();
+    }
+    writer.EndElement();
+    cout << "Write: " << (writer.Finish() && sink.Finish() ? "ok" : "failed") << "\n";
+  }
+  fclose(file);
+
+  XmlNode doc(XmlNode::DOCUMENT);
+  cout << "LoadFile: " << (LoadFile("Demo_File.xml.gz", doc) ? "ok" : "failed") << "\n";
+  cout << "Last item: " << doc.FirstChild()->LastChild()->ToString(-1) << "\n";
+
+  int items = 0;
+  XmlStreamMatcher matcher;
+  matcher.Add("/Catalog/Item", [&items](const XmlStreamMatch &) { ++items; });
+  cout << "MatchFile: " << (MatchFile("Demo_File.xml.gz", matcher) ? "ok" : "failed") << "\n";
+  cout << "Items: " << items << "\n";
+
+  XmlFileReader reader;
+  cout << "Content size: " << (reader.Open("Demo_File.xml.gz") ? reader.SizeHint() : 0) << "\n";
+  reader.Close();
+  remove("Demo_File.xml.gz");
+  cout << "Missing file: " << (LoadFile("Demo_File.xml.gz", doc) ? "ok" : "failed") << "\n";
+}
+#endif
+
+#ifdef DEMO_LOADER
+void test_loader() {
+  cout << "\n----- Test Loading Many Files -----\n";
+  vector<string> paths;
+  for (int index = 0; index < 8; ++index) {
+    paths.push_back("Demo_Loader_" + to_string(index) + ".xml");
+    FILE * file = fopen(paths.back().c_str(), "wb");
+    if (NULL == file) {
+      cout << "Can't open " << paths.back() << "\n";
+      return;
+    }
+    string content = "<Config id=\"" + to_string(index) + "\"><Name>Config " + to_string(index) + "</Name></Config>";
+    if (5 == index)
+      content = "<Config><Name>Broken</Config>";
+    fwrite(content.data(), 1, content.size(), file);
+    fclose(file);
+  }
+  paths.push_back("Demo_Loader_Missing.xml");
+
+  vector<XmlNode *> configs(paths.size(), NULL);
+  size_t loaded = LoadFiles(paths, [&configs](size_t index, XmlNode * document) {
+    configs[index] = document;
+  });
+  cout << "Loaded: " << loaded << " of " << paths.size() << "\n";
+
+  for (size_t index = 0; index < configs.size(); ++index) {
+    cout << paths[index] << ": " << (NULL != configs[index] ? configs[index]->ToString(-1) : "failed") << "\n";
+    delete configs[index];
+    remove(paths[index].c_str());
+  }
+}
+#endif
+
+#ifdef DEMO_BINDING
+struct DemoAuthor {
+  string name;
+  int born = 0;
+};
+
+struct DemoBook {
+  int64_t id = 0;
+  string title;
+  double price = 0;
+  vector<DemoAuthor> authors;
+};
+
+struct DemoCatalog {
+  vector<DemoBook> books;
+};
+
+namespace SmallXml {
+
+template <> struct XmlBinding<DemoAuthor> {
+  static constexpr auto fields = XmlFields(
+      XmlAttribute("born", &DemoAuthor::born),
+      XmlText(&DemoAuthor::name));
+};
+
+template <> struct XmlBinding<DemoBook> {
+  static constexpr auto fields = XmlFields(
+      XmlAttribute("id", &DemoBook::id),
+      XmlElement("title", &DemoBook::title),
+      XmlElement("price", &DemoBook::price),
+      XmlElement("author", &DemoBook::authors));
+};
+
+template <> struct XmlBinding<DemoCatalog> {
+  static constexpr auto fields = XmlFields(XmlElement("book", &DemoCatalog::books));
+};
+
+}
+
+void test_binding() {
+  cout << "\n----- Test Struct Binding -----\n";
+  string content = "<catalog>"
+                   "<book id=\"1\"><title>Fish &amp; Chips</title><price>9.5</price>"
+                   "<author born=\"1920\">Ann</author><author>Bob</author></book>"
+                   "<book id=\"2\"><title>Tea</title><note>skipped</note></book>"
+                   "</catalog>";
+
+  DemoCatalog catalog;
+  cout << "ReadStruct: " << (ReadStruct(content, catalog) ? "ok" : "failed") << "\n";
+  for (size_t index = 0; index < catalog.books.size(); ++index) {
+    const DemoBook & book = catalog.books[index];
+    cout << book.id << ": " << book.title << ", " << book.price << ", " << book.authors.size() << " authors\n";
+  }
+
+  string out;
+  XmlStringSink sink(out);
+  XmlWriter writer(sink, -1);
+  WriteStruct(writer, "catalog", catalog);
+  writer.Finish();
+  cout << "WriteStruct: " << out << "\n";
+
+  DemoCatalog broken;
+  cout << "Bad number: " << (ReadStruct("<catalog><book id=\"x\"/></catalog>", broken) ? "ok" : "failed") << "\n";
+}
+#endif
+
+#ifdef DEMO_STATIC_PATH
+void test_static_path() {
+  cout << "\n----- Test Static Paths -----\n";
+  XmlNode doc(XmlNode::DOCUMENT);
+  doc.Read("<config><db><host>alpha</host></db><db><host>beta</host><port>5432</port></db></config>");
+
+  static constexpr XmlStaticPath kHost("config/db/host");
+  static constexpr XmlStaticPath kPort("/config//db/port/");
+  cout << "Steps: " << kHost.num_steps << ", last " << kHost.step(kHost.num_steps - 1) << "\n";
+  cout << "XPath: " << doc.XPath(kHost)->ToString(-1) << "\n";
+  cout << "XPaths: " << doc.XPaths(kHost).size() << "\n";
+  cout << "Same as run time: " << (doc.XPath(kPort) == doc.XPath("/config//db/port/") ? "yes" : "no") << "\n";
+}
+#endif
+
+#ifdef DEMO_VERSIONED
+void test_versioned() {
+  cout << "\n----- Test Versioned Documents -----\n";
+  XmlNode doc(XmlNode::DOCUMENT);
+  doc.Read("<config><db><host>alpha</host></db></config>");
+  XmlVersionedDocument config(doc);
+
+  XmlVersionedDocument::Reader reader(config);
+  {
+    XmlVersionedDocument::Snapshot before(reader);
+    config.Update([](XmlNode & next) {
+      next.XPath("config/db/host")->FirstChild()->set_text("beta");
+      return true;
+    });
+    // The snapshot still sees its version, which is kept for it
+    cout << "Snapshot " << before.version() << ": " << before->XPath("config/db/host")->ToString(-1) << "\n";
+    cout << "Retired while read: " << config.NumOfRetired() << "\n";
+  }
+  config.Reclaim();
+  cout << "Retired after: " << config.NumOfRetired() << "\n";
+
+  // Readers on other threads, while this one keeps updating
+  size_t mismatches = 0;
+  std::thread reading([&config, &mismatches] {
+    XmlVersionedDocument::Reader thread_reader(config);
+    for (int index = 0; index < 1000; ++index) {
+      XmlVersionedDocument::Snapshot snapshot(thread_reader);
+      int64_t number = 0;
+      snapshot->XPath("config")->GetAttributeAs("version", number);
+      if (1 < snapshot.version() && static_cast<uint64_t>(number) != snapshot.version())
+        ++mismatches;
+    }
+  });
+  for (int index = 0; index < 100; ++index) {
+    config.Update([&config](XmlNode & next) {
+      next.XPath("config")->SetAttribute("version", static_cast<int64_t>(config.version() + 1));
+      return true;
+    });
+  }
+  reading.join();
+
+  XmlVersionedDocument::Snapshot last(reader);
+  cout << "Version " << last.version() << ": " << last->ToString(-1) << "\n";
+  cout << "Mismatches: " << mismatches << "\n";
+}
+#endif
+
+#ifdef DEMO_RETAIN
+void test_retain() {
+  cout << "\n----- Test Retained Capacity -----\n";
+  XmlNode message(XmlNode::DOCUMENT);
+  message.RetainCapacity(true);
+
+  for (int index = 0; index < 3; ++index) {
+    string payload = "<order id=\"" + to_string(index) + "\">";
+    for (int item = 0; item <= index; ++item)
+      payload += "<item sku=\"" + to_string(item) + "\">Tea</item>";
+    payload += "</order>";
+
+    message.Read(payload);
+    cout << message.ToString(-1) << ", kept " << message.NumOfRetainedNodes() << "\n";
+  }
+
+  message.Read("<order/>");
+  cout << message.ToString(-1) << ", kept " << message.NumOfRetainedNodes() << "\n";
+  message.RetainCapacity(false);
+  cout << "Released, kept " << message.NumOfRetainedNodes() << "\n";
+}
+#endif
+
+#ifdef DEMO_VALUE
+void test_value() {
+  cout << "\n----- Test Compact Values -----\n";
+  const char * kinds[] = {"inline", "heap", "slice"};
+  string source = "A text which is too long to be kept inline";
+
+  XmlValue value("title", 5);
+  cout << value.view() << ": " << kinds[value.kind()] << "\n";
+  value.assign(source);
+  cout << value.view() << ": " << kinds[value.kind()] << "\n";
+  value.slice(source.data() + 2, 4);
+  cout << value.view() << ": " << kinds[value.kind()] << "\n";
+  value.append(" kept", 5);
+  cout << value.view() << ": " << kinds[value.kind()] << "\n";
+
+  // Long values of a spanned tree are slices of its source
+  string content = "<note><body>" + source + "</body></note>";
+  XmlParser parser(PARSE_DEFAULT | PARSE_SOURCE_SPANS);
+  XmlNode doc(XmlNode::DOCUMENT);
+  parser.Read(content, doc);
+  content.clear();
+  cout << doc.ToString(-1) << "\n";
+  cout << "sizeof(XmlNode): " << sizeof(XmlNode) << ", sizeof(XmlValue): " << sizeof(XmlValue) << "\n";
+
+  // A short value in a kept block grows in that block
+  XmlValue shrunk(source.data(), source.size());
+  shrunk.assign("hello", 5);
+  shrunk.append(" world", 6);
+  cout << shrunk.view() << ": " << kinds[shrunk.kind()] << "\n";
+
+  // A reused text node of a coalescing parser, the same
+  XmlParser coalescing(PARSE_DEFAULT | PARSE_COALESCE_TEXT | PARSE_SKIP_COMMENTS);
+  string tag(40, 'T');
+  XmlNode reused(XmlNode::DOCUMENT);
+  coalescing.Read("<" + tag + "><x/></" + tag + ">", reused);
+  coalescing.Read("<r>ab<!--c-->cd</r>", reused);
+  cout << reused.ToString(-1) << "\n";
+}
+#endif
+
+#ifdef DEMO_VALUE_POOL
+void test_value_pool() {
+  cout << "\n----- Test Value Pool -----\n";
+  const char * states[] = {"SENSOR_READING_WITHIN_EXPECTED_RANGE", "SENSOR_READING_ABOVE_WARNING_THRESHOLD"};
+  string feed = "<feed>";
+  for (int index = 0; index < 1000; ++index) {
+    feed += "<sample source=\"urn:example:plant-7:line-2:sensor-temperature\"><ok>true</ok><state>" +
+            string(states[index % 2]) + "</state></sample>";
+  }
+  feed += "</feed>";
+
+  XmlParser parser(PARSE_DEFAULT | PARSE_DEDUP_VALUES);
+  XmlNode doc(XmlNode::DOCUMENT);
+  parser.Read(feed, doc);
+  doc.XPath("/feed/sample/state")->FirstChild()->set_text("SENSOR_READING_ABOVE_WARNING_THRESHOLD");
+  doc.XPath("/feed/sample")->SetAttribute("source", "urn:example:plant-7:line-2:sensor-temperature");
+
+  const XmlValuePool * pool = doc.ValuePool();
+  cout << "Values: " << pool->NumOfValues() << ", distinct: " << pool->NumOfDistinct() << "\n";
+  cout << "Bytes: " << pool->InternedBytes() << ", stored: " << pool->StoredBytes()
+       << ", ratio: " << pool->DedupRatio() << "\n";
+  cout << doc.XPath("/feed/sample")->ToString(-1) << "\n";
+
+  // The pool alone keeps no source
+  cout << "Has raw xml: " << (doc.HasRawXml() ? "yes" : "no") << "\n";
+  cout << "ToSourceString is ToString: " << (doc.ToSourceString() == doc.ToString(-1) ? "yes" : "no") << "\n";
+}
+#endif
+
+#ifdef DEMO_ENCODING
+void test_encoding() {
+  cout << "\n----- Test Encodings -----\n";
+  XmlParser parser(PARSE_DEFAULT | PARSE_TRANSCODE | PARSE_VALIDATE_UTF8);
+  XmlNode doc(XmlNode::DOCUMENT);
+
+  // "café" in ISO-8859-1, by its declaration
+  string latin1 = "<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?><menu>caf\xE9</menu>";
+  bool read = parser.Read(latin1, doc);
+  cout << "Latin-1: " << read << " " << doc.ToString(-1) << "\n";
+  cout << "Declared: " << doc.FirstChild()->GetEncoding() << "\n";
+
+  // The same in UTF-16LE, by its byte order mark
+  string utf16 = "\xFF\xFE";
+  const char * text = "<menu>caf";
+  for (const char * scan = text; '\0' != *scan; ++scan)
+    utf16 += string(1, *scan) + '\0';
+  utf16 += string("\xE9\0<\0/\0m\0e\0n\0u\0>\0", 16);
+  read = parser.Read(utf16, doc);
+  cout << "UTF-16: " << read << " " << doc.ToString(-1) << "\n";
+
+  // Latin-1 bytes without a declaration are not UTF-8
+  read = parser.Read("<menu>caf\xE9</menu>", doc);
+  cout << "Invalid: " << read << "\n";
+}
+#endif
+
 #endif
@@ -12,10 +12,105 @@ Author: Yang Liu
 #include <string>
 #include <map>
 #include <vector>
+#include <algorithm>
 #include <queue>
+#include <memory>
+#include <string_view>
+#include <iterator>
+#include <cstddef>
+#include <cctype>
+#include <cstdint>
+#include <charconv>
+#include <type_traits>
+
+#include "XmlValue.h"
 
 namespace SmallXml {
 
+class ParseProjection;
+class XmlParser;
+struct XmlSource;
+class XmlNode;
+
+/*
+  One difference found by XmlNode::Diff
+
+  CHANGED - before and after are at the same place, and their own
+            tag, attributes or text differ
+  ADDED   - after has no counterpart, before is NULL
+  REMOVED - before has no counterpart, after is NULL
+*/
+struct XmlDiff {
+  enum Kind {CHANGED, ADDED, REMOVED};
+
+  Kind kind;
+  const XmlNode * before;
+  const XmlNode * after;
+};
+
+/*
+  A pair of iterators, for range-for
+*/
+template <typename Iterator>
+class XmlRange {
+ public:
+  XmlRange(Iterator begin, Iterator end) : begin_(begin), end_(end) {}
+
+  Iterator begin() const { return begin_; }
+  Iterator end() const { return end_; }
+  bool empty() const { return begin_ == end_; }
+
+ private:
+  Iterator begin_;
+  Iterator end_;
+};
+
+/*
+  XmlStaticPath is a path split into its steps at compile time, the
+  way XPath splits it at run time: empty steps between slashes are
+  skipped. XPath, XPaths and XPaths_c of a XmlStaticPath give what
+  they give for the string, without scanning the path for each node.
+
+  static constexpr XmlStaticPath kHost("config/db/host");
+  const XmlNode * host = doc.XPath(kHost);
+
+  With C++20, the path can be a template argument:
+
+  const XmlNode * host = doc.XPath<"config/db/host">();
+
+  The members are public only so that it can be a template argument.
+*/
+template <size_t N>
+struct XmlStaticPath {
+  constexpr XmlStaticPath(const char (&path)[N]) : text(), num_steps(0), begins(), ends() {
+    size_t end = 0;
+    while (end + 1 < N) {
+      size_t begin = end;
+      while (begin + 1 < N && '/' == path[begin])
+        ++begin;
+      end = begin;
+      while (end + 1 < N && '/' != path[end])
+        ++end;
+      if (begin != end) {
+        begins[num_steps] = begin;
+        ends[num_steps] = end;
+        ++num_steps;
+      }
+    }
+    for (size_t index = 0; index < N; ++index)
+      text[index] = path[index];
+  }
+
+  constexpr std::string_view step(size_t index) const {
+    return std::string_view(text + begins[index], ends[index] - begins[index]);
+  }
+
+  char text[N];
+  size_t num_steps;
+  size_t begins[N];
+  size_t ends[N];
+};
+
 /*
   A class for everything in the Document Object
   Model. It might be Element, Comment, Declaration.
@@ -26,6 +121,10 @@ namespace SmallXml {
 */
 
 class XmlNode {
+  // Snapshots and the parser read and build nodes directly
+  friend class XmlSnapshot;
+  friend class XmlParser;
+
  public:
   enum NodeType {
     ELEMENT,      // Element
@@ -121,6 +220,69 @@ class XmlNode {
   XmlNode * PushChild(const XmlNode & node);
   XmlNode * InsertChildBefore(const XmlNode & node, XmlNode * before_this);
   XmlNode * InsertChildAfter(const XmlNode & node, XmlNode * after_this);
+
+  /*
+    Remove and move children
+    Nothing is copied, nodes are only unlinked and linked again.
+
+    RemoveChild - Delete a child and its subtree. Returns false if
+                  child is not a child of this node.
+    DetachChild - Unlink a child and give it to the caller, who has to
+                  delete it, or give it to AdoptChild. Returns NULL if
+                  child is not a child of this node.
+    AdoptChild - Take a node which has no parent, allocated with new,
+                 as the last child. Returns it, or NULL if this node
+                 can't have it: a document, a node which has a parent
+                 or an ancestor of this node.
+    RemoveChildrenIf - Delete every child for which pred(child) is
+                       true, in a single pass. Returns how many.
+    SpliceChildren - Move the siblings from first to last, both
+                     included, from their parent to this node, before
+                     before_this, or at the end if it is NULL. The
+                     lists are relinked in constant time, only the
+                     parent link of each moved node is set. Returns
+                     false, and moves nothing, if first and last are
+                     not siblings in that order, before_this is not a
+                     child of this node, or this node is among them or
+                     below them.
+
+    // Drop empty items
+    catalog.RemoveChildrenIf([](const XmlNode & item) { return !item.HasChild(); });
+    // Move all items to archive
+    archive.SpliceChildren(NULL, catalog.FirstChild(), catalog.LastChild());
+  */
+  bool RemoveChild(XmlNode * child);
+  XmlNode * DetachChild(XmlNode * child);
+  XmlNode * AdoptChild(XmlNode * node);
+  template <typename Predicate> size_t RemoveChildrenIf(Predicate pred);
+  bool SpliceChildren(XmlNode * before_this, XmlNode * first, XmlNode * last);
+
+  /*
+    Sort children
+    The children list is reordered in place, nodes are neither copied
+    nor allocated. Both sorts are stable and take O(n log n).
+
+    SortChildren - Order by less(a, b), which compares two children.
+    SortChildrenByKey - Order by key(child), called once per child.
+                        Cheaper than SortChildren when the key costs
+                        more than comparing it.
+    StableSortChildrenByAttribute - Order by the value of an attribute,
+                                    children without it first. Each
+                                    value is looked up once.
+
+    Memory is a vector of one entry per child, and the buffer of
+    std::stable_sort, nothing per node.
+
+    node.SortChildren([](const XmlNode & a, const XmlNode & b) { return a.tag() < b.tag(); });
+    node.SortChildrenByKey([](const XmlNode & a) { return a.NumOfChildren(); });
+    node.StableSortChildrenByAttribute("id");
+
+    NOTE:
+      Values compare as they are stored, encoded, byte by byte.
+  */
+  template <typename Compare> void SortChildren(Compare less);
+  template <typename KeyFunction> void SortChildrenByKey(KeyFunction key);
+  void StableSortChildrenByAttribute(const std::string & name);
   
   /*
     Number of children
@@ -166,6 +328,39 @@ class XmlNode {
   void RemoveAttribute(const std::string & name);
   std::string GetAttribute(const std::string & name) const;
   std::vector<std::pair<std::string, std::string> > GetAttributes() const;
+
+  /*
+    Typed values
+    GetAttributeAs and GetTextAs parse the stored value straight into
+    T, without copying or decoding it. T is an integer, a floating
+    point type, or bool ("true", "false", "1", "0"). White space around
+    the value is ignored, everything else has to be part of it. They
+    return false, and leave value unchanged, when there is no such
+    value or it does not parse.
+    SetAttribute with a number formats it over the stored value.
+
+    int64_t count = 0;
+    if (node.GetAttributeAs("count", count))
+      node.SetAttribute("count", count + 1);
+
+    double price = 0;
+    bool ok = price_node.GetTextAs(price);
+
+    NOTE:
+      GetTextAs of an element reads its first child, if it is a text.
+  */
+  template <typename T> bool GetAttributeAs(const std::string & name, T & value) const;
+  template <typename T> bool GetTextAs(T & value) const;
+  template <typename T>
+  typename std::enable_if<std::is_arithmetic<T>::value>::type
+  SetAttribute(const std::string & name, T value);
+
+  /*
+    ParseValue - Parse [data, data + size) into value, as GetAttributeAs
+    FormatValue - Replace out with value, as SetAttribute writes it
+  */
+  template <typename T> static bool ParseValue(const char * data, size_t size, T & value);
+  template <typename T> static void FormatValue(T value, std::string & out);
   
   /*
     Declaration attributes
@@ -185,11 +380,105 @@ class XmlNode {
       If you don't want indent, please set it to -1;
   */
   std::string ToString(int indent = 0) const;
+
+  /*
+    Source span
+    With PARSE_SOURCE_SPANS (XmlParser.h), a node remembers the bytes
+    it was parsed from. As long as neither the node nor anything below
+    it is changed, RawXml returns those bytes without copying them.
+    Once changed, HasRawXml is false and RawXml is empty.
+    ToSourceString writes unchanged subtrees as their raw bytes, with
+    their original formatting, and builds only the changed parts, like
+    ToString(-1).
+
+    // Forward a subtree as it came
+    if (item->HasRawXml())
+      send(item->RawXml());
+
+    NOTE:
+      The view stays valid while the node lives and is not changed.
+      Raw bytes are the source as it is, with whatever parse options
+      dropped from the tree (comments, white space...).
+  */
+  bool HasRawXml() const;
+  std::string_view RawXml() const;
+  std::string ToSourceString() const;
+
+  /*
+    Content hash
+    Hash covers the type, tag, attributes and text of a node, and the
+    hashes of its children in order, so equal subtrees hash equal.
+    Hashes are computed when first asked for and kept in the nodes.
+    Changing a node forgets the hashes of it and of its ancestors
+    only, the next Hash rehashes just those paths.
+
+    DeepEquals compares two subtrees and stops at the first
+    difference. Subtrees which are already hashed and hash
+    differently are told apart without going further, equal hashes
+    are still compared node by node.
+
+    Diff lists the differences of two subtrees in document order.
+    Subtrees with equal hashes are skipped without being visited, so
+    it costs what the changed paths cost, once both are hashed.
+    Children are walked in order, a few added or removed in a row are
+    found by looking ahead, others are paired by type and tag. It is
+    not a minimal edit script, a moved child shows as removed and
+    added.
+
+    if (last.Hash() != doc.Hash()) {
+      std::vector<XmlDiff> diffs = XmlNode::Diff(last, doc);
+      ...
+    }
+
+    NOTE:
+      Diff takes equal hashes as equal subtrees, DeepEquals does not.
+      Hash, DeepEquals and Diff parse lazy children.
+  */
+  uint64_t Hash() const;
+  bool DeepEquals(const XmlNode & node) const;
+  static std::vector<XmlDiff> Diff(const XmlNode & before, const XmlNode & after);
   
   /*
     Clear - Clear all children node and make itself a default element node
   */
   void Clear();
+
+  /*
+    RetainCapacity - With retain, Clear and Read of this node keep the
+                     nodes they release, with their string buffers and
+                     attribute storage, and the next Read takes them
+                     again. Reading messages of the same shape into the
+                     same node then hardly allocates. Without retain,
+                     the kept nodes are freed.
+    NumOfRetainedNodes - Nodes kept for the next Read
+
+    XmlNode message(XmlNode::DOCUMENT);
+    message.RetainCapacity(true);
+    while (next_message(payload)) {
+      message.Read(payload);
+      ...
+    }
+
+    NOTE:
+      It is a XmlParser of the node, like the one Read would set up,
+      kept alive. Copies of the node don't retain anything.
+  */
+  void RetainCapacity(bool retain);
+  bool RetainsCapacity() const;
+  size_t NumOfRetainedNodes() const;
+
+  /*
+    ValuePool - Pool of the document this node was read into with
+                PARSE_DEDUP_VALUES, NULL without one. Long tags,
+                texts and attribute values are kept there once,
+                set_tag, set_text and SetAttribute put theirs there
+                too. See XmlValuePool for its stats.
+
+    XmlParser parser(PARSE_DEFAULT | PARSE_DEDUP_VALUES);
+    parser.Read(feed, doc);
+    double ratio = doc.ValuePool()->DedupRatio();
+  */
+  const XmlValuePool * ValuePool() const;
   
   /*
     Read and Load
@@ -200,13 +489,24 @@ class XmlNode {
     // Read a node from a string with the start
     // start will change into the index of last read char.
     node.Read(str, start);
+    // Read only the given paths, see ParseProjection in XmlParser.h
+    node.Read(str, ParseProjection{"/catalog/item/price"});
+    // Parse children only when they are visited, see PARSE_LAZY
+    XmlParser(PARSE_DEFAULT | PARSE_LAZY).Read(str, node);
     
     NOTE:
       Read functions will return a bool value, to indicate it success or is
       failed. If you want to track where cause the failure, check the index.
+      Each call sets up a new parser. To parse many documents, keep a
+      XmlParser (XmlParser.h) instead, it reuses its buffers and nodes,
+      or let the node keep one with RetainCapacity.
+      Children of a lazily read node are parsed by the first call which
+      looks at them, const calls included. Until then a lazy tree must
+      not be shared between threads.
   */
   bool Read(const std::string & content);
   bool Read(const std::string & content, int & index);
+  bool Read(const std::string & content, const ParseProjection & projection);
 
   // Get and set
   /*
@@ -266,6 +566,103 @@ class XmlNode {
     return const_cast<XmlNode * >( (const_cast<const XmlNode * >(this))->LastChild());
   }
   
+  /*
+    Traversal
+    Walk a subtree in constant stack space, whatever its depth: the
+    walks follow the child, sibling and parent links, nothing else.
+    root is the node the walk started from, it is never left. They
+    return NULL once the walk of root is over.
+
+    NextInPreorder - The next node in document order, a node before
+                     its children.
+    FirstInPostorder - The first node of the postorder walk of this
+                       subtree, its deepest first descendant.
+    NextInPostorder - The next node in postorder, a node after its
+                      children.
+
+    // Every node of doc, doc included
+    for (const XmlNode * scan = &doc; NULL != scan; scan = scan->NextInPreorder(&doc))
+      visit(scan);
+
+    PreorderIterator and PostorderIterator are forward iterators over
+    the same walks. A default constructed one is the end.
+
+    for (XmlNode::PostorderIterator it(&doc), end; it != end; ++it)
+      visit(*it);
+
+    NOTE:
+      Changing the tree under a walk is not supported, except for the
+      nodes already visited in postorder.
+  */
+  const XmlNode * NextInPreorder(const XmlNode * root) const;
+  XmlNode * NextInPreorder(const XmlNode * root) {
+    return const_cast<XmlNode * >( (const_cast<const XmlNode * >(this))->NextInPreorder(root));
+  }
+  const XmlNode * FirstInPostorder() const;
+  XmlNode * FirstInPostorder() {
+    return const_cast<XmlNode * >( (const_cast<const XmlNode * >(this))->FirstInPostorder());
+  }
+  const XmlNode * NextInPostorder(const XmlNode * root) const;
+  XmlNode * NextInPostorder(const XmlNode * root) {
+    return const_cast<XmlNode * >( (const_cast<const XmlNode * >(this))->NextInPostorder(root));
+  }
+
+  template <typename Node> class BasicPreorderIterator;
+  template <typename Node> class BasicPostorderIterator;
+  typedef BasicPreorderIterator<XmlNode> PreorderIterator;
+  typedef BasicPreorderIterator<const XmlNode> ConstPreorderIterator;
+  typedef BasicPostorderIterator<XmlNode> PostorderIterator;
+  typedef BasicPostorderIterator<const XmlNode> ConstPostorderIterator;
+
+  /*
+    Ranges
+    Views of the tree for range-for and <algorithm>. They hold a few
+    pointers and allocate nothing, neither do their iterators, and
+    they are evaluated as they are walked.
+
+    children - Every child, bidirectional.
+    descendants - Every node below this, in document order, forward.
+    elements - Child elements with tag, bidirectional. An empty tag
+               matches every element.
+    attributes - Name and value pairs, stored encoded, bidirectional.
+                 A value is a XmlValue, see XmlValue.h.
+    xpath - The nodes XPaths would return, in the same order, found
+            one at a time, forward. The first one is what XPath
+            returns.
+
+    for (XmlNode & item : catalog.elements("item"))
+      total += item.NumOfChildren();
+
+    size_t n = std::count_if(doc.descendants().begin(), doc.descendants().end(), isPrice);
+
+    NOTE:
+      elements and xpath keep the view they are given, not a copy:
+      the tag or path must outlive the range. String literals do.
+      Iterators stay valid while the nodes they point to are in the
+      tree, the way list iterators do.
+  */
+  template <typename Node> class BasicChildIterator;
+  template <typename Node> class BasicElementIterator;
+  template <typename Node> class BasicXPathIterator;
+  typedef BasicChildIterator<XmlNode> ChildIterator;
+  typedef BasicChildIterator<const XmlNode> ConstChildIterator;
+  typedef BasicElementIterator<XmlNode> ElementIterator;
+  typedef BasicElementIterator<const XmlNode> ConstElementIterator;
+  typedef BasicXPathIterator<XmlNode> XPathIterator;
+  typedef BasicXPathIterator<const XmlNode> ConstXPathIterator;
+  typedef std::map<std::string, XmlValue> AttributeMap;
+  typedef AttributeMap::const_iterator AttributeIterator;
+
+  XmlRange<ChildIterator> children();
+  XmlRange<ConstChildIterator> children() const;
+  XmlRange<PreorderIterator> descendants();
+  XmlRange<ConstPreorderIterator> descendants() const;
+  XmlRange<ElementIterator> elements(std::string_view tag);
+  XmlRange<ConstElementIterator> elements(std::string_view tag) const;
+  XmlRange<AttributeIterator> attributes() const;
+  XmlRange<XPathIterator> xpath(std::string_view path);
+  XmlRange<ConstXPathIterator> xpath(std::string_view path) const;
+
   /*
     XPath!
     
@@ -281,12 +678,28 @@ class XmlNode {
   const std::vector<const XmlNode * > XPaths_c(const std::string & path) const;
   std::vector<XmlNode * > XPaths(const std::string & path);
 
+  /*
+    Same as above, for a path split at compile time, see XmlStaticPath
+  */
+  template <size_t N> const XmlNode * XPath(const XmlStaticPath<N> & path) const;
+  template <size_t N> XmlNode * XPath(const XmlStaticPath<N> & path);
+  template <size_t N> const std::vector<const XmlNode * > XPaths_c(const XmlStaticPath<N> & path) const;
+  template <size_t N> std::vector<XmlNode * > XPaths(const XmlStaticPath<N> & path);
+
+#if __cplusplus >= 202002L
+  template <XmlStaticPath Path> const XmlNode * XPath() const { return XPath(Path); }
+  template <XmlStaticPath Path> XmlNode * XPath() { return XPath(Path); }
+  template <XmlStaticPath Path> const std::vector<const XmlNode * > XPaths_c() const { return XPaths_c(Path); }
+  template <XmlStaticPath Path> std::vector<XmlNode * > XPaths() { return XPaths(Path); }
+#endif
+
   /*
     Value
     Get - Return
       Content of Comment
       Plain Text of Element
-    Set - Set the value above
+    Set - Set the value above. On an element, set_text adds a text
+          child, encoded once like set_text of a text node.
 
     GetText
       Get decoded text.
@@ -301,9 +714,50 @@ class XmlNode {
   
   /*
     XmlSpecial characters encoding and decoding
+    
+    The second form appends the encoded or decoded characters of
+    [data, data + size) to out, without building a temporary string.
   */
   static std::string XmlSpecialCharEncode(std::string origin);
   static std::string XmlSpecialCharDecode(std::string origin);
+  static void XmlSpecialCharEncode(const char * data, size_t size, std::string & out);
+  static void XmlSpecialCharDecode(const char * data, size_t size, std::string & out);
+  
+  /*
+    XmlSpecialCharNormalize appends raw xml character data in the
+    stored form: known entities are kept, bare special characters are
+    encoded. It equals Encode(Decode(data)), in one pass.
+  */
+  static void XmlSpecialCharNormalize(const char * data, size_t size, std::string & out);
+
+  /*
+    XmlSpecialCharDecodeInPlace decodes [data, data + size) over
+    itself, and returns the decoded size. Decoding never grows.
+  */
+  static size_t XmlSpecialCharDecodeInPlace(char * data, size_t size);
+
+  /*
+    White space as trim() and the parsers see it
+    isWhiteSpace - True for a space, tab, new line, carriage return,
+                   vertical tab or form feed.
+    trimRange - Narrow [begin, end) to what trim() keeps, without
+                copying.
+  */
+  static bool isWhiteSpace(const char c) {
+    return 0 != isspace(static_cast<unsigned char>(c));
+  }
+  static void trimRange(const char * & begin, const char * & end) {
+    while (begin != end && isWhiteSpace(*begin))
+      ++begin;
+    while (end != begin && isWhiteSpace(*(end - 1)))
+      --end;
+  }
+  static void trimRange(char * & begin, char * & end) {
+    while (begin != end && isWhiteSpace(*begin))
+      ++begin;
+    while (end != begin && isWhiteSpace(*(end - 1)))
+      --end;
+  }
   
  protected:
   /*
@@ -333,11 +787,6 @@ class XmlNode {
                        const std::string & to // new part
                        );
   
-  /*
-    isWhiteSpace
-  */
-  static bool isWhiteSpace(const char c);
-
   /*
     split a xpath string into pieces
   */
@@ -347,29 +796,72 @@ class XmlNode {
   /*
     ToString by type
   */
-  std::string ToStringAsElement(int indent) const;
+  void appendOpenTag(std::string & out, int indent) const;
+  void appendCloseTag(std::string & out, int indent) const;
   std::string ToStringAsComment(int indent) const;
   std::string ToStringAsDeclaration(int indent) const;
   std::string ToStringAsUnknown(int indent) const;
   std::string ToStringAsText(int indent) const;
-  std::string ToStringAsDOCUMENT(int indent) const;
-  
+  void appendString(std::string & out, int indent, bool raw) const;
+
+  // Parse children which were left for later, see PARSE_LAZY
+  void expand() const;
+
+  // Forget the source span and the hash of this node and of its
+  // ancestors
+  void touch();
+
   /*
-    Parser functions
+    findAttribute - Stored value of the attribute, or NULL
+    attributeSlot - Stored value of the attribute, added if missing
+    Names without special characters are looked up as they are.
   */
-  XmlNode * ParseNext(const std::string & content, // Content to Parse
-                      int & start,                   // Parse index
-                      NodeParseFlag & flag,        // flag of result
-                      std::string & id);           // id for element parsing
-  bool MatchedStr(const std::string & content, 
-                  int & index, 
-                  const std::string & query) const;
+  const XmlValue * findAttribute(const std::string & name) const;
+  XmlValue & attributeSlot(const std::string & name);
+
+  // Compare tag, attributes and text, not the children
+  bool sameValue(const XmlNode & node) const;
+
+  // Take child out of the children list, its own links are kept
+  void unlinkChild(XmlNode * child);
+  // Make children, in that order, the children list
+  void relinkChildren(const std::vector<XmlNode *> & children);
 
-  void EatWhiteSpace(const std::string & content, int & start) const;
-  bool ReadNode(std::string content, int & index);
-  bool ReadDocument(std::string content, int & index);
+  // Children are released and copied without recursion
+  void releaseChildren();
+  void copyValue(const XmlNode & node);
+  // Store an encoded tag, text or attribute value, in the value pool
+  // if there is one
+  void setValue(const std::string & value);
+  void setValue(XmlValue & stored, const std::string & value) const;
+  // Any value refers into source_
+  bool hasSlice() const;
+  void copyChildren(const XmlNode & node);
 
-  const XmlNode * xPathRec(std::queue<std::string> paths) const;
+  /*
+    Where an xpath walk is: node is a candidate for the step at
+    [step_begin, step_end) of path, depth steps below root.
+    xpathFind moves node to the next match, or to NULL; with skip, the
+    node it is on is not one.
+  */
+  struct XPathState {
+    const XmlNode * root;
+    const XmlNode * node;
+    std::string_view path;
+    size_t depth;
+    size_t step_begin;
+    size_t step_end;
+  };
+  static void xpathStart(XPathState & state, const XmlNode * root, std::string_view path);
+  static void xpathFind(XPathState & state, bool skip);
+  /*
+    The walk of xpathFind for a XmlStaticPath, where the step is the
+    one at depth. Every match goes to found, or with no found, the
+    first match is returned.
+  */
+  template <size_t N>
+  static const XmlNode * xpathStatic(const XmlNode * root, const XmlStaticPath<N> & path,
+                                     std::vector<const XmlNode *> * found);
 
   // Type of this node
   NodeType type_;
@@ -387,23 +879,465 @@ class XmlNode {
   XmlNode * last_child_;
 
 
-  // TODO
-  // I will explain these member variables soon!
-  
-  // text_ has different meaning to different type.
-  std::string text_;
-  // tag_ is only used by element
-  // it is the name of tag
-  std::string tag_;
+  // The name of an element, or the text of a text, comment or
+  // unknown node. A slice value refers into source_.
+  XmlValue value_;
   
   // Attribute map
   // According to Xml 1.1, value of attributes should be
-  // string. Thus, a map in map<string, string> is used to
+  // string. Thus, a map of names to values is used to
   // present attributes.
-  std::map<std::string, std::string> attributes_;
+  AttributeMap attributes_;
+
+  // Content this node was read from, kept for lazy children and
+  // for the source span
+  std::shared_ptr<const XmlSource> source_;
+
+  // Set while the children are not parsed yet. They start at
+  // lazy_begin_ of source_, right after the open tag.
+  bool lazy_;
+  size_t lazy_begin_;
+
+  // [span_begin_, span_end_) of source_ while this subtree is
+  // unchanged. An empty span means there is none.
+  size_t span_begin_;
+  size_t span_end_;
+
+  // Content hash, 0 while it is not known. Not known for a node
+  // means not known for its ancestors either.
+  mutable uint64_t hash_;
+
+  // Pool of Clear and Read, only while capacity is retained
+  std::unique_ptr<XmlParser> recycler_;
   
 };
 
+template <typename Predicate>
+size_t XmlNode::RemoveChildrenIf(Predicate pred) {
+  expand();
+  size_t removed = 0;
+  XmlNode * scan = first_child_;
+  while (NULL != scan) {
+    XmlNode * next = scan->next_;
+    if (pred(*scan)) {
+      if (0 == removed)
+        touch();
+      unlinkChild(scan);
+      delete scan;
+      ++removed;
+    }
+    scan = next;
+  }
+
+  return removed;
+}
+
+/*
+  Children are sorted as a vector of pointers, which is much kinder
+  to the cache than merging the linked list, then relinked once.
+*/
+template <typename Compare>
+void XmlNode::SortChildren(Compare less) {
+  expand();
+  if (first_child_ == last_child_)
+    return;
+  touch();
+
+  std::vector<XmlNode *> children;
+  for (XmlNode * scan = first_child_; NULL != scan; scan = scan->next_)
+    children.push_back(scan);
+
+  std::stable_sort(children.begin(), children.end(),
+                   [&less](const XmlNode * a, const XmlNode * b) { return less(*a, *b); });
+  relinkChildren(children);
+}
+
+template <typename KeyFunction>
+void XmlNode::SortChildrenByKey(KeyFunction key) {
+  expand();
+  if (first_child_ == last_child_)
+    return;
+  touch();
+
+  typedef std::pair<decltype(key(*first_child_)), XmlNode *> KeyedChild;
+  std::vector<KeyedChild> keyed;
+  for (XmlNode * scan = first_child_; NULL != scan; scan = scan->next_)
+    keyed.push_back(KeyedChild(key(*scan), scan));
+
+  std::stable_sort(keyed.begin(), keyed.end(),
+                   [](const KeyedChild & a, const KeyedChild & b) { return a.first < b.first; });
+
+  std::vector<XmlNode *> children(keyed.size());
+  for (size_t index = 0; index < keyed.size(); ++index)
+    children[index] = keyed[index].second;
+  relinkChildren(children);
+}
+
+template <size_t N>
+const XmlNode * XmlNode::XPath(const XmlStaticPath<N> & path) const {
+  return xpathStatic(this, path, NULL);
+}
+
+template <size_t N>
+XmlNode * XmlNode::XPath(const XmlStaticPath<N> & path) {
+  return const_cast<XmlNode *>(xpathStatic(this, path, NULL));
+}
+
+template <size_t N>
+const std::vector<const XmlNode * > XmlNode::XPaths_c(const XmlStaticPath<N> & path) const {
+  std::vector<const XmlNode * > vec;
+  xpathStatic(this, path, &vec);
+  return vec;
+}
+
+template <size_t N>
+std::vector<XmlNode * > XmlNode::XPaths(const XmlStaticPath<N> & path) {
+  std::vector<const XmlNode * > found;
+  xpathStatic(this, path, &found);
+  std::vector<XmlNode * > vec(found.size());
+  for (size_t index = 0; index < found.size(); ++index)
+    vec[index] = const_cast<XmlNode *>(found[index]);
+  return vec;
+}
+
+template <size_t N>
+const XmlNode * XmlNode::xpathStatic(const XmlNode * root, const XmlStaticPath<N> & path,
+                                     std::vector<const XmlNode *> * found) {
+  if (0 == path.num_steps) {
+    if (NULL != found)
+      found->push_back(root);
+    return root;
+  }
+
+  const XmlNode * scan = root->FirstChild();
+  size_t depth = 0;
+  while (NULL != scan) {
+    if (ELEMENT == scan->type_ && scan->value_ == path.step(depth)) {
+      if (depth + 1 == path.num_steps) {
+        if (NULL == found)
+          return scan;
+        found->push_back(scan);
+      } else {
+        scan->expand();
+        if (NULL != scan->first_child_) {
+          scan = scan->first_child_;
+          ++depth;
+          continue;
+        }
+      }
+    }
+
+    while (NULL == scan->next_) {
+      if (0 == depth)
+        return NULL;
+      scan = scan->parent_;
+      --depth;
+    }
+    scan = scan->next_;
+  }
+
+  return NULL;
+}
+
+template <typename T>
+bool XmlNode::GetAttributeAs(const std::string & name, T & value) const {
+  if (ELEMENT != type_ && DECLARATION != type_)
+    return false;
+
+  const XmlValue * stored = findAttribute(name);
+  return NULL != stored && ParseValue(stored->data(), stored->size(), value);
+}
+
+template <typename T>
+bool XmlNode::GetTextAs(T & value) const {
+  const XmlNode * node = this;
+  if (ELEMENT == type_) {
+    node = FirstChild();
+    if (NULL == node || TEXT != node->type_)
+      return false;
+  }
+
+  return ParseValue(node->value_.data(), node->value_.size(), value);
+}
+
+template <typename T>
+typename std::enable_if<std::is_arithmetic<T>::value>::type
+XmlNode::SetAttribute(const std::string & name, T value) {
+  if (ELEMENT != type_ && DECLARATION != type_)
+    return;
+  touch();
+  std::string formatted;
+  FormatValue(value, formatted);
+  setValue(attributeSlot(name), formatted);
+}
+
+/*
+  Numbers never hold special characters, so the stored form is the
+  decoded one. A value with an entity does not parse, as it should.
+*/
+template <typename T>
+bool XmlNode::ParseValue(const char * data, size_t size, T & value) {
+  static_assert(std::is_arithmetic<T>::value, "ParseValue reads numbers and bools");
+
+  const char * end = data + size;
+  trimRange(data, end);
+
+  if constexpr (std::is_same<T, bool>::value) {
+    std::string_view text(data, end - data);
+    if ("true" == text || "1" == text)
+      value = true;
+    else if ("false" == text || "0" == text)
+      value = false;
+    else
+      return false;
+    return true;
+  } else {
+    // from_chars takes no leading '+'
+    if (end - data > 1 && '+' == *data && '-' != data[1])
+      ++data;
+
+    T parsed;
+    std::from_chars_result result = std::from_chars(data, end, parsed);
+    if (std::errc() != result.ec || end != result.ptr)
+      return false;
+    value = parsed;
+    return true;
+  }
+}
+
+template <typename T>
+void XmlNode::FormatValue(T value, std::string & out) {
+  if constexpr (std::is_same<T, bool>::value) {
+    out.assign(value ? "true" : "false");
+  } else {
+    // Enough for the shortest round trip form of any arithmetic type
+    char buffer[64];
+    std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out.assign(buffer, result.ptr);
+  }
+}
+
+/////////////////////////////////////////////
+// Iterators
+// Node is XmlNode or const XmlNode, a mutable iterator converts
+// to a const one.
+
+template <typename Node>
+class XmlNode::BasicPreorderIterator {
+ public:
+  typedef std::forward_iterator_tag iterator_category;
+  typedef XmlNode value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef Node * pointer;
+  typedef Node & reference;
+
+  BasicPreorderIterator() : root_(NULL), node_(NULL) {}
+  explicit BasicPreorderIterator(Node * root) : root_(root), node_(root) {}
+  BasicPreorderIterator(Node * root, Node * node) : root_(root), node_(node) {}
+  operator BasicPreorderIterator<const XmlNode>() const {
+    return BasicPreorderIterator<const XmlNode>(root_, node_);
+  }
+
+  reference operator*() const { return *node_; }
+  pointer operator->() const { return node_; }
+  BasicPreorderIterator & operator++() {
+    node_ = node_->NextInPreorder(root_);
+    return *this;
+  }
+  BasicPreorderIterator operator++(int) {
+    BasicPreorderIterator old(*this);
+    ++(*this);
+    return old;
+  }
+  bool operator==(const BasicPreorderIterator & other) const { return node_ == other.node_; }
+  bool operator!=(const BasicPreorderIterator & other) const { return node_ != other.node_; }
+
+ private:
+  Node * root_;
+  Node * node_;
+};
+
+template <typename Node>
+class XmlNode::BasicPostorderIterator {
+ public:
+  typedef std::forward_iterator_tag iterator_category;
+  typedef XmlNode value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef Node * pointer;
+  typedef Node & reference;
+
+  BasicPostorderIterator() : root_(NULL), node_(NULL) {}
+  explicit BasicPostorderIterator(Node * root)
+    : root_(root), node_((NULL == root) ? NULL : root->FirstInPostorder()) {}
+  BasicPostorderIterator(Node * root, Node * node) : root_(root), node_(node) {}
+  operator BasicPostorderIterator<const XmlNode>() const {
+    return BasicPostorderIterator<const XmlNode>(root_, node_);
+  }
+
+  reference operator*() const { return *node_; }
+  pointer operator->() const { return node_; }
+  BasicPostorderIterator & operator++() {
+    node_ = node_->NextInPostorder(root_);
+    return *this;
+  }
+  BasicPostorderIterator operator++(int) {
+    BasicPostorderIterator old(*this);
+    ++(*this);
+    return old;
+  }
+  bool operator==(const BasicPostorderIterator & other) const { return node_ == other.node_; }
+  bool operator!=(const BasicPostorderIterator & other) const { return node_ != other.node_; }
+
+ private:
+  Node * root_;
+  Node * node_;
+};
+
+/*
+  The end of the children is NULL, it steps back to the last child
+*/
+template <typename Node>
+class XmlNode::BasicChildIterator {
+ public:
+  typedef std::bidirectional_iterator_tag iterator_category;
+  typedef XmlNode value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef Node * pointer;
+  typedef Node & reference;
+
+  BasicChildIterator() : parent_(NULL), node_(NULL) {}
+  BasicChildIterator(Node * parent, Node * node) : parent_(parent), node_(node) {}
+  operator BasicChildIterator<const XmlNode>() const {
+    return BasicChildIterator<const XmlNode>(parent_, node_);
+  }
+
+  reference operator*() const { return *node_; }
+  pointer operator->() const { return node_; }
+  BasicChildIterator & operator++() {
+    node_ = node_->next_;
+    return *this;
+  }
+  BasicChildIterator operator++(int) {
+    BasicChildIterator old(*this);
+    ++(*this);
+    return old;
+  }
+  BasicChildIterator & operator--() {
+    node_ = (NULL == node_) ? parent_->last_child_ : node_->prev_;
+    return *this;
+  }
+  BasicChildIterator operator--(int) {
+    BasicChildIterator old(*this);
+    --(*this);
+    return old;
+  }
+  bool operator==(const BasicChildIterator & other) const { return node_ == other.node_; }
+  bool operator!=(const BasicChildIterator & other) const { return node_ != other.node_; }
+
+ private:
+  Node * parent_;
+  Node * node_;
+};
+
+template <typename Node>
+class XmlNode::BasicElementIterator {
+ public:
+  typedef std::bidirectional_iterator_tag iterator_category;
+  typedef XmlNode value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef Node * pointer;
+  typedef Node & reference;
+
+  BasicElementIterator() : parent_(NULL), node_(NULL) {}
+  // node is where the search starts, it may not match
+  BasicElementIterator(Node * parent, Node * node, std::string_view tag)
+    : parent_(parent), node_(node), tag_(tag) {
+    while (NULL != node_ && !matches(node_))
+      node_ = node_->next_;
+  }
+  operator BasicElementIterator<const XmlNode>() const {
+    return BasicElementIterator<const XmlNode>(parent_, node_, tag_);
+  }
+
+  reference operator*() const { return *node_; }
+  pointer operator->() const { return node_; }
+  BasicElementIterator & operator++() {
+    do {
+      node_ = node_->next_;
+    } while (NULL != node_ && !matches(node_));
+    return *this;
+  }
+  BasicElementIterator operator++(int) {
+    BasicElementIterator old(*this);
+    ++(*this);
+    return old;
+  }
+  BasicElementIterator & operator--() {
+    do {
+      node_ = (NULL == node_) ? parent_->last_child_ : node_->prev_;
+    } while (NULL != node_ && !matches(node_));
+    return *this;
+  }
+  BasicElementIterator operator--(int) {
+    BasicElementIterator old(*this);
+    --(*this);
+    return old;
+  }
+  bool operator==(const BasicElementIterator & other) const { return node_ == other.node_; }
+  bool operator!=(const BasicElementIterator & other) const { return node_ != other.node_; }
+
+ private:
+  bool matches(const XmlNode * node) const {
+    return ELEMENT == node->type_ && (tag_.empty() || node->value_ == tag_);
+  }
+
+  Node * parent_;
+  Node * node_;
+  std::string_view tag_;
+};
+
+template <typename Node>
+class XmlNode::BasicXPathIterator {
+ public:
+  typedef std::forward_iterator_tag iterator_category;
+  typedef XmlNode value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef Node * pointer;
+  typedef Node & reference;
+
+  BasicXPathIterator() {
+    state_.root = NULL;
+    state_.node = NULL;
+  }
+  BasicXPathIterator(Node * root, std::string_view path) {
+    xpathStart(state_, root, path);
+  }
+  operator BasicXPathIterator<const XmlNode>() const {
+    BasicXPathIterator<const XmlNode> other;
+    other.state_ = state_;
+    return other;
+  }
+
+  reference operator*() const { return *const_cast<Node *>(state_.node); }
+  pointer operator->() const { return const_cast<Node *>(state_.node); }
+  BasicXPathIterator & operator++() {
+    xpathFind(state_, true);
+    return *this;
+  }
+  BasicXPathIterator operator++(int) {
+    BasicXPathIterator old(*this);
+    ++(*this);
+    return old;
+  }
+  bool operator==(const BasicXPathIterator & other) const { return state_.node == other.state_.node; }
+  bool operator!=(const BasicXPathIterator & other) const { return state_.node != other.state_.node; }
+
+ private:
+  friend class BasicXPathIterator<XmlNode>;
+
+  XPathState state_;
+};
+
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,42 @@
+#include "XmlBinding.h"
+
+namespace SmallXml {
+
+namespace internal {
+
+bool sameTag(const XmlToken & open, const XmlToken & close) {
+  const char * end = close.name + close.name_size;
+  while (end != close.name && XmlNode::isWhiteSpace(*(end - 1)))
+    --end;
+  return static_cast<size_t>(end - close.name) == open.name_size &&
+         0 == memcmp(open.name, close.name, open.name_size);
+}
+
+void appendText(const XmlToken & token, std::string & out) {
+  const char * begin = token.value;
+  const char * end = token.value + token.value_size;
+  XmlNode::trimRange(begin, end);
+  out.append(begin, end - begin);
+}
+
+bool readElementText(XmlTokenizer & tokenizer, const XmlToken & open, std::string & out) {
+  out.clear();
+  if (XmlNode::SELF_CLOSE_TAG == open.flag)
+    return true;
+
+  XmlToken token;
+  while (tokenizer.Next(token)) {
+    if (XmlNode::CLOSE_TAG == token.flag)
+      return sameTag(open, token);
+    if (XmlNode::TEXT == token.type)
+      appendText(token, out);
+    else if (XmlNode::OPEN_TAG == token.flag && !tokenizer.SkipElement())
+      return false;
+  }
+
+  return false;
+}
+
+}
+
+}
@@ -0,0 +1,490 @@
+/*
+SmallXml - Tiny and Simple Xml DOM
+
+www.github.com/theliuy/SmallXml.git
+Author: Yang Liu
+        theliuy.com
+*/
+
+#ifndef SMALLXML_XMLBINDING_H
+#define SMALLXML_XMLBINDING_H
+
+#include <string>
+#include <vector>
+#include <tuple>
+#include <array>
+#include <utility>
+#include <type_traits>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+#include "SmallXml.h"
+#include "XmlParser.h"
+#include "XmlWriter.h"
+
+namespace SmallXml {
+
+/*
+  XmlBinding maps a struct to xml. Specialize it with a constexpr
+  list of fields, each naming an attribute, a child element or the
+  text of the element, and the member it goes to.
+
+  struct Author {
+    std::string name;
+  };
+  struct Book {
+    int64_t id;
+    std::string title;
+    double price;
+    std::vector<Author> authors;
+  };
+
+  template <> struct XmlBinding<Author> {
+    static constexpr auto fields = XmlFields(XmlText(&Author::name));
+  };
+  template <> struct XmlBinding<Book> {
+    static constexpr auto fields = XmlFields(
+        XmlAttribute("id", &Book::id),
+        XmlElement("title", &Book::title),
+        XmlElement("price", &Book::price),
+        XmlElement("author", &Book::authors));
+  };
+
+  Book book;
+  bool ok = ReadStruct(content, book);
+  ...
+  WriteStruct(writer, "book", book);
+
+  A member is a std::string, a number or bool (as GetAttributeAs reads
+  them), another bound struct, or for elements a std::vector of any
+  of those, which takes every element of that name.
+*/
+template <typename T> struct XmlBinding;
+
+enum XmlFieldKind {
+  XML_ATTRIBUTE_FIELD,
+  XML_ELEMENT_FIELD,
+  XML_TEXT_FIELD
+};
+
+template <typename Struct, typename Member, XmlFieldKind Kind>
+struct XmlField {
+  static constexpr XmlFieldKind kind = Kind;
+  const char * name;
+  size_t name_size;
+  Member Struct::* member;
+};
+
+/*
+  XmlAttribute - Field from the attribute name
+  XmlElement - Field from the child elements with tag name
+  XmlText - Field from the text of the element itself
+  XmlFields - The list of fields of a binding
+*/
+template <typename Struct, typename Member, size_t N>
+constexpr XmlField<Struct, Member, XML_ATTRIBUTE_FIELD>
+XmlAttribute(const char (&name)[N], Member Struct::* member) {
+  return XmlField<Struct, Member, XML_ATTRIBUTE_FIELD>{name, N - 1, member};
+}
+
+template <typename Struct, typename Member, size_t N>
+constexpr XmlField<Struct, Member, XML_ELEMENT_FIELD>
+XmlElement(const char (&name)[N], Member Struct::* member) {
+  return XmlField<Struct, Member, XML_ELEMENT_FIELD>{name, N - 1, member};
+}
+
+template <typename Struct, typename Member>
+constexpr XmlField<Struct, Member, XML_TEXT_FIELD> XmlText(Member Struct::* member) {
+  return XmlField<Struct, Member, XML_TEXT_FIELD>{"", 0, member};
+}
+
+template <typename... Fields>
+constexpr std::tuple<Fields...> XmlFields(Fields... fields) {
+  return std::tuple<Fields...>(fields...);
+}
+
+/*
+  ReadStruct - Read the top level element of content into value,
+               straight from the tokens, without building nodes.
+               Attributes and elements without a field are skipped,
+               fields which are not there keep their value, vectors
+               are appended to. Returns false on malformed content,
+               or a value which does not parse.
+  WriteStruct - Write value as the element tag.
+
+  NOTE:
+    Texts are trimmed, like PARSE_DEFAULT does, and decoded. The text
+    of an element is all its texts, joined.
+    Tags are matched as they are written, names with special
+    characters don't match.
+*/
+template <typename T> bool ReadStruct(const char * data, size_t size, T & value);
+template <typename T> bool ReadStruct(const std::string & content, T & value);
+template <typename T> bool WriteStruct(XmlWriter & writer, const char * tag, const T & value);
+
+/////////////////////////////////////////////
+// Implementation
+
+namespace internal {
+
+constexpr uint32_t bindingHash(const char * data, size_t size) {
+  uint32_t hash = 2166136261u;
+  for (size_t index = 0; index < size; ++index)
+    hash = (hash ^ static_cast<unsigned char>(data[index])) * 16777619u;
+  return hash;
+}
+
+// Most fields a binding may have
+const size_t kMaxBindingFields = 64;
+
+/*
+  A perfect hash of the names of one kind of fields, built at compile
+  time: slot (hash >> shift) & mask holds the field index + 1, or 0.
+  Without a perfect one, names are compared one by one.
+*/
+struct BindingTable {
+  unsigned char slots[kMaxBindingFields];
+  uint32_t mask;
+  uint32_t shift;
+  bool perfect;
+};
+
+template <size_t N>
+constexpr BindingTable makeBindingTable(const std::array<const char *, N> & names,
+                                        const std::array<size_t, N> & sizes,
+                                        const std::array<int, N> & kinds, int kind) {
+  BindingTable table{};
+  size_t count = 0;
+  for (size_t index = 0; index < N; ++index)
+    count += (kind == kinds[index]) ? 1 : 0;
+
+  for (uint32_t size = 1; size <= kMaxBindingFields; size *= 2) {
+    if (size < count)
+      continue;
+    for (uint32_t shift = 0; shift < 24; ++shift) {
+      bool used[kMaxBindingFields] = {};
+      bool collides = false;
+      for (size_t index = 0; index < N && !collides; ++index) {
+        if (kind != kinds[index])
+          continue;
+        uint32_t slot = (bindingHash(names[index], sizes[index]) >> shift) & (size - 1);
+        collides = used[slot];
+        used[slot] = true;
+      }
+      if (collides)
+        continue;
+
+      for (size_t index = 0; index < N; ++index) {
+        if (kind == kinds[index]) {
+          uint32_t slot = (bindingHash(names[index], sizes[index]) >> shift) & (size - 1);
+          table.slots[slot] = static_cast<unsigned char>(index + 1);
+        }
+      }
+      table.mask = size - 1;
+      table.shift = shift;
+      table.perfect = true;
+      return table;
+    }
+  }
+
+  return table;
+}
+
+template <typename T, typename = void>
+struct IsBound : std::false_type {};
+template <typename T>
+struct IsBound<T, decltype(void(XmlBinding<T>::fields))> : std::true_type {};
+
+template <typename T>
+struct IsVector : std::false_type {};
+template <typename T, typename Allocator>
+struct IsVector<std::vector<T, Allocator> > : std::true_type {};
+
+template <typename T, size_t... I>
+constexpr std::array<const char *, sizeof...(I)> fieldNames(std::index_sequence<I...>) {
+  return {{std::get<I>(XmlBinding<T>::fields).name...}};
+}
+
+template <typename T, size_t... I>
+constexpr std::array<size_t, sizeof...(I)> fieldSizes(std::index_sequence<I...>) {
+  return {{std::get<I>(XmlBinding<T>::fields).name_size...}};
+}
+
+template <typename T, size_t... I>
+constexpr std::array<int, sizeof...(I)> fieldKinds(std::index_sequence<I...>) {
+  typedef typename std::decay<decltype(XmlBinding<T>::fields)>::type Tuple;
+  return {{static_cast<int>(std::tuple_element<I, Tuple>::type::kind)...}};
+}
+
+template <size_t N>
+constexpr int firstField(const std::array<int, N> & kinds, int kind) {
+  for (size_t index = 0; index < N; ++index) {
+    if (kind == kinds[index])
+      return static_cast<int>(index);
+  }
+  return -1;
+}
+
+// What the compiler knows about the fields of a bound struct
+template <typename T>
+struct BoundFields {
+  typedef typename std::decay<decltype(XmlBinding<T>::fields)>::type Tuple;
+  static constexpr size_t size = std::tuple_size<Tuple>::value;
+  static_assert(size < kMaxBindingFields, "Too many fields in a XmlBinding");
+
+  static constexpr std::array<const char *, size> kNames = fieldNames<T>(std::make_index_sequence<size>());
+  static constexpr std::array<size_t, size> kSizes = fieldSizes<T>(std::make_index_sequence<size>());
+  static constexpr std::array<int, size> kKinds = fieldKinds<T>(std::make_index_sequence<size>());
+  static constexpr BindingTable kAttributes = makeBindingTable(kNames, kSizes, kKinds, XML_ATTRIBUTE_FIELD);
+  static constexpr BindingTable kElements = makeBindingTable(kNames, kSizes, kKinds, XML_ELEMENT_FIELD);
+  static constexpr int kText = firstField(kKinds, XML_TEXT_FIELD);
+
+  // Index of the field of that kind and name, -1 if there is none
+  static int find(const BindingTable & table, int kind, const char * name, size_t name_size) {
+    if (table.perfect) {
+      int slot = table.slots[(bindingHash(name, name_size) >> table.shift) & table.mask] - 1;
+      if (0 > slot || kSizes[slot] != name_size || 0 != memcmp(kNames[slot], name, name_size))
+        return -1;
+      return slot;
+    }
+
+    for (size_t index = 0; index < size; ++index) {
+      if (kind == kKinds[index] && kSizes[index] == name_size &&
+          0 == memcmp(kNames[index], name, name_size))
+        return static_cast<int>(index);
+    }
+    return -1;
+  }
+};
+
+/*
+  Call visitor with field index of the tuple. The compiler turns the
+  comparisons into a jump.
+*/
+template <typename Tuple, typename Visitor, size_t... I>
+bool visitField(const Tuple & fields, size_t index, Visitor & visitor, std::index_sequence<I...>) {
+  bool result = false;
+  (void)((index == I ? (result = visitor(std::get<I>(fields)), true) : false) || ...);
+  return result;
+}
+
+/*
+  Non template helpers, in XmlBinding.cpp
+  sameTag - Whether close closes open
+  appendText - Append a text token, trimmed and still encoded
+  readElementText - The texts of the element opened by open, joined
+                    and still encoded, up to its close tag. Child
+                    elements are skipped.
+*/
+bool sameTag(const XmlToken & open, const XmlToken & close);
+void appendText(const XmlToken & token, std::string & out);
+bool readElementText(XmlTokenizer & tokenizer, const XmlToken & open, std::string & out);
+
+inline bool readValue(const char * data, size_t size, std::string & member) {
+  member.clear();
+  XmlNode::XmlSpecialCharDecode(data, size, member);
+  return true;
+}
+
+template <typename T>
+typename std::enable_if<std::is_arithmetic<T>::value, bool>::type
+readValue(const char * data, size_t size, T & member) {
+  return XmlNode::ParseValue(data, size, member);
+}
+
+inline void writeValue(const std::string & member, std::string & out) {
+  out = member;
+}
+
+template <typename T>
+typename std::enable_if<std::is_arithmetic<T>::value>::type
+writeValue(T member, std::string & out) {
+  XmlNode::FormatValue(member, out);
+}
+
+template <typename T>
+bool readStruct(XmlTokenizer & tokenizer, const XmlToken & open, T & value, std::string & scratch);
+template <typename T>
+bool writeStruct(XmlWriter & writer, const char * tag, const T & value, std::string & scratch);
+
+template <typename T>
+bool readElement(XmlTokenizer & tokenizer, const XmlToken & open, T & member, std::string & scratch) {
+  if constexpr (IsBound<T>::value) {
+    return readStruct(tokenizer, open, member, scratch);
+  } else if constexpr (IsVector<T>::value) {
+    member.emplace_back();
+    return readElement(tokenizer, open, member.back(), scratch);
+  } else {
+    return readElementText(tokenizer, open, scratch) &&
+           readValue(scratch.data(), scratch.size(), member);
+  }
+}
+
+template <typename T>
+bool writeElement(XmlWriter & writer, const char * tag, const T & member, std::string & scratch) {
+  if constexpr (IsBound<T>::value) {
+    return writeStruct(writer, tag, member, scratch);
+  } else if constexpr (IsVector<T>::value) {
+    for (size_t index = 0; index < member.size(); ++index) {
+      if (!writeElement(writer, tag, member[index], scratch))
+        return false;
+    }
+    return true;
+  } else {
+    writeValue(member, scratch);
+    return writer.StartElement(tag) && writer.Text(scratch) && writer.EndElement();
+  }
+}
+
+/*
+  Attributes go through the attribute table, child elements through
+  the element table, texts are gathered for the text field. The
+  tokenizer ends behind the close tag of open.
+*/
+template <typename T>
+bool readStruct(XmlTokenizer & tokenizer, const XmlToken & open, T & value, std::string & scratch) {
+  typedef BoundFields<T> Bound;
+  const auto & fields = XmlBinding<T>::fields;
+  std::make_index_sequence<Bound::size> all;
+
+  const char * pos = open.value;
+  const char * end = open.value + open.value_size;
+  const char * name = NULL;
+  size_t name_size = 0;
+  const char * data = NULL;
+  size_t size = 0;
+  auto read_attribute = [&value, &data, &size](const auto & field) {
+    if constexpr (XML_ATTRIBUTE_FIELD == std::decay<decltype(field)>::type::kind)
+      return readValue(data, size, value.*field.member);
+    else
+      return false;
+  };
+  while (XmlTokenizer::NextAttribute(pos, end, name, name_size, data, size)) {
+    int index = Bound::find(Bound::kAttributes, XML_ATTRIBUTE_FIELD, name, name_size);
+    if (0 <= index && !visitField(fields, index, read_attribute, all))
+      return false;
+  }
+
+  std::string text;
+  auto read_text = [&value, &text](const auto & field) {
+    if constexpr (XML_TEXT_FIELD == std::decay<decltype(field)>::type::kind)
+      return readValue(text.data(), text.size(), value.*field.member);
+    else
+      return false;
+  };
+  if (XmlNode::SELF_CLOSE_TAG == open.flag)
+    return 0 > Bound::kText || visitField(fields, Bound::kText, read_text, all);
+
+  XmlToken token;
+  auto read_element = [&tokenizer, &token, &value, &scratch](const auto & field) {
+    if constexpr (XML_ELEMENT_FIELD == std::decay<decltype(field)>::type::kind)
+      return readElement(tokenizer, token, value.*field.member, scratch);
+    else
+      return false;
+  };
+  while (tokenizer.Next(token)) {
+    if (XmlNode::CLOSE_TAG == token.flag) {
+      if (!sameTag(open, token))
+        return false;
+      return 0 > Bound::kText || visitField(fields, Bound::kText, read_text, all);
+    }
+
+    if (XmlNode::TEXT == token.type) {
+      if (0 <= Bound::kText)
+        appendText(token, text);
+      continue;
+    }
+    if (XmlNode::ELEMENT != token.type)
+      continue;
+
+    int index = Bound::find(Bound::kElements, XML_ELEMENT_FIELD, token.name, token.name_size);
+    if (0 > index) {
+      if (XmlNode::OPEN_TAG == token.flag && !tokenizer.SkipElement())
+        return false;
+      continue;
+    }
+    if (!visitField(fields, index, read_element, all))
+      return false;
+  }
+
+  return false;
+}
+
+/*
+  Attributes first, then texts and elements in the order of the fields
+*/
+template <typename T>
+bool writeStruct(XmlWriter & writer, const char * tag, const T & value, std::string & scratch) {
+  if (!writer.StartElement(tag))
+    return false;
+
+  auto write_attribute = [&writer, &value, &scratch](const auto & field) {
+    if constexpr (XML_ATTRIBUTE_FIELD == std::decay<decltype(field)>::type::kind) {
+      writeValue(value.*field.member, scratch);
+      return writer.Attribute(field.name, scratch.c_str());
+    } else {
+      return true;
+    }
+  };
+  auto write_content = [&writer, &value, &scratch](const auto & field) {
+    typedef typename std::decay<decltype(field)>::type Field;
+    if constexpr (XML_ELEMENT_FIELD == Field::kind) {
+      return writeElement(writer, field.name, value.*field.member, scratch);
+    } else if constexpr (XML_TEXT_FIELD == Field::kind) {
+      writeValue(value.*field.member, scratch);
+      return writer.Text(scratch);
+    } else {
+      return true;
+    }
+  };
+
+  bool ok = std::apply([&write_attribute](const auto & ... field) {
+    return (true && ... && write_attribute(field));
+  }, XmlBinding<T>::fields);
+  ok = ok && std::apply([&write_content](const auto & ... field) {
+    return (true && ... && write_content(field));
+  }, XmlBinding<T>::fields);
+  return ok && writer.EndElement();
+}
+
+}
+
+template <typename T>
+bool ReadStruct(const char * data, size_t size, T & value) {
+  static_assert(internal::IsBound<T>::value, "ReadStruct needs a XmlBinding<T>");
+
+  XmlTokenizer tokenizer(PARSE_SKIP_COMMENTS | PARSE_SKIP_DECLARATIONS | PARSE_SKIP_WHITESPACE_TEXT);
+  tokenizer.Reset(data, size);
+  std::string scratch;
+  bool read = false;
+  XmlToken token;
+  while (tokenizer.Next(token)) {
+    if (XmlNode::ELEMENT != token.type)
+      continue;
+    if (read || XmlNode::CLOSE_TAG == token.flag)
+      return false;
+    if (!internal::readStruct(tokenizer, token, value, scratch))
+      return false;
+    read = true;
+  }
+
+  return read && !tokenizer.Failed();
+}
+
+template <typename T>
+bool ReadStruct(const std::string & content, T & value) {
+  return ReadStruct(content.data(), content.size(), value);
+}
+
+template <typename T>
+bool WriteStruct(XmlWriter & writer, const char * tag, const T & value) {
+  static_assert(internal::IsBound<T>::value, "WriteStruct needs a XmlBinding<T>");
+
+  std::string scratch;
+  return internal::writeStruct(writer, tag, value, scratch);
+}
+
+}
+
+#endif
@@ -0,0 +1,301 @@
+#include "XmlEncoding.h"
+#include "XmlParser.h"
+
+#include <cstring>
+#include <cctype>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace SmallXml {
+
+namespace {
+
+bool startsWith(const char * pos, const char * end, const char * prefix, size_t size) {
+  return static_cast<size_t>(end - pos) >= size && 0 == memcmp(pos, prefix, size);
+}
+
+/*
+  Size of the ASCII run at the start of [data, data + size)
+*/
+size_t asciiRun(const unsigned char * data, size_t size) {
+  size_t index = 0;
+#if defined(__SSE2__)
+  for (; index + 16 <= size; index += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + index));
+    int mask = _mm_movemask_epi8(chunk);
+    if (0 != mask)
+      return index + __builtin_ctz(mask);
+  }
+#endif
+  while (index < size && data[index] < 0x80)
+    ++index;
+  return index;
+}
+
+char * appendUtf8(char * out, unsigned int code) {
+  if (code < 0x80) {
+    *out++ = static_cast<char>(code);
+  } else if (code < 0x800) {
+    *out++ = static_cast<char>(0xC0 | (code >> 6));
+    *out++ = static_cast<char>(0x80 | (code & 0x3F));
+  } else if (code < 0x10000) {
+    *out++ = static_cast<char>(0xE0 | (code >> 12));
+    *out++ = static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+    *out++ = static_cast<char>(0x80 | (code & 0x3F));
+  } else {
+    *out++ = static_cast<char>(0xF0 | (code >> 18));
+    *out++ = static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+    *out++ = static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+    *out++ = static_cast<char>(0x80 | (code & 0x3F));
+  }
+  return out;
+}
+
+/*
+  Every byte is one code point, at most two bytes in UTF-8
+*/
+char * latin1ToUtf8(const unsigned char * data, size_t size, char * out) {
+  size_t index = 0;
+  while (index < size) {
+    size_t run = asciiRun(data + index, size - index);
+    memcpy(out, data + index, run);
+    out += run;
+    index += run;
+    if (index < size)
+      out = appendUtf8(out, data[index++]);
+  }
+  return out;
+}
+
+unsigned int unitAt(const unsigned char * data, bool big_endian) {
+  return big_endian ? (data[0] << 8) | data[1] : data[0] | (data[1] << 8);
+}
+
+/*
+  Eight ASCII units at a time are packed to bytes. Returns NULL on a
+  broken surrogate pair.
+*/
+char * utf16ToUtf8(const unsigned char * data, size_t size, bool big_endian, char * out) {
+  size_t index = 0;
+  while (index < size) {
+#if defined(__SSE2__)
+    if (index + 16 <= size) {
+      __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + index));
+      if (big_endian)
+        chunk = _mm_or_si128(_mm_slli_epi16(chunk, 8), _mm_srli_epi16(chunk, 8));
+      __m128i high = _mm_and_si128(chunk, _mm_set1_epi16(static_cast<short>(0xFF80)));
+      if (0xFFFF == _mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128()))) {
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out), _mm_packus_epi16(chunk, chunk));
+        out += 8;
+        index += 16;
+        continue;
+      }
+    }
+#endif
+
+    unsigned int code = unitAt(data + index, big_endian);
+    index += 2;
+    if (code >= 0xD800 && code <= 0xDBFF) {
+      if (index + 2 > size)
+        return NULL;
+      unsigned int low = unitAt(data + index, big_endian);
+      if (low < 0xDC00 || low > 0xDFFF)
+        return NULL;
+      index += 2;
+      code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+    } else if (code >= 0xDC00 && code <= 0xDFFF) {
+      return NULL;
+    }
+    out = appendUtf8(out, code);
+  }
+  return out;
+}
+
+/*
+  Value of encoding="..." in a declaration right at data
+*/
+std::string declaredEncoding(const char * data, size_t size) {
+  const char * end = data + size;
+  if (!startsWith(data, end, "<?xml", 5))
+    return "";
+
+  const char * close = data + 5;
+  while (close + 1 < end && !('?' == close[0] && '>' == close[1]))
+    ++close;
+  if (close + 1 >= end)
+    return "";
+
+  const char * pos = data + 5;
+  const char * name = NULL;
+  const char * value = NULL;
+  size_t name_size = 0;
+  size_t value_size = 0;
+  while (XmlTokenizer::NextAttribute(pos, close, name, name_size, value, value_size)) {
+    if (8 == name_size && 0 == memcmp(name, "encoding", 8))
+      return std::string(value, value_size);
+  }
+  return "";
+}
+
+}
+
+XmlEncoding DetectEncoding(const char * data, size_t size, size_t & bom_size) {
+  const char * end = data + size;
+  bom_size = 0;
+  if (startsWith(data, end, "\xEF\xBB\xBF", 3)) {
+    bom_size = 3;
+    return ENCODING_UTF8;
+  }
+  if (startsWith(data, end, "\xFF\xFE", 2)) {
+    bom_size = 2;
+    return ENCODING_UTF16LE;
+  }
+  if (startsWith(data, end, "\xFE\xFF", 2)) {
+    bom_size = 2;
+    return ENCODING_UTF16BE;
+  }
+  if (startsWith(data, end, "<\0?\0", 4))
+    return ENCODING_UTF16LE;
+  if (startsWith(data, end, "\0<\0?", 4))
+    return ENCODING_UTF16BE;
+
+  std::string name = declaredEncoding(data, size);
+  return name.empty() ? ENCODING_UTF8 : EncodingByName(name);
+}
+
+XmlEncoding EncodingByName(const std::string & name) {
+  std::string upper(name);
+  for (size_t index = 0; index < upper.size(); ++index)
+    upper[index] = static_cast<char>(toupper(static_cast<unsigned char>(upper[index])));
+
+  if ("UTF-8" == upper || "UTF8" == upper || "US-ASCII" == upper || "ASCII" == upper)
+    return ENCODING_UTF8;
+  if ("ISO-8859-1" == upper || "ISO_8859-1" == upper || "ISO8859-1" == upper ||
+      "LATIN1" == upper || "LATIN-1" == upper)
+    return ENCODING_LATIN1;
+  // Without a byte order mark, UTF-16 is big endian
+  if ("UTF-16" == upper || "UTF-16BE" == upper)
+    return ENCODING_UTF16BE;
+  if ("UTF-16LE" == upper)
+    return ENCODING_UTF16LE;
+  return ENCODING_UNKNOWN;
+}
+
+/*
+  out is sized for the longest result first: two bytes for a Latin-1
+  byte, three for a UTF-16 unit. It keeps its capacity.
+*/
+bool TranscodeToUtf8(const char * data, size_t size, XmlEncoding encoding, std::string & out) {
+  const unsigned char * bytes = reinterpret_cast<const unsigned char *>(data);
+  char * begin = NULL;
+  char * end = NULL;
+
+  switch (encoding) {
+    case ENCODING_UTF8:
+      out.assign(data, size);
+      return true;
+    case ENCODING_LATIN1:
+      out.resize(2 * size);
+      begin = &out[0];
+      end = latin1ToUtf8(bytes, size, begin);
+      break;
+    case ENCODING_UTF16LE:
+    case ENCODING_UTF16BE:
+      if (0 != size % 2) {
+        out.clear();
+        return false;
+      }
+      out.resize(size / 2 * 3 + 8);
+      begin = &out[0];
+      end = utf16ToUtf8(bytes, size, ENCODING_UTF16BE == encoding, begin);
+      break;
+    default:
+      out.clear();
+      return false;
+  }
+
+  if (NULL == end) {
+    out.clear();
+    return false;
+  }
+  out.resize(end - begin);
+  return true;
+}
+
+/////////////////////////////////////////////
+// XmlUtf8Validator
+
+XmlUtf8Validator::XmlUtf8Validator()
+  : valid_(true), pending_(0), lower_(0x80), upper_(0xBF) {
+}
+
+/*
+  The allowed range of the first continuation byte rules out overlong
+  forms (E0, F0), surrogates (ED) and code points above U+10FFFF (F4).
+*/
+bool XmlUtf8Validator::Feed(const char * data, size_t size) {
+  const unsigned char * bytes = reinterpret_cast<const unsigned char *>(data);
+  size_t index = 0;
+
+  while (valid_ && index < size) {
+    if (0 == pending_) {
+      index += asciiRun(bytes + index, size - index);
+      if (index == size)
+        break;
+
+      unsigned char lead = bytes[index++];
+      lower_ = 0x80;
+      upper_ = 0xBF;
+      if (lead >= 0xC2 && lead <= 0xDF) {
+        pending_ = 1;
+      } else if (lead >= 0xE0 && lead <= 0xEF) {
+        pending_ = 2;
+        if (0xE0 == lead)
+          lower_ = 0xA0;
+        else if (0xED == lead)
+          upper_ = 0x9F;
+      } else if (lead >= 0xF0 && lead <= 0xF4) {
+        pending_ = 3;
+        if (0xF0 == lead)
+          lower_ = 0x90;
+        else if (0xF4 == lead)
+          upper_ = 0x8F;
+      } else {
+        valid_ = false;
+      }
+      continue;
+    }
+
+    unsigned char next = bytes[index++];
+    if (next < lower_ || next > upper_) {
+      valid_ = false;
+      break;
+    }
+    --pending_;
+    lower_ = 0x80;
+    upper_ = 0xBF;
+  }
+
+  return valid_;
+}
+
+bool XmlUtf8Validator::Finish() const {
+  return valid_ && 0 == pending_;
+}
+
+void XmlUtf8Validator::Reset() {
+  valid_ = true;
+  pending_ = 0;
+  lower_ = 0x80;
+  upper_ = 0xBF;
+}
+
+bool XmlUtf8Validator::Validate(const char * data, size_t size) {
+  XmlUtf8Validator validator;
+  validator.Feed(data, size);
+  return validator.Finish();
+}
+
+}
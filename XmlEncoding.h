@@ -0,0 +1,85 @@
+/*
+SmallXml - Tiny and Simple Xml DOM
+
+www.github.com/theliuy/SmallXml.git
+Author: Yang Liu
+        theliuy.com
+*/
+
+#ifndef SMALLXML_XMLENCODING_H
+#define SMALLXML_XMLENCODING_H
+
+#include <string>
+#include <cstddef>
+
+namespace SmallXml {
+
+/*
+  Encodings content can be read from. Nodes always hold UTF-8, other
+  encodings are converted while reading with PARSE_TRANSCODE.
+*/
+enum XmlEncoding {
+  ENCODING_UTF8,
+  ENCODING_UTF16LE,
+  ENCODING_UTF16BE,
+  ENCODING_LATIN1,
+  ENCODING_UNKNOWN
+};
+
+/*
+  DetectEncoding - Encoding of [data, data + size), by its byte order
+                   mark, by the byte pattern of "<?" in UTF-16, or by
+                   the encoding of its declaration, in that order.
+                   Without any of them it is UTF-8. bom_size is the
+                   size of the byte order mark, 0 without one.
+  EncodingByName - Encoding of a declared name, case insensitive.
+                   ENCODING_UNKNOWN for names not supported.
+  TranscodeToUtf8 - Convert [data, data + size), without its byte
+                    order mark, to UTF-8 into out. Returns false on
+                    an odd UTF-16 size or a broken surrogate pair.
+*/
+XmlEncoding DetectEncoding(const char * data, size_t size, size_t & bom_size);
+XmlEncoding EncodingByName(const std::string & name);
+bool TranscodeToUtf8(const char * data, size_t size, XmlEncoding encoding, std::string & out);
+
+/*
+  XmlUtf8Validator checks UTF-8 fed in pieces, as it is read. A
+  sequence may be cut between two pieces. Overlong forms, surrogates
+  and code points above U+10FFFF are invalid.
+
+  XmlUtf8Validator validator;
+  while (read_more(buffer, size))
+    validator.Feed(buffer, size);
+  if (!validator.Finish())
+    reject();
+
+  Runs of ASCII are skipped 16 bytes at a time with SSE2 where
+  available, the rest is checked byte by byte.
+
+  Feed - Check the next bytes. Returns false once anything fed was
+         invalid, later bytes are not looked at then.
+  Finish - True when all that was fed was valid and no sequence is
+           left open.
+  Validate - Both at once, for a whole buffer.
+*/
+class XmlUtf8Validator {
+ public:
+  XmlUtf8Validator();
+
+  bool Feed(const char * data, size_t size);
+  bool Finish() const;
+  void Reset();
+
+  static bool Validate(const char * data, size_t size);
+
+ private:
+  bool valid_;
+  // Continuation bytes still expected, and the range of the next one
+  int pending_;
+  unsigned char lower_;
+  unsigned char upper_;
+};
+
+}
+
+#endif
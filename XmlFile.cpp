@@ -0,0 +1,427 @@
+#include "XmlFile.h"
+
+#include <cstring>
+#include <climits>
+
+#include <zlib.h>
+
+namespace SmallXml {
+
+namespace {
+
+const size_t kNone = static_cast<size_t>(-1);
+
+// Big enough for the gzip magic bytes
+const size_t kMinBufferSize = 16;
+
+bool isGzipMagic(const unsigned char * data) {
+  return 0x1f == data[0] && 0x8b == data[1];
+}
+
+}
+
+/////////////////////////////////////////////
+// XmlFileReader
+
+XmlFileReader::XmlFileReader(size_t buffer_size, size_t num_buffers)
+  : buffer_size_(buffer_size < kMinBufferSize ? kMinBufferSize : buffer_size),
+    buffers_(0 == num_buffers ? 1 : num_buffers),
+    sizes_(buffers_.size(), 0),
+    file_(NULL),
+    owns_file_(false),
+    size_hint_(0),
+    done_(true),
+    failed_(false),
+    stop_(false),
+    current_(kNone) {
+  for (size_t index = 0; index < buffers_.size(); ++index)
+    buffers_[index].resize(buffer_size_);
+}
+
+XmlFileReader::~XmlFileReader() {
+  Close();
+}
+
+/*
+  A seekable file tells its size. For gzip, that is the size in the
+  last four bytes, little endian and modulo 4GB.
+*/
+bool XmlFileReader::Open(const std::string & path) {
+  Close();
+
+  FILE * file = fopen(path.c_str(), "rb");
+  if (NULL == file)
+    return false;
+
+  unsigned char head[2] = {0, 0};
+  unsigned char tail[4] = {0, 0, 0, 0};
+  if (0 == fseek(file, 0, SEEK_END)) {
+    long size = ftell(file);
+    if (6 <= size && 0 == fseek(file, 0, SEEK_SET) && 2 == fread(head, 1, 2, file) &&
+        isGzipMagic(head) && 0 == fseek(file, -4, SEEK_END) && 4 == fread(tail, 1, 4, file)) {
+      size_hint_ = static_cast<size_t>(tail[0]) | (static_cast<size_t>(tail[1]) << 8) |
+                   (static_cast<size_t>(tail[2]) << 16) | (static_cast<size_t>(tail[3]) << 24);
+    } else if (0 < size) {
+      size_hint_ = static_cast<size_t>(size);
+    }
+  }
+  if (0 != fseek(file, 0, SEEK_SET)) {
+    fclose(file);
+    return false;
+  }
+
+  start(file, true);
+  return true;
+}
+
+bool XmlFileReader::Open(FILE * file) {
+  Close();
+  if (NULL == file)
+    return false;
+
+  start(file, false);
+  return true;
+}
+
+/*
+  A thread blocked on a pipe is only joined once its read returns.
+*/
+void XmlFileReader::Close() {
+  if (thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    changed_.notify_all();
+    thread_.join();
+  }
+
+  if (owns_file_ && NULL != file_)
+    fclose(file_);
+  file_ = NULL;
+  owns_file_ = false;
+
+  full_.clear();
+  free_.clear();
+  current_ = kNone;
+  done_ = true;
+  failed_ = false;
+  stop_ = false;
+}
+
+bool XmlFileReader::Next(const char * & data, size_t & size) {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  // The last piece is done with, its buffer can be filled again
+  if (kNone != current_) {
+    free_.push_back(current_);
+    current_ = kNone;
+    changed_.notify_all();
+  }
+
+  changed_.wait(lock, [this] { return done_ || !full_.empty(); });
+  if (full_.empty())
+    return false;
+
+  current_ = full_.front();
+  full_.pop_front();
+  data = buffers_[current_].data();
+  size = sizes_[current_];
+  return true;
+}
+
+bool XmlFileReader::Failed() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return failed_;
+}
+
+size_t XmlFileReader::SizeHint() const {
+  return size_hint_;
+}
+
+void XmlFileReader::start(FILE * file, bool owns_file) {
+  file_ = file;
+  owns_file_ = owns_file;
+  if (!owns_file)
+    size_hint_ = 0;
+
+  full_.clear();
+  free_.clear();
+  for (size_t index = 0; index < buffers_.size(); ++index)
+    free_.push_back(index);
+  current_ = kNone;
+  done_ = false;
+  failed_ = false;
+  stop_ = false;
+
+  thread_ = std::thread(&XmlFileReader::run, this);
+}
+
+/*
+  The first two bytes tell whether the file is gzip. A plain file is
+  read straight into the buffers, those two bytes first.
+*/
+void XmlFileReader::run() {
+  unsigned char magic[2] = {0, 0};
+  size_t magic_size = fread(magic, 1, 2, file_);
+  if (ferror(file_)) {
+    finish(true);
+    return;
+  }
+
+  if (2 != magic_size || !isGzipMagic(magic)) {
+    size_t carried = magic_size;
+    bool end = false;
+    while (!end) {
+      size_t index = takeFree();
+      if (kNone == index)
+        return;
+
+      char * out = buffers_[index].data();
+      memcpy(out, magic, carried);
+      size_t size = carried + fread(out + carried, 1, buffer_size_ - carried, file_);
+      carried = 0;
+      if (ferror(file_)) {
+        finish(true);
+        return;
+      }
+
+      end = (size < buffer_size_);
+      if (0 != size)
+        deliver(index, size);
+    }
+
+    finish(false);
+    return;
+  }
+
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  // 16 + window bits: gzip header and trailer
+  if (Z_OK != inflateInit2(&stream, 16 + MAX_WBITS)) {
+    finish(true);
+    return;
+  }
+
+  std::vector<char> input(buffer_size_);
+  memcpy(input.data(), magic, 2);
+  size_t input_size = 2 + fread(input.data() + 2, 1, buffer_size_ - 2, file_);
+  bool input_end = (input_size < buffer_size_);
+  stream.next_in = reinterpret_cast<Bytef *>(input.data());
+  stream.avail_in = static_cast<uInt>(input_size);
+
+  bool ok = !ferror(file_);
+  bool end = false;
+  while (ok && !end) {
+    size_t index = takeFree();
+    if (kNone == index) {
+      inflateEnd(&stream);
+      return;
+    }
+
+    size_t filled = 0;
+    ok = inflatePiece(stream, input, input_end, buffers_[index].data(), filled, end);
+    if (ok && 0 != filled)
+      deliver(index, filled);
+  }
+
+  inflateEnd(&stream);
+  finish(!ok);
+}
+
+/*
+  After the end of a gzip member, more input is another member. Input
+  which ends inside a member is a truncated file.
+*/
+bool XmlFileReader::inflatePiece(z_stream & stream, std::vector<char> & input, bool & input_end,
+                                 char * out, size_t & filled, bool & end) {
+  stream.next_out = reinterpret_cast<Bytef *>(out);
+  stream.avail_out = static_cast<uInt>(buffer_size_);
+
+  while (0 != stream.avail_out) {
+    if (0 == stream.avail_in && !input_end) {
+      size_t size = fread(input.data(), 1, input.size(), file_);
+      if (ferror(file_))
+        return false;
+      input_end = (size < input.size());
+      stream.next_in = reinterpret_cast<Bytef *>(input.data());
+      stream.avail_in = static_cast<uInt>(size);
+    }
+
+    int result = inflate(&stream, Z_NO_FLUSH);
+    if (Z_STREAM_END == result) {
+      if (0 == stream.avail_in && !input_end)
+        continue;
+      if (0 == stream.avail_in) {
+        end = true;
+        break;
+      }
+      if (Z_OK != inflateReset(&stream))
+        return false;
+    } else if (Z_BUF_ERROR == result) {
+      if (0 == stream.avail_in && input_end)
+        return false;
+    } else if (Z_OK != result) {
+      return false;
+    }
+  }
+
+  filled = buffer_size_ - stream.avail_out;
+  return true;
+}
+
+size_t XmlFileReader::takeFree() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [this] { return stop_ || !free_.empty(); });
+  if (stop_)
+    return kNone;
+
+  size_t index = free_.front();
+  free_.pop_front();
+  return index;
+}
+
+void XmlFileReader::deliver(size_t index, size_t size) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sizes_[index] = size;
+    full_.push_back(index);
+  }
+  changed_.notify_all();
+}
+
+void XmlFileReader::finish(bool failed) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_ = true;
+    failed_ = failed;
+  }
+  changed_.notify_all();
+}
+
+/////////////////////////////////////////////
+// Files
+
+/*
+  The content is reserved up front when the file tells its size, so
+  it is not copied while it grows.
+*/
+bool LoadFile(const std::string & path, XmlNode & node, int options) {
+  XmlFileReader reader;
+  if (!reader.Open(path))
+    return false;
+
+  std::string content;
+  content.reserve(reader.SizeHint());
+  const char * data = NULL;
+  size_t size = 0;
+  while (reader.Next(data, size))
+    content.append(data, size);
+  if (reader.Failed())
+    return false;
+  reader.Close();
+
+  XmlParser parser(options);
+  return parser.Read(content, node);
+}
+
+bool MatchFile(const std::string & path, XmlStreamMatcher & matcher) {
+  matcher.Reset();
+
+  XmlFileReader reader;
+  if (!reader.Open(path))
+    return false;
+
+  const char * data = NULL;
+  size_t size = 0;
+  while (reader.Next(data, size)) {
+    if (!matcher.Feed(data, size))
+      return false;
+  }
+
+  return !reader.Failed() && matcher.Finish();
+}
+
+/////////////////////////////////////////////
+// XmlGzipSink
+
+XmlGzipSink::XmlGzipSink(XmlSink & out, int level, size_t buffer_size)
+  : out_(out),
+    stream_(new z_stream),
+    buffer_(buffer_size < kMinBufferSize ? kMinBufferSize : buffer_size),
+    finished_(false),
+    good_(false) {
+  memset(stream_, 0, sizeof(z_stream));
+  // 16 + window bits: gzip header and trailer
+  good_ = (Z_OK == deflateInit2(stream_, level, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY));
+}
+
+XmlGzipSink::~XmlGzipSink() {
+  if (good_ && !finished_)
+    Finish();
+  deflateEnd(stream_);
+  delete stream_;
+}
+
+bool XmlGzipSink::Write(const char * data, size_t size) {
+  if (!good_ || finished_)
+    return false;
+
+  // avail_in is 32 bits
+  while (0 != size) {
+    size_t piece = (size < UINT_MAX) ? size : UINT_MAX;
+    stream_->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    stream_->avail_in = static_cast<uInt>(piece);
+    if (!deflateInput(Z_NO_FLUSH))
+      return false;
+    data += piece;
+    size -= piece;
+  }
+
+  return true;
+}
+
+bool XmlGzipSink::Flush() {
+  if (!good_)
+    return false;
+  if (!finished_ && !deflateInput(Z_SYNC_FLUSH))
+    return false;
+
+  return out_.Flush();
+}
+
+bool XmlGzipSink::Finish() {
+  if (finished_)
+    return good_;
+
+  finished_ = true;
+  if (!good_ || !deflateInput(Z_FINISH))
+    return false;
+
+  return out_.Flush();
+}
+
+/*
+  Deflate until it leaves room in the buffer, then all input is taken
+  and, for Z_FINISH, the trailer is written.
+*/
+bool XmlGzipSink::deflateInput(int flush) {
+  do {
+    stream_->next_out = reinterpret_cast<Bytef *>(buffer_.data());
+    stream_->avail_out = static_cast<uInt>(buffer_.size());
+    if (Z_STREAM_ERROR == deflate(stream_, flush)) {
+      good_ = false;
+      return false;
+    }
+
+    size_t produced = buffer_.size() - stream_->avail_out;
+    if (0 != produced && !out_.Write(buffer_.data(), produced)) {
+      good_ = false;
+      return false;
+    }
+  } while (0 == stream_->avail_out);
+
+  return true;
+}
+
+}
@@ -0,0 +1,174 @@
+/*
+SmallXml - Tiny and Simple Xml DOM
+
+www.github.com/theliuy/SmallXml.git
+Author: Yang Liu
+        theliuy.com
+*/
+
+#ifndef SMALLXML_XMLFILE_H
+#define SMALLXML_XMLFILE_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "SmallXml.h"
+#include "XmlParser.h"
+#include "XmlWriter.h"
+#include "XmlMatcher.h"
+
+struct z_stream_s;
+
+namespace SmallXml {
+
+/*
+  XmlFileReader reads a file piece by piece. A gzip file (it starts
+  with 1f 8b) is inflated on the way, so a .xml.gz reads like the
+  .xml it holds. Concatenated gzip members are read one after the
+  other, like gunzip does.
+
+  Reading and inflating run on a second thread, at most num_buffers
+  pieces ahead of the caller, so working on one piece overlaps with
+  decompressing the next ones. Memory is num_buffers * buffer_size
+  and the inflate window, whatever the size of the file.
+
+  XmlFileReader reader;
+  if (!reader.Open("feed.xml.gz"))
+    ...
+  const char * data = NULL;
+  size_t size = 0;
+  while (reader.Next(data, size))
+    matcher.Feed(data, size);
+  if (reader.Failed())
+    ...
+
+  NOTE:
+    A piece is valid until the next call to Next, Open or Close.
+*/
+class XmlFileReader {
+ public:
+  explicit XmlFileReader(size_t buffer_size = 64 * 1024, size_t num_buffers = 4);
+  ~XmlFileReader();
+
+  /*
+    Open - Start reading a file. The FILE form reads from a file
+           opened by the caller, a pipe works too, and does not close
+           it. Returns false if the file can't be opened.
+    Close - Stop reading, the thread ends. Open does it first.
+  */
+  bool Open(const std::string & path);
+  bool Open(FILE * file);
+  void Close();
+
+  /*
+    Next - The next piece of the content. Returns false at the end, or
+           when the file can't be read or inflated. Failed() tells
+           them apart.
+  */
+  bool Next(const char * & data, size_t & size);
+  bool Failed() const;
+
+  /*
+    Size of the content, as far as the file tells it before reading:
+    the size of a plain file, the size in the trailer of a gzip file.
+    0 when it is not known, like for a pipe. Only a hint.
+  */
+  size_t SizeHint() const;
+
+ private:
+  // Not copyable
+  XmlFileReader(const XmlFileReader &);
+  XmlFileReader & operator=(const XmlFileReader &);
+
+  void start(FILE * file, bool owns_file);
+  // The second thread
+  void run();
+  // Inflate into out until it is full or the content ends
+  bool inflatePiece(z_stream_s & stream, std::vector<char> & input, bool & input_end,
+                    char * out, size_t & filled, bool & end);
+  // A free buffer to fill, or npos once stopped
+  size_t takeFree();
+  void deliver(size_t index, size_t size);
+  void finish(bool failed);
+
+  size_t buffer_size_;
+  std::vector<std::vector<char> > buffers_;
+  std::vector<size_t> sizes_;
+
+  FILE * file_;
+  bool owns_file_;
+  size_t size_hint_;
+
+  // Shared with the thread, under mutex_
+  mutable std::mutex mutex_;
+  std::condition_variable changed_;
+  std::deque<size_t> full_;
+  std::deque<size_t> free_;
+  bool done_;
+  bool failed_;
+  bool stop_;
+
+  // Buffer the caller is reading, or npos
+  size_t current_;
+  std::thread thread_;
+};
+
+/*
+  LoadFile - Read a whole file, gzip or not, into node, like Read
+             with a XmlParser of those options. The compressed bytes
+             are never held as a whole, only the content is.
+  MatchFile - Feed a whole file, gzip or not, to a matcher, after a
+              Reset. Memory stays bounded by the buffers of the reader
+              and what the matcher keeps.
+*/
+bool LoadFile(const std::string & path, XmlNode & node, int options = PARSE_DEFAULT);
+bool MatchFile(const std::string & path, XmlStreamMatcher & matcher);
+
+/*
+  XmlGzipSink compresses what it is given, in gzip format, into
+  another sink. Finish ends the gzip stream; the destructor does it
+  if it was not called. Flush pushes out what is compressed so far,
+  frequent flushes cost some compression.
+
+  FILE * file = fopen("feed.xml.gz", "wb");
+  XmlFileSink file_sink(file);
+  XmlGzipSink sink(file_sink);
+  XmlWriter writer(sink);
+  ...
+  writer.Finish();
+  sink.Finish();
+  fclose(file);
+
+  level is the zlib level, 1 (fast) to 9 (small).
+*/
+class XmlGzipSink : public XmlSink {
+ public:
+  explicit XmlGzipSink(XmlSink & out, int level = 6, size_t buffer_size = 64 * 1024);
+  ~XmlGzipSink();
+
+  bool Write(const char * data, size_t size);
+  bool Flush();
+  bool Finish();
+
+ private:
+  // Not copyable
+  XmlGzipSink(const XmlGzipSink &);
+  XmlGzipSink & operator=(const XmlGzipSink &);
+
+  bool deflateInput(int flush);
+
+  XmlSink & out_;
+  z_stream_s * stream_;
+  std::vector<char> buffer_;
+  bool finished_;
+  bool good_;
+};
+
+}
+
+#endif
@@ -0,0 +1,252 @@
+#include "XmlInSitu.h"
+
+#include <cstring>
+
+namespace SmallXml {
+
+namespace {
+
+const size_t kBlockSize = 256;
+
+// Terminator of empty strings, never written
+const char kEmpty[] = "";
+
+}
+
+/////////////////////////////////////////////
+// Node
+
+const XmlInSituDocument::Node * XmlInSituDocument::Node::NextElement(const char * tag) const {
+  for (const Node * scan = next_; NULL != scan; scan = scan->next_) {
+    if (XmlNode::ELEMENT == scan->type_ && 0 == strcmp(scan->tag_, tag))
+      return scan;
+  }
+
+  return NULL;
+}
+
+const char * XmlInSituDocument::Node::GetAttribute(const char * name) const {
+  for (const Attribute * scan = first_attribute_; NULL != scan; scan = scan->next_) {
+    if (0 == strcmp(scan->name_, name))
+      return scan->value_;
+  }
+
+  return NULL;
+}
+
+/////////////////////////////////////////////
+// XmlInSituDocument
+
+XmlInSituDocument::XmlInSituDocument(int options)
+  : tokenizer_(options),
+    options_(options),
+    buffer_(NULL),
+    num_of_nodes_(0),
+    num_of_attributes_(0) {
+  Clear();
+}
+
+XmlInSituDocument::~XmlInSituDocument() {
+  for (size_t index = 0; index < node_blocks_.size(); ++index)
+    delete [] node_blocks_[index];
+  for (size_t index = 0; index < attribute_blocks_.size(); ++index)
+    delete [] attribute_blocks_[index];
+}
+
+/*
+  The same walk as XmlParser::build for a document. A string is
+  terminated right away when the character behind it belongs to the
+  token just read. A text runs up to the '<' of the next token, its
+  terminator waits until that token is read.
+*/
+bool XmlInSituDocument::ReadInSitu(char * buffer, size_t size) {
+  Clear();
+  buffer_ = buffer;
+  tokenizer_.Reset(buffer, size);
+
+  bool trim = (0 == (options_ & PARSE_PRESERVE_WHITESPACE));
+  char * pending = NULL;
+  XmlToken token;
+
+  stack_.clear();
+  stack_.push_back(&root_);
+  while (tokenizer_.Next(token)) {
+    if (NULL != pending) {
+      *pending = '\0';
+      pending = NULL;
+    }
+
+    Node * top = stack_.back();
+    if (XmlNode::CLOSE_TAG == token.flag) {
+      // The document itself has no close tag
+      if (&root_ == top)
+        return false;
+
+      char * begin = buffer + (token.name - buffer);
+      char * end = begin + token.name_size;
+      XmlNode::trimRange(begin, end);
+      size_t name_size = XmlNode::XmlSpecialCharDecodeInPlace(begin, end - begin);
+      if (name_size != top->tag_size_ || 0 != memcmp(begin, top->tag_, name_size))
+        return false;
+
+      stack_.pop_back();
+      continue;
+    }
+
+    Node * node = newNode(token.type, top);
+    switch (token.type) {
+      case XmlNode::TEXT: {
+        char * text = decodeText(token, node->text_size_, trim);
+        node->text_ = text;
+        if (text + node->text_size_ == buffer + token.end)
+          pending = text + node->text_size_;
+        else
+          text[node->text_size_] = '\0';
+        break;
+      }
+      case XmlNode::COMMENT: {
+        char * text = decodeText(token, node->text_size_, true);
+        node->text_ = text;
+        text[node->text_size_] = '\0';
+        break;
+      }
+      case XmlNode::DECLARATION:
+        fillAttributes(node, token);
+        break;
+      case XmlNode::ELEMENT: {
+        // Attributes start right behind the tag, read them first
+        fillAttributes(node, token);
+        char * tag = buffer + (token.name - buffer);
+        node->tag_size_ = XmlNode::XmlSpecialCharDecodeInPlace(tag, token.name_size);
+        tag[node->tag_size_] = '\0';
+        node->tag_ = tag;
+
+        if (XmlNode::OPEN_TAG == token.flag)
+          stack_.push_back(node);
+        break;
+      }
+      default:
+        break;
+    }
+  }
+
+  // A trailing text ends at buffer[size]
+  if (NULL != pending)
+    *pending = '\0';
+
+  return !tokenizer_.Failed() && 1 == stack_.size();
+}
+
+const XmlInSituDocument::Node * XmlInSituDocument::Root() const {
+  return &root_;
+}
+
+size_t XmlInSituDocument::NumOfNodes() const {
+  return num_of_nodes_;
+}
+
+void XmlInSituDocument::Clear() {
+  num_of_nodes_ = 0;
+  num_of_attributes_ = 0;
+  buffer_ = NULL;
+
+  memset(&root_, 0, sizeof(root_));
+  root_.type_ = XmlNode::DOCUMENT;
+  root_.tag_ = kEmpty;
+  root_.text_ = kEmpty;
+}
+
+/////////////////////////////////////////////
+// Private member functions
+
+XmlInSituDocument::Node * XmlInSituDocument::newNode(XmlNode::NodeType type, Node * parent) {
+  size_t block = num_of_nodes_ / kBlockSize;
+  if (block == node_blocks_.size())
+    node_blocks_.push_back(new Node[kBlockSize]);
+
+  Node * node = node_blocks_[block] + num_of_nodes_ % kBlockSize;
+  ++num_of_nodes_;
+
+  memset(node, 0, sizeof(*node));
+  node->type_ = type;
+  node->tag_ = kEmpty;
+  node->text_ = kEmpty;
+
+  node->parent_ = parent;
+  node->prev_ = parent->last_child_;
+  if (NULL != parent->last_child_)
+    parent->last_child_->next_ = node;
+  else
+    parent->first_child_ = node;
+  parent->last_child_ = node;
+
+  return node;
+}
+
+XmlInSituDocument::Attribute * XmlInSituDocument::newAttribute(Node * node) {
+  size_t block = num_of_attributes_ / kBlockSize;
+  if (block == attribute_blocks_.size())
+    attribute_blocks_.push_back(new Attribute[kBlockSize]);
+
+  Attribute * attribute = attribute_blocks_[block] + num_of_attributes_ % kBlockSize;
+  ++num_of_attributes_;
+
+  memset(attribute, 0, sizeof(*attribute));
+  if (NULL != node->last_attribute_)
+    node->last_attribute_->next_ = attribute;
+  else
+    node->first_attribute_ = attribute;
+  node->last_attribute_ = attribute;
+
+  return attribute;
+}
+
+/*
+  Each pair is decoded and terminated as soon as it is read. Only the
+  terminator of an unquoted value may sit where the scan goes on, it
+  waits for the next pair.
+*/
+void XmlInSituDocument::fillAttributes(Node * node, const XmlToken & token) {
+  const char * pos = token.value;
+  const char * end = token.value + token.value_size;
+  const char * name = NULL;
+  const char * value = NULL;
+  size_t name_size = 0;
+  size_t value_size = 0;
+  char * pending = NULL;
+
+  while (XmlTokenizer::NextAttribute(pos, end, name, name_size, value, value_size)) {
+    if (NULL != pending)
+      *pending = '\0';
+
+    Attribute * attribute = newAttribute(node);
+
+    char * mutable_name = buffer_ + (name - buffer_);
+    attribute->name_size_ = XmlNode::XmlSpecialCharDecodeInPlace(mutable_name, name_size);
+    mutable_name[attribute->name_size_] = '\0';
+    attribute->name_ = mutable_name;
+
+    char * mutable_value = buffer_ + (value - buffer_);
+    attribute->value_size_ = XmlNode::XmlSpecialCharDecodeInPlace(mutable_value, value_size);
+    attribute->value_ = mutable_value;
+    pending = mutable_value + attribute->value_size_;
+  }
+
+  if (NULL != pending)
+    *pending = '\0';
+}
+
+/*
+  Trim and decode the value of token, return where it starts now
+*/
+char * XmlInSituDocument::decodeText(const XmlToken & token, size_t & size, bool trim) {
+  char * begin = buffer_ + (token.value - buffer_);
+  char * end = begin + token.value_size;
+  if (trim)
+    XmlNode::trimRange(begin, end);
+
+  size = XmlNode::XmlSpecialCharDecodeInPlace(begin, end - begin);
+  return begin;
+}
+
+}
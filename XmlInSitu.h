@@ -0,0 +1,162 @@
+/*
+SmallXml - Tiny and Simple Xml DOM
+
+www.github.com/theliuy/SmallXml.git
+Author: Yang Liu
+        theliuy.com
+*/
+
+#ifndef SMALLXML_XMLINSITU_H
+#define SMALLXML_XMLINSITU_H
+
+#include <vector>
+#include <cstddef>
+
+#include "SmallXml.h"
+#include "XmlParser.h"
+
+namespace SmallXml {
+
+/*
+  A read only DOM parsed in place, from a buffer the caller owns and
+  gives away, like a network receive buffer.
+
+  ReadInSitu decodes entities and terminates tags, texts, attribute
+  names and values inside the buffer itself. The nodes point into the
+  buffer, no string is copied or allocated. Nodes and attributes live
+  in blocks that the document keeps for the next read, so after the
+  first few documents a read does not allocate at all.
+
+  XmlInSituDocument doc;
+  if (doc.ReadInSitu(buffer, received)) {
+    const XmlInSituDocument::Node * item = doc.Root()->FirstChild();
+    for (; NULL != item; item = item->NextElement("item"))
+      handle(item->GetAttribute("id"), item->FirstChild()->text());
+  }
+
+  Buffer contract:
+    - buffer holds size bytes of xml, and buffer[size] must be writable
+      too, it may receive the terminator of a trailing text.
+    - The buffer is changed: after ReadInSitu it is no longer the xml it
+      was. Keep a copy if the original is needed.
+    - Every pointer from the document points into the buffer. The
+      buffer must stay alive and unchanged as long as nodes are used,
+      and the nodes are invalid after the next ReadInSitu or Clear.
+
+  NOTE:
+    Strings are decoded, the way GetDecodedTag and GetDecodedText
+    return them, and texts and comments are trimmed the same way Read
+    trims them. Every string is NUL terminated, and its size is known
+    as well.
+    Parse options work as for XmlParser, except PARSE_COALESCE_TEXT and
+    PARSE_LAZY which are ignored. A declaration only has the attributes
+    written in the buffer, there are no defaults.
+*/
+class XmlInSituDocument {
+ public:
+  class Attribute {
+   public:
+    const char * name() const { return name_; }
+    size_t name_size() const { return name_size_; }
+    const char * value() const { return value_; }
+    size_t value_size() const { return value_size_; }
+    const Attribute * Next() const { return next_; }
+
+   private:
+    friend class XmlInSituDocument;
+
+    const char * name_;
+    size_t name_size_;
+    const char * value_;
+    size_t value_size_;
+    Attribute * next_;
+  };
+
+  class Node {
+   public:
+    XmlNode::NodeType type() const { return type_; }
+
+    // Tag of an element, "" for other nodes
+    const char * tag() const { return tag_; }
+    size_t tag_size() const { return tag_size_; }
+    // Text of a text or a comment, "" for other nodes
+    const char * text() const { return text_; }
+    size_t text_size() const { return text_size_; }
+
+    const Node * Parent() const { return parent_; }
+    const Node * FirstChild() const { return first_child_; }
+    const Node * LastChild() const { return last_child_; }
+    const Node * PreviousSibling() const { return prev_; }
+    const Node * NextSibling() const { return next_; }
+    const Node * NextElement(const char * tag) const;
+
+    /*
+      Attributes in document order. GetAttribute returns NULL when
+      there is no such attribute.
+    */
+    const Attribute * FirstAttribute() const { return first_attribute_; }
+    const char * GetAttribute(const char * name) const;
+
+   private:
+    friend class XmlInSituDocument;
+
+    XmlNode::NodeType type_;
+    const char * tag_;
+    size_t tag_size_;
+    const char * text_;
+    size_t text_size_;
+
+    Attribute * first_attribute_;
+    Attribute * last_attribute_;
+
+    Node * parent_;
+    Node * prev_;
+    Node * next_;
+    Node * first_child_;
+    Node * last_child_;
+  };
+
+  explicit XmlInSituDocument(int options = PARSE_DEFAULT);
+  ~XmlInSituDocument();
+
+  /*
+    ReadInSitu - Parse buffer in place, see the buffer contract above.
+                 Returns false on malformed xml, the nodes built so far
+                 are kept.
+  */
+  bool ReadInSitu(char * buffer, size_t size);
+
+  // The document node, its children are the top level nodes
+  const Node * Root() const;
+  size_t NumOfNodes() const;
+
+  // Forget the nodes, their blocks are kept
+  void Clear();
+
+ private:
+  // Not copyable
+  XmlInSituDocument(const XmlInSituDocument &);
+  XmlInSituDocument & operator=(const XmlInSituDocument &);
+
+  Node * newNode(XmlNode::NodeType type, Node * parent);
+  Attribute * newAttribute(Node * node);
+  void fillAttributes(Node * node, const XmlToken & token);
+  char * decodeText(const XmlToken & token, size_t & size, bool trim);
+
+  XmlTokenizer tokenizer_;
+  int options_;
+  char * buffer_;
+
+  Node root_;
+  std::vector<Node *> stack_;
+
+  // Blocks of kBlockSize nodes and attributes, and how many are used
+  std::vector<Node *> node_blocks_;
+  size_t num_of_nodes_;
+  std::vector<Attribute *> attribute_blocks_;
+  size_t num_of_attributes_;
+};
+
+}
+
+#endif
@@ -0,0 +1,264 @@
+#include "XmlIndex.h"
+#include "XmlEncoding.h"
+
+#include <cstring>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace SmallXml {
+
+namespace {
+
+const size_t kBlockSize = 64;
+
+bool startsWith(const char * pos, const char * end, const char * prefix, size_t size) {
+  return static_cast<size_t>(end - pos) >= size && 0 == memcmp(pos, prefix, size);
+}
+
+/*
+  Find needle in [pos, end), return end if it is not there.
+*/
+const char * findStr(const char * pos, const char * end, const char * needle, size_t size) {
+  while (static_cast<size_t>(end - pos) >= size) {
+    const char * first = static_cast<const char *>(memchr(pos, needle[0], end - pos - size + 1));
+    if (NULL == first)
+      return end;
+    if (0 == memcmp(first, needle, size))
+      return first;
+    pos = first + 1;
+  }
+
+  return end;
+}
+
+bool isCandidate(const char c) {
+  return '<' == c || '>' == c || '\"' == c || '\'' == c;
+}
+
+#if defined(__SSE2__)
+uint64_t candidates16(const char * data) {
+  __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+  __m128i tags = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('<')),
+                              _mm_cmpeq_epi8(chunk, _mm_set1_epi8('>')));
+  __m128i quotes = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\"')),
+                                _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\'')));
+  return static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(tags, quotes)));
+}
+#endif
+
+/*
+  Bit i is set when data[i] may be structural. Blocks shorter than
+  kBlockSize, at the end of the content, are classified one by one.
+*/
+uint64_t candidates(const char * data, size_t size) {
+#if defined(__SSE2__)
+  if (kBlockSize <= size) {
+    return candidates16(data) |
+           (candidates16(data + 16) << 16) |
+           (candidates16(data + 32) << 32) |
+           (candidates16(data + 48) << 48);
+  }
+#endif
+
+  uint64_t mask = 0;
+  size_t count = std::min(size, kBlockSize);
+  for (size_t index = 0; index < count; ++index) {
+    if (isCandidate(data[index]))
+      mask |= static_cast<uint64_t>(1) << index;
+  }
+
+  return mask;
+}
+
+int lowestBit(uint64_t mask) {
+#if defined(__GNUC__)
+  return __builtin_ctzll(mask);
+#else
+  int bit = 0;
+  while (0 == (mask & 1)) {
+    mask >>= 1;
+    ++bit;
+  }
+  return bit;
+#endif
+}
+
+/*
+  End of markup which is not a tag, the same way XmlTokenizer finds
+  it. Returns the offset of its final '>', or end when it is not
+  terminated.
+*/
+const char * markupEnd(const char * lt, const char * end) {
+  const char * close = end;
+
+  if (startsWith(lt, end, "<!--", 4)) {
+    close = findStr(lt + 4, end, "-->", 3);
+    return (close == end) ? end : close + 2;
+  }
+  if (startsWith(lt, end, "<![CDATA[", 9)) {
+    close = findStr(lt + 9, end, "]]>", 3);
+    return (close == end) ? end : close + 2;
+  }
+  if (startsWith(lt, end, "<?", 2)) {
+    close = findStr(lt + 2, end, "?>", 2);
+    return (close == end) ? end : close + 1;
+  }
+
+  // <!DOCTYPE ...> with its internal subset
+  int brackets = 0;
+  char quote = 0;
+  for (const char * scan = lt + 2; scan != end; ++scan) {
+    if (0 != quote) {
+      if (quote == *scan)
+        quote = 0;
+    } else if ('\"' == *scan || '\'' == *scan) {
+      quote = *scan;
+    } else if ('[' == *scan) {
+      ++brackets;
+    } else if (']' == *scan) {
+      --brackets;
+    } else if ('>' == *scan && 0 >= brackets) {
+      return scan;
+    }
+  }
+
+  return end;
+}
+
+}
+
+XmlStructuralIndex::XmlStructuralIndex()
+  : size_(0) {
+}
+
+/*
+  Candidates are walked with a small state machine. Markup whose end
+  is not a plain '>' (comments, CDATA, processing instructions and
+  DOCTYPEs) is searched for its end directly, and classification goes
+  on behind it.
+*/
+bool XmlStructuralIndex::Build(const char * data, size_t size, XmlUtf8Validator * validator) {
+  enum State {
+    IN_TEXT,
+    IN_TAG,
+    IN_QUOTE,
+    IN_CLOSE_TAG
+  };
+
+  Clear();
+  if (size >= 0xFFFFFFFFu)
+    return false;
+  size_ = size;
+
+  const char * end = data + size;
+  State state = IN_TEXT;
+  char quote = 0;
+  size_t lt = 0;
+
+  size_t block = 0;
+  while (block < size) {
+    uint64_t mask = candidates(data + block, size - block);
+    size_t next_block = block + kBlockSize;
+
+    while (0 != mask) {
+      size_t pos = block + lowestBit(mask);
+      mask &= mask - 1;
+      char c = data[pos];
+
+      switch (state) {
+        case IN_TEXT:
+          if ('<' != c)
+            break;
+          if (pos + 1 < size && ('!' == data[pos + 1] || '?' == data[pos + 1])) {
+            const char * gt = markupEnd(data + pos, end);
+            if (gt == end) {
+              Clear();
+              return false;
+            }
+            marks_.push_back(static_cast<uint32_t>(pos));
+            marks_.push_back(static_cast<uint32_t>(gt - data));
+            // Go on right behind it
+            next_block = gt + 1 - data;
+            mask = 0;
+          } else {
+            lt = pos;
+            state = (pos + 1 < size && '/' == data[pos + 1]) ? IN_CLOSE_TAG : IN_TAG;
+          }
+          break;
+        case IN_TAG:
+          if ('\"' == c || '\'' == c) {
+            quote = c;
+            state = IN_QUOTE;
+          } else if ('>' == c) {
+            marks_.push_back(static_cast<uint32_t>(lt));
+            marks_.push_back(static_cast<uint32_t>(pos));
+            state = IN_TEXT;
+          }
+          break;
+        case IN_QUOTE:
+          if (quote == c)
+            state = IN_TAG;
+          break;
+        case IN_CLOSE_TAG:
+          if ('>' == c) {
+            marks_.push_back(static_cast<uint32_t>(lt));
+            marks_.push_back(static_cast<uint32_t>(pos));
+            state = IN_TEXT;
+          }
+          break;
+      }
+    }
+
+    // Including what a jump over a comment or CDATA section skipped
+    if (NULL != validator)
+      validator->Feed(data + block, std::min(next_block, size) - block);
+    block = next_block;
+  }
+
+  if (IN_TEXT != state) {
+    Clear();
+    return false;
+  }
+
+  return true;
+}
+
+void XmlStructuralIndex::Clear() {
+  marks_.clear();
+  size_ = 0;
+}
+
+bool XmlStructuralIndex::Empty() const {
+  return marks_.empty();
+}
+
+const std::vector<uint32_t> & XmlStructuralIndex::marks() const {
+  return marks_;
+}
+
+/*
+  Binary search over the '<' offsets, the even entries
+*/
+size_t XmlStructuralIndex::Lower(size_t offset) const {
+  size_t low = 0;
+  size_t high = marks_.size() / 2;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (marks_[2 * middle] < offset)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  return 2 * low;
+}
+
+size_t XmlStructuralIndex::SplitPoint(size_t offset) const {
+  size_t mark = Lower(offset);
+  return (mark < marks_.size()) ? marks_[mark] : size_;
+}
+
+}
@@ -0,0 +1,91 @@
+/*
+SmallXml - Tiny and Simple Xml DOM
+
+www.github.com/theliuy/SmallXml.git
+Author: Yang Liu
+        theliuy.com
+*/
+
+#ifndef SMALLXML_XMLINDEX_H
+#define SMALLXML_XMLINDEX_H
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+namespace SmallXml {
+
+class XmlUtf8Validator;
+
+/*
+  Structural index of xml content, the first stage of a two stage
+  parse.
+
+  Build finds every piece of markup: tags, close tags, comments,
+  CDATA sections, declarations and DOCTYPEs, and stores the offset of
+  its '<' and of its final '>'. Characters are classified 64 at a
+  time with SSE2 where available, only the '<', '>' and quote
+  characters found that way are looked at one by one. Quotes inside
+  tags and the bodies of comments and CDATA sections are handled, so
+  a '>' in an attribute value or a '<' in a comment is not markup.
+
+  The second stage, XmlTokenizer given the index, jumps from markup
+  to markup instead of scanning characters. Skipping a subtree walks
+  the index only, which is what the index is for: projections and
+  lazy reads which skip large subtrees, and SplitPoint. Building the
+  index costs more than the walk saves, so tokenizing all of the
+  content is slower with it than scanning.
+
+  XmlStructuralIndex index;
+  if (index.Build(data, size)) {
+    XmlTokenizer tokenizer;
+    tokenizer.Reset(data, size, 0, &index);
+    ...
+  }
+
+  XmlParser does it with PARSE_STRUCTURAL_INDEX.
+
+  NOTE:
+    Offsets are 32 bits, content of 4GB or more is not indexed.
+    An index is only valid for the content it was built from.
+*/
+class XmlStructuralIndex {
+ public:
+  XmlStructuralIndex();
+
+  /*
+    Build - Index [data, data + size). Returns false, and leaves the
+            index empty, if some markup is not terminated.
+            Each block is fed to validator too, if one is given,
+            while it is at hand. Only a successful Build feeds it
+            all the content.
+  */
+  bool Build(const char * data, size_t size, XmlUtf8Validator * validator = NULL);
+  void Clear();
+  bool Empty() const;
+
+  /*
+    Offsets of markup, in pairs: marks()[2 * i] is the '<' starting
+    the i-th markup, marks()[2 * i + 1] the '>' ending it.
+  */
+  const std::vector<uint32_t> & marks() const;
+
+  // Position in marks() of the first markup starting at or after offset
+  size_t Lower(size_t offset) const;
+
+  /*
+    SplitPoint - Start of the first markup at or after offset, or the
+                 size of the content. Content cut there is never cut
+                 inside a tag, a comment or a CDATA section, so pieces
+                 may be tokenized independently.
+  */
+  size_t SplitPoint(size_t offset) const;
+
+ private:
+  std::vector<uint32_t> marks_;
+  size_t size_;
+};
+
+}
+
+#endif
@@ -0,0 +1,612 @@
+#include "XmlLoader.h"
+
+#include <cstring>
+#include <climits>
+#include <cerrno>
+#include <cstdint>
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <zlib.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define SMALLXML_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+namespace SmallXml {
+
+namespace {
+
+// Reads in flight at once
+const unsigned kQueueDepth = 64;
+
+// Threads reading with pread, when there is no io_uring
+const size_t kReadThreads = 16;
+
+struct LoadedFile {
+  size_t index;
+  std::string content;
+  bool ok;
+};
+
+/*
+  Files which are read wait here for the workers. The queue is
+  bounded, so reading does not run far ahead of parsing.
+*/
+class ParseQueue {
+ public:
+  explicit ParseQueue(size_t limit) : limit_(limit), closed_(false) {}
+
+  void Push(LoadedFile & file) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [this] { return files_.size() < limit_; });
+    files_.push_back(std::move(file));
+    not_empty_.notify_one();
+  }
+
+  // Returns false once the queue is closed and empty
+  bool Pop(LoadedFile & file) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this] { return closed_ || !files_.empty(); });
+    if (files_.empty())
+      return false;
+
+    file = std::move(files_.front());
+    files_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+  }
+
+ private:
+  size_t limit_;
+  bool closed_;
+  std::deque<LoadedFile> files_;
+  std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+};
+
+/*
+  Open a regular file for reading and get its size, -1 if it can't
+*/
+int openFile(const std::string & path, size_t & size) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (0 > fd)
+    return -1;
+
+  struct stat info;
+  if (0 != fstat(fd, &info) || !S_ISREG(info.st_mode)) {
+    close(fd);
+    return -1;
+  }
+
+  size = static_cast<size_t>(info.st_size);
+  return fd;
+}
+
+/*
+  Read content from done on, up to its size or the end of the file.
+  A file which shrinks while it is read ends where it ends.
+*/
+bool readRest(int fd, std::string & content, size_t & done) {
+  while (done < content.size()) {
+    ssize_t result = pread(fd, &content[done], content.size() - done, done);
+    if (0 > result && EINTR == errno)
+      continue;
+    if (0 > result)
+      return false;
+    if (0 == result)
+      break;
+    done += static_cast<size_t>(result);
+  }
+
+  return true;
+}
+
+bool readFile(const std::string & path, std::string & content) {
+  size_t size = 0;
+  int fd = openFile(path, size);
+  if (0 > fd)
+    return false;
+
+  content.resize(size);
+  size_t done = 0;
+  bool ok = readRest(fd, content, done);
+  content.resize(done);
+  close(fd);
+  return ok;
+}
+
+bool isGzip(const std::string & content) {
+  return 2 <= content.size() && '\x1f' == content[0] && '\x8b' == content[1];
+}
+
+/*
+  Inflate a whole gzip file, all of its members. The output starts at
+  the size the trailer tells.
+*/
+bool inflateContent(const std::string & in, std::string & out) {
+  if (in.size() < 18 || in.size() > UINT_MAX)
+    return false;
+
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (Z_OK != inflateInit2(&stream, 16 + MAX_WBITS))
+    return false;
+
+  const unsigned char * tail = reinterpret_cast<const unsigned char *>(in.data() + in.size() - 4);
+  size_t hint = static_cast<size_t>(tail[0]) | (static_cast<size_t>(tail[1]) << 8) |
+                (static_cast<size_t>(tail[2]) << 16) | (static_cast<size_t>(tail[3]) << 24);
+  out.resize(hint < 64 ? 64 : hint);
+
+  stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+  stream.avail_in = static_cast<uInt>(in.size());
+  size_t produced = 0;
+  bool ok = true;
+  for (;;) {
+    if (produced == out.size())
+      out.resize(out.size() * 2);
+    size_t room = out.size() - produced;
+    if (room > UINT_MAX)
+      room = UINT_MAX;
+    stream.next_out = reinterpret_cast<Bytef *>(&out[produced]);
+    stream.avail_out = static_cast<uInt>(room);
+
+    int result = inflate(&stream, Z_NO_FLUSH);
+    produced += room - stream.avail_out;
+    if (Z_STREAM_END == result) {
+      if (0 == stream.avail_in)
+        break;
+      if (Z_OK != inflateReset(&stream)) {
+        ok = false;
+        break;
+      }
+    } else if (Z_OK != result && !(Z_BUF_ERROR == result && 0 == stream.avail_out)) {
+      ok = false;
+      break;
+    }
+  }
+
+  inflateEnd(&stream);
+  out.resize(produced);
+  return ok;
+}
+
+/*
+  A worker takes read files until the queue is closed. Its parser
+  keeps its scratch buffers from one file to the next.
+*/
+void parseFiles(ParseQueue & queue, int options, std::mutex & callback_mutex,
+                XmlLoadCallback & callback, std::atomic<size_t> & loaded) {
+  XmlParser parser(options);
+  std::string inflated;
+  LoadedFile file;
+
+  while (queue.Pop(file)) {
+    XmlNode * document = NULL;
+    const std::string * content = file.ok ? &file.content : NULL;
+    if (NULL != content && isGzip(file.content))
+      content = inflateContent(file.content, inflated) ? &inflated : NULL;
+
+    if (NULL != content) {
+      document = new XmlNode(XmlNode::DOCUMENT);
+      if (!parser.Read(*content, *document)) {
+        delete document;
+        document = NULL;
+      } else {
+        ++loaded;
+      }
+    }
+
+    file.content.clear();
+    file.content.shrink_to_fit();
+    std::lock_guard<std::mutex> lock(callback_mutex);
+    callback(file.index, document);
+  }
+}
+
+/*
+  Read paths from first on
+*/
+void readWithThreads(const std::vector<std::string> & paths, size_t first, ParseQueue & queue) {
+  std::atomic<size_t> next(first);
+  std::vector<std::thread> readers;
+  size_t left = (first < paths.size()) ? paths.size() - first : 0;
+  size_t num_readers = (left < kReadThreads) ? left : kReadThreads;
+
+  for (size_t reader = 0; reader < num_readers; ++reader) {
+    readers.push_back(std::thread([&paths, &queue, &next] {
+      for (size_t index = next++; index < paths.size(); index = next++) {
+        LoadedFile file;
+        file.index = index;
+        file.ok = readFile(paths[index], file.content);
+        queue.Push(file);
+      }
+    }));
+  }
+
+  for (size_t reader = 0; reader < readers.size(); ++reader)
+    readers[reader].join();
+}
+
+#ifdef SMALLXML_IO_URING
+
+/*
+  Just enough io_uring, straight on the system calls: a submission
+  ring of readv requests, and the completion ring.
+*/
+class Ring {
+ public:
+  Ring()
+    : fd_(-1),
+      sq_ptr_(MAP_FAILED), sq_size_(0),
+      cq_ptr_(MAP_FAILED), cq_size_(0),
+      sqes_(static_cast<io_uring_sqe *>(MAP_FAILED)), sqes_size_(0),
+      to_submit_(0) {}
+
+  ~Ring() {
+    if (MAP_FAILED != static_cast<void *>(sqes_))
+      munmap(sqes_, sqes_size_);
+    if (MAP_FAILED != cq_ptr_ && cq_ptr_ != sq_ptr_)
+      munmap(cq_ptr_, cq_size_);
+    if (MAP_FAILED != sq_ptr_)
+      munmap(sq_ptr_, sq_size_);
+    if (0 <= fd_)
+      close(fd_);
+  }
+
+  bool Setup(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (0 > fd_)
+      return false;
+
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = (0 != (params.features & IORING_FEAT_SINGLE_MMAP));
+    if (single_mmap && cq_size_ > sq_size_)
+      sq_size_ = cq_size_;
+
+    sq_ptr_ = mmap(NULL, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   fd_, IORING_OFF_SQ_RING);
+    if (MAP_FAILED == sq_ptr_)
+      return false;
+    cq_ptr_ = single_mmap ? sq_ptr_ :
+              mmap(NULL, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   fd_, IORING_OFF_CQ_RING);
+    if (MAP_FAILED == cq_ptr_)
+      return false;
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe *>(mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+    if (MAP_FAILED == static_cast<void *>(sqes_))
+      return false;
+
+    char * sq = static_cast<char *>(sq_ptr_);
+    sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+    char * cq = static_cast<char *>(cq_ptr_);
+    cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    return true;
+  }
+
+  /*
+    Queue a read into iov at offset of fd. iov has to stay until the
+    read completes.
+  */
+  bool PushRead(int fd, const struct iovec * iov, size_t offset, uint64_t user_data) {
+    unsigned tail = *sq_tail_;
+    if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_)
+      return false;
+
+    unsigned index = tail & *sq_mask_;
+    io_uring_sqe & sqe = sqes_[index];
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_READV;
+    sqe.fd = fd;
+    sqe.off = offset;
+    sqe.addr = reinterpret_cast<uint64_t>(iov);
+    sqe.len = 1;
+    sqe.user_data = user_data;
+    sq_array_[index] = index;
+
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    ++to_submit_;
+    return true;
+  }
+
+  // Submit what is queued, and wait for one completion at least
+  bool SubmitAndWait() {
+    for (;;) {
+      long result = syscall(__NR_io_uring_enter, fd_, to_submit_, 1,
+                            IORING_ENTER_GETEVENTS, NULL, 0);
+      if (0 <= result) {
+        to_submit_ -= static_cast<unsigned>(result);
+        return true;
+      }
+      if (EINTR != errno && EAGAIN != errno && EBUSY != errno)
+        return false;
+    }
+  }
+
+  // Wait for one completion at least, without submitting
+  bool Wait() {
+    for (;;) {
+      long result = syscall(__NR_io_uring_enter, fd_, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+      if (0 <= result)
+        return true;
+      if (EINTR != errno && EAGAIN != errno && EBUSY != errno)
+        return false;
+    }
+  }
+
+  /*
+    Take back the requests the kernel has not taken, after a failed
+    submit, and give their user_data. Without SQPOLL the kernel only
+    takes requests inside io_uring_enter.
+  */
+  void Unsubmit(std::vector<uint64_t> & user_data) {
+    unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    unsigned tail = *sq_tail_;
+    for (unsigned scan = head; scan != tail; ++scan)
+      user_data.push_back(sqes_[sq_array_[scan & *sq_mask_]].user_data);
+
+    __atomic_store_n(sq_tail_, head, __ATOMIC_RELEASE);
+    to_submit_ = 0;
+  }
+
+  // The next completion, false if there is none yet
+  bool PopCompletion(uint64_t & user_data, int & result) {
+    unsigned head = *cq_head_;
+    if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+      return false;
+
+    const io_uring_cqe & cqe = cqes_[head & *cq_mask_];
+    user_data = cqe.user_data;
+    result = cqe.res;
+    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+ private:
+  int fd_;
+  void * sq_ptr_;
+  size_t sq_size_;
+  void * cq_ptr_;
+  size_t cq_size_;
+  io_uring_sqe * sqes_;
+  size_t sqes_size_;
+
+  unsigned * sq_head_;
+  unsigned * sq_tail_;
+  unsigned * sq_mask_;
+  unsigned sq_entries_;
+  unsigned * sq_array_;
+  unsigned * cq_head_;
+  unsigned * cq_tail_;
+  unsigned * cq_mask_;
+  io_uring_cqe * cqes_;
+
+  unsigned to_submit_;
+};
+
+// A read in flight
+struct Slot {
+  LoadedFile file;
+  int fd;
+  size_t size;
+  size_t done;
+  struct iovec iov;
+};
+
+bool pushRead(Ring & ring, Slot & slot, size_t slot_index) {
+  slot.iov.iov_base = &slot.file.content[slot.done];
+  slot.iov.iov_len = slot.size - slot.done;
+  return ring.PushRead(slot.fd, &slot.iov, slot.done, slot_index);
+}
+
+void finishRead(Slot & slot, bool ok, ParseQueue & queue) {
+  slot.file.ok = ok;
+  slot.file.content.resize(slot.done);
+  close(slot.fd);
+  queue.Push(slot.file);
+}
+
+/*
+  After a failed submit, nothing more goes to the ring. Requests it
+  never took are read with pread. The buffers of those it took are
+  only let go when they have completed, the rest of those files is
+  read with pread too. If even waiting fails, the kernel may still
+  write into the buffers: they are never freed then, and their files
+  fail.
+*/
+void drainRing(Ring & ring, std::vector<Slot> & slots, std::vector<bool> & busy,
+               size_t in_flight, ParseQueue & queue) {
+  std::vector<uint64_t> unsubmitted;
+  ring.Unsubmit(unsubmitted);
+  for (size_t index = 0; index < unsubmitted.size(); ++index) {
+    Slot & slot = slots[unsubmitted[index]];
+    finishRead(slot, readRest(slot.fd, slot.file.content, slot.done), queue);
+    busy[unsubmitted[index]] = false;
+    --in_flight;
+  }
+
+  while (0 != in_flight) {
+    if (!ring.Wait()) {
+      for (size_t index = 0; index < slots.size(); ++index) {
+        if (!busy[index])
+          continue;
+        LoadedFile file;
+        file.index = slots[index].file.index;
+        file.ok = false;
+        queue.Push(file);
+      }
+      // Left to the kernel on purpose
+      new std::vector<Slot>(std::move(slots));
+      return;
+    }
+
+    uint64_t slot_index = 0;
+    int result = 0;
+    while (ring.PopCompletion(slot_index, result)) {
+      Slot & slot = slots[slot_index];
+      if (0 < result)
+        slot.done += static_cast<size_t>(result);
+      finishRead(slot, 0 <= result && readRest(slot.fd, slot.file.content, slot.done), queue);
+      busy[slot_index] = false;
+      --in_flight;
+    }
+  }
+}
+
+/*
+  Files are opened in turn, their reads go to the ring until
+  kQueueDepth are in flight, then whatever completes is handed to the
+  workers and makes room for the next ones. A short read is continued
+  where it stopped. Returns false, before reading anything, if there
+  is no io_uring.
+*/
+bool readWithRing(const std::vector<std::string> & paths, ParseQueue & queue) {
+  Ring ring;
+  if (!ring.Setup(kQueueDepth))
+    return false;
+
+  std::vector<Slot> slots(kQueueDepth);
+  std::vector<bool> busy(kQueueDepth, false);
+  std::vector<size_t> free_slots;
+  for (size_t index = kQueueDepth; index > 0; --index)
+    free_slots.push_back(index - 1);
+
+  size_t next = 0;
+  size_t in_flight = 0;
+  while (next < paths.size() || 0 != in_flight) {
+    while (!free_slots.empty() && next < paths.size()) {
+      LoadedFile file;
+      file.index = next;
+      file.ok = false;
+      size_t size = 0;
+      int fd = openFile(paths[next++], size);
+      if (0 > fd || 0 == size) {
+        if (0 <= fd)
+          close(fd);
+        file.ok = (0 <= fd);
+        queue.Push(file);
+        continue;
+      }
+
+      size_t slot_index = free_slots.back();
+      Slot & slot = slots[slot_index];
+      slot.file = std::move(file);
+      slot.file.content.resize(size);
+      slot.fd = fd;
+      slot.size = size;
+      slot.done = 0;
+      if (!pushRead(ring, slot, slot_index)) {
+        close(fd);
+        queue.Push(slot.file);
+        continue;
+      }
+      free_slots.pop_back();
+      busy[slot_index] = true;
+      ++in_flight;
+    }
+
+    if (0 == in_flight)
+      continue;
+
+    bool waited = ring.SubmitAndWait();
+
+    uint64_t slot_index = 0;
+    int result = 0;
+    while (ring.PopCompletion(slot_index, result)) {
+      Slot & slot = slots[slot_index];
+      if (0 < result) {
+        slot.done += static_cast<size_t>(result);
+        if (slot.done < slot.size && pushRead(ring, slot, slot_index))
+          continue;
+      }
+
+      finishRead(slot, 0 <= result, queue);
+      free_slots.push_back(slot_index);
+      busy[slot_index] = false;
+      --in_flight;
+    }
+
+    // Files not opened yet are read with pread
+    if (!waited) {
+      drainRing(ring, slots, busy, in_flight, queue);
+      readWithThreads(paths, next, queue);
+      return true;
+    }
+  }
+
+  return true;
+}
+
+#endif
+
+}
+
+size_t LoadFiles(const std::vector<std::string> & paths, XmlLoadCallback callback,
+                 int options, size_t num_threads) {
+  if (paths.empty())
+    return 0;
+
+  if (0 == num_threads)
+    num_threads = std::thread::hardware_concurrency();
+  if (0 == num_threads)
+    num_threads = 1;
+  if (num_threads > paths.size())
+    num_threads = paths.size();
+
+  ParseQueue queue(kQueueDepth + 2 * num_threads);
+  std::mutex callback_mutex;
+  std::atomic<size_t> loaded(0);
+  std::vector<std::thread> workers;
+  for (size_t worker = 0; worker < num_threads; ++worker) {
+    workers.push_back(std::thread(parseFiles, std::ref(queue), options, std::ref(callback_mutex),
+                                  std::ref(callback), std::ref(loaded)));
+  }
+
+  bool read = false;
+#ifdef SMALLXML_IO_URING
+  read = readWithRing(paths, queue);
+#endif
+  if (!read)
+    readWithThreads(paths, 0, queue);
+
+  queue.Close();
+  for (size_t worker = 0; worker < workers.size(); ++worker)
+    workers[worker].join();
+
+  return loaded;
+}
+
+}
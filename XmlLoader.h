@@ -0,0 +1,58 @@
+/*
+SmallXml - Tiny and Simple Xml DOM
+
+www.github.com/theliuy/SmallXml.git
+Author: Yang Liu
+        theliuy.com
+*/
+
+#ifndef SMALLXML_XMLLOADER_H
+#define SMALLXML_XMLLOADER_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstddef>
+
+#include "SmallXml.h"
+#include "XmlParser.h"
+
+namespace SmallXml {
+
+/*
+  Called once per file with its index in paths and its document, or
+  NULL if the file could not be read or parsed. The document belongs
+  to the callback, delete it when done.
+*/
+typedef std::function<void (size_t index, XmlNode * document)> XmlLoadCallback;
+
+/*
+  LoadFiles - Read many files and parse them, like LoadFile each, but
+              with the reads in flight together. Returns the number
+              of files loaded.
+
+  On Linux, reads are submitted in batches through io_uring, and
+  waited for together, so loading many small files costs what the
+  disk can deliver rather than the sum of their latencies. Where
+  io_uring is not there, or not allowed, a pool of threads reads them
+  with pread instead; the same happens to the files left when the
+  ring fails midway, once the reads it took have completed. Either
+  way, num_threads worker threads parse the files as their reads
+  complete, one XmlParser each. 0 means one per core.
+
+  std::vector<XmlNode *> configs(paths.size());
+  LoadFiles(paths, [&configs](size_t index, XmlNode * document) {
+    configs[index] = document;
+  });
+
+  NOTE:
+    The callback is called from the worker threads, in the order the
+    files complete, but never for two files at once.
+    Files are read whole. A gzip file is inflated, like LoadFile does.
+*/
+size_t LoadFiles(const std::vector<std::string> & paths, XmlLoadCallback callback,
+                 int options = PARSE_DEFAULT, size_t num_threads = 0);
+
+}
+
+#endif
@@ -0,0 +1,457 @@
+#include "XmlMatcher.h"
+
+#include <cstring>
+
+namespace SmallXml {
+
+namespace {
+
+// Characters which end a name in an expression
+bool isNameEnd(const char c) {
+  return '/' == c || '[' == c || ']' == c || '=' == c || '@' == c ||
+         '\'' == c || '\"' == c || XmlNode::isWhiteSpace(c);
+}
+
+size_t readName(const std::string & expression, size_t pos) {
+  while (pos < expression.size() && !isNameEnd(expression[pos]))
+    ++pos;
+  return pos;
+}
+
+}
+
+XmlStreamMatcher::XmlStreamMatcher(int options)
+    : options_(options),
+      tokenizer_((options & ~(PARSE_LAZY | PARSE_STRUCTURAL_INDEX | PARSE_SOURCE_SPANS)) |
+                 PARSE_SKIP_COMMENTS | PARSE_SKIP_DECLARATIONS | PARSE_SKIP_WHITESPACE_TEXT),
+      parser_(options & ~(PARSE_LAZY | PARSE_STRUCTURAL_INDEX)),
+      failed_(false),
+      base_(0),
+      pos_(0),
+      attributes_read_(false) {
+  State root;
+  root.has_descendant = false;
+  states_.push_back(root);
+  Reset();
+}
+
+/*
+  Steps are parsed first and only then merged into the automaton, so
+  an expression which is not supported leaves it unchanged.
+*/
+int XmlStreamMatcher::Add(const std::string & expression, Callback callback, bool subtree) {
+  std::vector<Transition> steps;
+  std::string attribute;
+
+  size_t pos = 0;
+  while (pos < expression.size()) {
+    if ('/' != expression[pos])
+      return -1;
+    bool descendant = pos + 1 < expression.size() && '/' == expression[pos + 1];
+    pos += descendant ? 2 : 1;
+
+    // Trailing /@name, //@name stands for //*/@name
+    if (pos < expression.size() && '@' == expression[pos]) {
+      size_t end = readName(expression, pos + 1);
+      if (end == pos + 1 || end != expression.size())
+        return -1;
+      if (descendant) {
+        Transition any;
+        any.descendant = true;
+        any.tag = "*";
+        any.target = -1;
+        steps.push_back(any);
+      }
+      attribute = expression.substr(pos + 1);
+      pos = end;
+      break;
+    }
+
+    Transition step;
+    step.descendant = descendant;
+    step.target = -1;
+    size_t end = readName(expression, pos);
+    if (end == pos)
+      return -1;
+    step.tag = expression.substr(pos, end - pos);
+    pos = end;
+
+    // Predicates, [@name] or [@name='value']
+    while (pos < expression.size() && '[' == expression[pos]) {
+      if (pos + 1 >= expression.size() || '@' != expression[pos + 1])
+        return -1;
+      Predicate predicate;
+      pos += 2;
+      end = readName(expression, pos);
+      if (end == pos || end == expression.size())
+        return -1;
+      predicate.name = expression.substr(pos, end - pos);
+      predicate.has_value = false;
+      pos = end;
+
+      if ('=' == expression[pos]) {
+        ++pos;
+        if (pos >= expression.size() || ('\'' != expression[pos] && '\"' != expression[pos]))
+          return -1;
+        size_t close = expression.find(expression[pos], pos + 1);
+        if (std::string::npos == close)
+          return -1;
+        predicate.value = expression.substr(pos + 1, close - pos - 1);
+        predicate.has_value = true;
+        pos = close + 1;
+      }
+      if (pos >= expression.size() || ']' != expression[pos])
+        return -1;
+      ++pos;
+      step.predicates.push_back(predicate);
+    }
+
+    steps.push_back(step);
+  }
+
+  if (steps.empty())
+    return -1;
+
+  // Merge the steps into the automaton, sharing equal transitions
+  int state = 0;
+  for (size_t i = 0; i < steps.size(); ++i) {
+    const Transition & step = steps[i];
+    int target = -1;
+    for (size_t t = 0; t < states_[state].transitions.size(); ++t) {
+      const Transition & transition = transitions_[states_[state].transitions[t]];
+      if (transition.descendant != step.descendant || transition.tag != step.tag ||
+          transition.predicates.size() != step.predicates.size())
+        continue;
+      bool same = true;
+      for (size_t p = 0; same && p < step.predicates.size(); ++p) {
+        const Predicate & a = transition.predicates[p];
+        const Predicate & b = step.predicates[p];
+        same = a.name == b.name && a.has_value == b.has_value && a.value == b.value;
+      }
+      if (same) {
+        target = transition.target;
+        break;
+      }
+    }
+
+    if (-1 == target) {
+      target = static_cast<int>(states_.size());
+      State added;
+      added.has_descendant = false;
+      states_.push_back(added);
+
+      transitions_.push_back(step);
+      transitions_.back().target = target;
+      states_[state].transitions.push_back(static_cast<int>(transitions_.size() - 1));
+      if (step.descendant)
+        states_[state].has_descendant = true;
+    }
+    state = target;
+  }
+
+  Expression added;
+  added.attribute = attribute;
+  added.callback = callback;
+  added.subtree = subtree && attribute.empty();
+  expressions_.push_back(added);
+
+  int id = static_cast<int>(expressions_.size() - 1);
+  states_[state].accepts.push_back(id);
+  return id;
+}
+
+bool XmlStreamMatcher::Feed(const char * data, size_t size) {
+  if (failed_)
+    return false;
+
+  buffer_.append(data, size);
+  return process(false);
+}
+
+bool XmlStreamMatcher::Finish() {
+  if (failed_)
+    return false;
+
+  if (!process(true))
+    return false;
+  // Every element has to be closed
+  if (!open_offsets_.empty())
+    return fail();
+  return true;
+}
+
+bool XmlStreamMatcher::Failed() const {
+  return failed_;
+}
+
+bool XmlStreamMatcher::Match(const std::string & content) {
+  Reset();
+  return Feed(content.data(), content.size()) && Finish();
+}
+
+void XmlStreamMatcher::Reset() {
+  failed_ = false;
+  buffer_.clear();
+  base_ = 0;
+  pos_ = 0;
+
+  entries_.clear();
+  level_begins_.clear();
+  Entry root = {0, true};
+  entries_.push_back(root);
+  level_begins_.push_back(0);
+
+  open_tags_.clear();
+  open_offsets_.clear();
+  captures_.clear();
+  attributes_read_ = false;
+  attributes_.clear();
+  decoded_.clear();
+}
+
+/*
+  Tokenize what is buffered. A token cut by the end of the buffer makes
+  the tokenizer fail, unless it is the last piece that only means the
+  token is read again once more data is there.
+*/
+bool XmlStreamMatcher::process(bool last) {
+  tokenizer_.Reset(buffer_.data(), buffer_.size(), pos_);
+
+  XmlToken token;
+  while (tokenizer_.Next(token)) {
+    if (XmlNode::ELEMENT == token.type) {
+      bool ok = (XmlNode::CLOSE_TAG == token.flag) ? closeElement(token) : openElement(token);
+      if (!ok)
+        return fail();
+    }
+    pos_ = token.end;
+  }
+
+  if (tokenizer_.Failed()) {
+    if (last)
+      return fail();
+  } else {
+    pos_ = tokenizer_.index();
+  }
+
+  // Drop what is consumed, except the elements still captured
+  size_t keep = pos_;
+  if (!captures_.empty() && captures_.front().begin - base_ < keep)
+    keep = captures_.front().begin - base_;
+  buffer_.erase(0, keep);
+  base_ += keep;
+  pos_ -= keep;
+  return true;
+}
+
+bool XmlStreamMatcher::openElement(const XmlToken & token) {
+  attributes_read_ = false;
+
+  size_t parent_begin = level_begins_.back();
+  size_t parent_end = entries_.size();
+  level_begins_.push_back(parent_end);
+
+  for (size_t i = parent_begin; i < parent_end; ++i) {
+    // A copy, addEntry grows entries_
+    Entry entry = entries_[i];
+    const State & state = states_[entry.state];
+    for (size_t t = 0; t < state.transitions.size(); ++t) {
+      const Transition & transition = transitions_[state.transitions[t]];
+      if (!transition.descendant && !entry.child)
+        continue;
+      if (matches(transition, token))
+        addEntry(transition.target, true);
+    }
+    // Keep looking for descendants below this element
+    if (state.has_descendant)
+      addEntry(entry.state, false);
+  }
+
+  size_t depth = open_offsets_.size() + 1;
+  fire(token, depth);
+
+  if (XmlNode::SELF_CLOSE_TAG == token.flag) {
+    entries_.resize(level_begins_.back());
+    level_begins_.pop_back();
+    if (!captures_.empty() && depth == captures_.back().depth)
+      finishCapture(token.end);
+    return !failed_;
+  }
+
+  open_offsets_.push_back(open_tags_.size());
+  open_tags_.append(token.name, token.name_size);
+  return true;
+}
+
+bool XmlStreamMatcher::closeElement(const XmlToken & token) {
+  if (open_offsets_.empty())
+    return false;
+
+  const char * begin = token.name;
+  const char * end = token.name + token.name_size;
+  XmlNode::trimRange(begin, end);
+  size_t offset = open_offsets_.back();
+  size_t size = open_tags_.size() - offset;
+  if (static_cast<size_t>(end - begin) != size ||
+      0 != memcmp(begin, open_tags_.data() + offset, size))
+    return false;
+
+  size_t depth = open_offsets_.size();
+  open_tags_.resize(offset);
+  open_offsets_.pop_back();
+  entries_.resize(level_begins_.back());
+  level_begins_.pop_back();
+
+  if (!captures_.empty() && depth == captures_.back().depth)
+    finishCapture(token.end);
+  return !failed_;
+}
+
+/*
+  Report the expressions accepted by the element just opened. Those
+  with a subtree wait for its close tag.
+*/
+void XmlStreamMatcher::fire(const XmlToken & token, size_t depth) {
+  Capture capture;
+  for (size_t i = level_begins_.back(); i < entries_.size(); ++i) {
+    if (!entries_[i].child)
+      continue;
+
+    const std::vector<int> & accepts = states_[entries_[i].state].accepts;
+    for (size_t a = 0; a < accepts.size(); ++a) {
+      const Expression & expression = expressions_[accepts[a]];
+      if (expression.subtree) {
+        capture.ids.push_back(accepts[a]);
+        continue;
+      }
+
+      XmlStreamMatch match;
+      match.id = accepts[a];
+      match.tag = std::string_view(token.name, token.name_size);
+      match.depth = depth;
+      match.offset = base_ + token.begin;
+      match.node = NULL;
+      if (!expression.attribute.empty()) {
+        readAttributes(token);
+        if (!attribute(expression.attribute, match.value))
+          continue;
+      }
+      expression.callback(match);
+    }
+  }
+
+  if (!capture.ids.empty()) {
+    capture.begin = base_ + token.begin;
+    capture.tag_begin = base_ + (token.name - buffer_.data());
+    capture.tag_size = token.name_size;
+    capture.depth = depth;
+    captures_.push_back(capture);
+  }
+}
+
+/*
+  The innermost capture ends at end, parse its bytes and report it.
+  Captures are nested like the elements, so it is always the last one.
+*/
+void XmlStreamMatcher::finishCapture(size_t end) {
+  Capture capture;
+  capture.ids.swap(captures_.back().ids);
+  capture.begin = captures_.back().begin;
+  capture.tag_begin = captures_.back().tag_begin;
+  capture.tag_size = captures_.back().tag_size;
+  capture.depth = captures_.back().depth;
+  captures_.pop_back();
+
+  size_t begin = capture.begin - base_;
+  size_t index = 0;
+  if (!parser_.Read(buffer_.data() + begin, end - begin, index, node_)) {
+    fail();
+    return;
+  }
+
+  XmlStreamMatch match;
+  match.tag = std::string_view(buffer_.data() + (capture.tag_begin - base_), capture.tag_size);
+  match.depth = capture.depth;
+  match.offset = capture.begin;
+  match.node = &node_;
+  for (size_t i = 0; i < capture.ids.size(); ++i) {
+    match.id = capture.ids[i];
+    expressions_[match.id].callback(match);
+  }
+}
+
+bool XmlStreamMatcher::fail() {
+  failed_ = true;
+  return false;
+}
+
+bool XmlStreamMatcher::matches(const Transition & transition, const XmlToken & token) {
+  if ("*" != transition.tag &&
+      (transition.tag.size() != token.name_size ||
+       0 != memcmp(transition.tag.data(), token.name, token.name_size)))
+    return false;
+
+  if (transition.predicates.empty())
+    return true;
+
+  readAttributes(token);
+  for (size_t i = 0; i < transition.predicates.size(); ++i) {
+    const Predicate & predicate = transition.predicates[i];
+    std::string_view value;
+    if (!attribute(predicate.name, value))
+      return false;
+    if (predicate.has_value && value != predicate.value)
+      return false;
+  }
+
+  return true;
+}
+
+void XmlStreamMatcher::readAttributes(const XmlToken & token) {
+  if (attributes_read_)
+    return;
+  attributes_read_ = true;
+  attributes_.clear();
+  decoded_.clear();
+
+  const char * pos = token.value;
+  const char * end = token.value + token.value_size;
+  const char * name = NULL;
+  const char * value = NULL;
+  size_t name_size = 0;
+  size_t value_size = 0;
+  while (XmlTokenizer::NextAttribute(pos, end, name, name_size, value, value_size)) {
+    Attribute read;
+    read.name = std::string_view(name, name_size);
+    read.value_begin = decoded_.size();
+    XmlNode::XmlSpecialCharDecode(value, value_size, decoded_);
+    read.value_size = decoded_.size() - read.value_begin;
+    attributes_.push_back(read);
+  }
+}
+
+bool XmlStreamMatcher::attribute(const std::string & name, std::string_view & value) const {
+  for (size_t i = 0; i < attributes_.size(); ++i) {
+    if (attributes_[i].name == name) {
+      value = std::string_view(decoded_.data() + attributes_[i].value_begin,
+                               attributes_[i].value_size);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void XmlStreamMatcher::addEntry(int state, bool child) {
+  for (size_t i = level_begins_.back(); i < entries_.size(); ++i) {
+    if (state == entries_[i].state) {
+      entries_[i].child = entries_[i].child || child;
+      return;
+    }
+  }
+
+  Entry entry = {state, child};
+  entries_.push_back(entry);
+}
+
+}
@@ -0,0 +1,219 @@
+/*
+SmallXml - Tiny and Simple Xml DOM
+
+www.github.com/theliuy/SmallXml.git
+Author: Yang Liu
+        theliuy.com
+*/
+
+#ifndef SMALLXML_XMLMATCHER_H
+#define SMALLXML_XMLMATCHER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <cstddef>
+
+#include "SmallXml.h"
+#include "XmlParser.h"
+
+namespace SmallXml {
+
+/*
+  What a XmlStreamMatcher reports for each match.
+
+  id - What Add returned for the expression
+  tag - Tag of the matched element, as written in the stream
+  value - Decoded value of the attribute, for an expression ending
+          with /@name, empty otherwise
+  depth - Depth of the element, 1 for the top level element
+  offset - Offset of its open tag in the stream
+  node - The element and its subtree, when the expression was added
+         with subtree, NULL otherwise. It is only valid during the
+         callback, copy it to keep it.
+*/
+struct XmlStreamMatch {
+  int id;
+  std::string_view tag;
+  std::string_view value;
+  size_t depth;
+  size_t offset;
+  const XmlNode * node;
+};
+
+/*
+  XmlStreamMatcher finds elements and attributes in xml which is fed to
+  it piece by piece, without building a DOM.
+
+  Expressions are a small part of XPath:
+    /a/b/c            child steps from the top level element
+    //item            an element at any depth
+    /a//item/name     both, mixed
+    *                 any tag
+    [@type]           an element with that attribute
+    [@type='x']       an element whose attribute has that value,
+                      several predicates may follow each other
+    /@id              at the end, the attribute of the matched elements
+
+  All expressions are compiled into one automaton, and the steps they
+  share are shared by the automaton as well. Each element only runs
+  the transitions of the states which are active at its parent, thus
+  many expressions cost about as much as one. The matcher keeps the
+  active states and the open tags, memory follows the depth of the
+  document, not its size. Only a match added with subtree keeps the
+  bytes of its element until the element is closed, then it is parsed
+  into a XmlNode.
+
+  XmlStreamMatcher matcher;
+  matcher.Add("//item[@type='book']/@id", [&](const XmlStreamMatch & match) {
+    ids.push_back(std::string(match.value));
+  });
+  matcher.Add("/catalog/header", [&](const XmlStreamMatch & match) {
+    header = *match.node;
+  }, true);
+
+  while (0 < (size = fread(buffer, 1, sizeof(buffer), file)))
+    if (!matcher.Feed(buffer, size))
+      break;
+  bool ok = matcher.Finish();
+
+  Callbacks fire in document order of open tags, except for those with
+  a subtree, which fire at the close tag.
+
+  NOTE:
+    Tags and attribute names are compared as they are written, values
+    of predicates after decoding. Texts are not matched.
+*/
+class XmlStreamMatcher {
+ public:
+  typedef std::function<void (const XmlStreamMatch &)> Callback;
+
+  explicit XmlStreamMatcher(int options = PARSE_DEFAULT);
+
+  /*
+    Add - Register an expression. Returns its id, or -1 when the
+          expression is not supported. Expressions are added before
+          the first Feed.
+  */
+  int Add(const std::string & expression, Callback callback, bool subtree = false);
+
+  /*
+    Feed - Match the next piece of the stream. Pieces may be cut
+           anywhere. Returns false once the xml is found malformed.
+    Finish - End of the stream. Returns false if the xml is malformed
+             or incomplete.
+  */
+  bool Feed(const char * data, size_t size);
+  bool Finish();
+  bool Failed() const;
+
+  // Match a whole document at once
+  bool Match(const std::string & content);
+
+  // Forget the stream, to match another one with the same expressions
+  void Reset();
+
+ private:
+  // Not copyable
+  XmlStreamMatcher(const XmlStreamMatcher &);
+  XmlStreamMatcher & operator=(const XmlStreamMatcher &);
+
+  struct Predicate {
+    std::string name;
+    std::string value;
+    bool has_value;
+  };
+
+  // An edge of the automaton, to target for an element matching it
+  struct Transition {
+    bool descendant;
+    std::string tag;
+    std::vector<Predicate> predicates;
+    int target;
+  };
+
+  struct State {
+    std::vector<int> transitions;
+    bool has_descendant;
+    // Expressions which end here
+    std::vector<int> accepts;
+  };
+
+  struct Expression {
+    std::string attribute;
+    Callback callback;
+    bool subtree;
+  };
+
+  // An active state at some depth. Carried down below a match, only
+  // its descendant transitions apply.
+  struct Entry {
+    int state;
+    bool child;
+  };
+
+  // An element kept for expressions with subtree
+  struct Capture {
+    size_t begin;
+    size_t tag_begin;
+    size_t tag_size;
+    size_t depth;
+    std::vector<int> ids;
+  };
+
+  bool process(bool last);
+  bool openElement(const XmlToken & token);
+  bool closeElement(const XmlToken & token);
+  void fire(const XmlToken & token, size_t depth);
+  void finishCapture(size_t end);
+  bool fail();
+
+  bool matches(const Transition & transition, const XmlToken & token);
+  void readAttributes(const XmlToken & token);
+  // Decoded value of an attribute of the current element
+  bool attribute(const std::string & name, std::string_view & value) const;
+  void addEntry(int state, bool child);
+
+  int options_;
+  XmlTokenizer tokenizer_;
+  XmlParser parser_;
+  XmlNode node_;
+  bool failed_;
+
+  std::vector<State> states_;
+  std::vector<Transition> transitions_;
+  std::vector<Expression> expressions_;
+
+  // Bytes not consumed yet, from offset base_ of the stream, and the
+  // position in them where tokenizing goes on
+  std::string buffer_;
+  size_t base_;
+  size_t pos_;
+
+  // Active entries of every open depth, level_begins_[d] is where
+  // those of depth d start
+  std::vector<Entry> entries_;
+  std::vector<size_t> level_begins_;
+
+  // Open tags, one after the other, and where each starts
+  std::string open_tags_;
+  std::vector<size_t> open_offsets_;
+
+  std::vector<Capture> captures_;
+
+  // Attributes of the current element, read when first needed.
+  // Names point into buffer_, values into decoded_.
+  struct Attribute {
+    std::string_view name;
+    size_t value_begin;
+    size_t value_size;
+  };
+  bool attributes_read_;
+  std::vector<Attribute> attributes_;
+  std::string decoded_;
+};
+
+}
+
+#endif
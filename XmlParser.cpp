@@ -0,0 +1,1177 @@
+#include "XmlParser.h"
+
+#include <cstring>
+#include <algorithm>
+
+namespace SmallXml {
+
+namespace {
+
+bool startsWith(const char * pos, const char * end, const char * prefix, size_t size) {
+  return static_cast<size_t>(end - pos) >= size && 0 == memcmp(pos, prefix, size);
+}
+
+bool isWhiteSpaceOnly(const char * pos, const char * end) {
+  for (; pos != end; ++pos) {
+    if (!XmlNode::isWhiteSpace(*pos))
+      return false;
+  }
+
+  return true;
+}
+
+/*
+  Trim a stored value in place, it keeps its capacity
+*/
+void trimInPlace(XmlValue & value) {
+  const char * data = value.data();
+  size_t end = value.size();
+  while (0 != end && XmlNode::isWhiteSpace(data[end - 1]))
+    --end;
+  size_t begin = 0;
+  while (begin != end && XmlNode::isWhiteSpace(data[begin]))
+    ++begin;
+
+  if (begin != 0 || end != value.size())
+    value.keep(begin, end - begin);
+}
+
+/*
+  Find needle in [pos, end), return end if it is not there.
+*/
+const char * findStr(const char * pos, const char * end, const char * needle, size_t size) {
+  while (static_cast<size_t>(end - pos) >= size) {
+    const char * first = static_cast<const char *>(memchr(pos, needle[0], end - pos - size + 1));
+    if (NULL == first)
+      return end;
+    if (0 == memcmp(first, needle, size))
+      return first;
+    pos = first + 1;
+  }
+
+  return end;
+}
+
+}
+
+/////////////////////////////////////////////
+// XmlTokenizer
+
+XmlTokenizer::XmlTokenizer(int options)
+  : data_(NULL), pos_(NULL), end_(NULL), failed_(false), options_(options),
+    index_(NULL), mark_(0) {
+}
+
+void XmlTokenizer::Reset(const char * data, size_t size, size_t index,
+                         const XmlStructuralIndex * structural_index) {
+  data_ = data;
+  end_ = data + size;
+  pos_ = data + (index < size ? index : size);
+  failed_ = false;
+
+  index_ = structural_index;
+  mark_ = (NULL == index_) ? 0 : index_->Lower(pos_ - data_);
+}
+
+void XmlTokenizer::SetOptions(int options) {
+  options_ = options;
+}
+
+bool XmlTokenizer::Failed() const {
+  return failed_;
+}
+
+size_t XmlTokenizer::index() const {
+  return pos_ - data_;
+}
+
+bool XmlTokenizer::Next(XmlToken & token) {
+  // White space in front of a token is only a text of its own when
+  // white space is kept or white space texts are wanted
+  bool skip_white_space = (0 != (options_ & PARSE_SKIP_WHITESPACE_TEXT)) &&
+                          (0 == (options_ & PARSE_PRESERVE_WHITESPACE));
+
+  while (true) {
+    while (skip_white_space && pos_ != end_ && XmlNode::isWhiteSpace(*pos_))
+      ++pos_;
+
+    if (failed_ || pos_ == end_)
+      return false;
+
+    const char * start = pos_;
+    token.begin = start - data_;
+    token.name = NULL;
+    token.name_size = 0;
+    token.value = NULL;
+    token.value_size = 0;
+    token.flag = XmlNode::SELF_CLOSE_TAG;
+
+    // TEXT, up to the next tag
+    if ('<' != *start) {
+      const char * lt = NULL;
+      if (NULL == index_)
+        lt = static_cast<const char *>(memchr(start, '<', end_ - start));
+      else if (mark_ < index_->marks().size())
+        lt = data_ + index_->marks()[mark_];
+      pos_ = (NULL == lt) ? end_ : lt;
+      if (!skip_white_space &&
+          0 != (options_ & PARSE_SKIP_WHITESPACE_TEXT) &&
+          isWhiteSpaceOnly(start, pos_)) {
+        continue;
+      }
+      token.type = XmlNode::TEXT;
+      token.value = start;
+      token.value_size = pos_ - start;
+      token.end = pos_ - data_;
+      return true;
+    }
+
+    // With an index, the end of the markup is known already
+    const char * gt = NULL;
+    if (NULL != index_ && NULL == (gt = indexedEnd(start)))
+      return fail();
+
+    // Comment
+    if (startsWith(start, end_, "<!--", 4)) {
+      const char * close = (NULL != gt) ? gt - 2 : findStr(start + 4, end_, "-->", 3);
+      if (close == end_)
+        return fail();
+      if (0 != (options_ & PARSE_SKIP_COMMENTS)) {
+        pos_ = close + 3;
+        continue;
+      }
+      token.type = XmlNode::COMMENT;
+      token.value = start + 4;
+      token.value_size = close - token.value;
+      pos_ = close + 3;
+      token.end = pos_ - data_;
+      return true;
+    }
+
+    // CDATA section, a text which is not parsed
+    if (startsWith(start, end_, "<![CDATA[", 9)) {
+      const char * close = (NULL != gt) ? gt - 2 : findStr(start + 9, end_, "]]>", 3);
+      if (close == end_)
+        return fail();
+      token.type = XmlNode::TEXT;
+      token.value = start + 9;
+      token.value_size = close - token.value;
+      pos_ = close + 3;
+      token.end = pos_ - data_;
+      return true;
+    }
+
+    // Declaration, or a processing instruction which is skipped
+    if (startsWith(start, end_, "<?", 2)) {
+      const char * close = (NULL != gt) ? gt - 1 : findStr(start + 2, end_, "?>", 2);
+      if (close == end_)
+        return fail();
+      pos_ = close + 2;
+
+      if (startsWith(start, close, "<?xml", 5) &&
+          (start + 5 == close || XmlNode::isWhiteSpace(start[5])) &&
+          0 == (options_ & PARSE_SKIP_DECLARATIONS)) {
+        token.type = XmlNode::DECLARATION;
+        token.value = start + 5;
+        token.value_size = close - token.value;
+        token.end = pos_ - data_;
+        return true;
+      }
+      continue;
+    }
+
+    // <!DOCTYPE ...>, skipped with its internal subset
+    if (startsWith(start, end_, "<!", 2)) {
+      if (NULL != gt) {
+        pos_ = gt + 1;
+        continue;
+      }
+
+      int brackets = 0;
+      char quote = 0;
+      const char * scan = start + 2;
+      for (; scan != end_; ++scan) {
+        if (0 != quote) {
+          if (quote == *scan)
+            quote = 0;
+        } else if ('\"' == *scan || '\'' == *scan) {
+          quote = *scan;
+        } else if ('[' == *scan) {
+          ++brackets;
+        } else if (']' == *scan) {
+          --brackets;
+        } else if ('>' == *scan && 0 >= brackets) {
+          break;
+        }
+      }
+      if (scan == end_)
+        return fail();
+      pos_ = scan + 1;
+      continue;
+    }
+
+    // Close tag
+    if (startsWith(start, end_, "</", 2)) {
+      if (NULL == gt)
+        gt = static_cast<const char *>(memchr(start + 2, '>', end_ - start - 2));
+      if (NULL == gt)
+        return fail();
+      token.type = XmlNode::ELEMENT;
+      token.flag = XmlNode::CLOSE_TAG;
+      token.name = start + 2;
+      token.name_size = gt - token.name;
+      pos_ = gt + 1;
+      token.end = pos_ - data_;
+      return true;
+    }
+
+    // Open tag, or self closed tag
+    const char * scan = start + 1;
+    while (scan != end_ && !XmlNode::isWhiteSpace(*scan) && '>' != *scan && '/' != *scan)
+      ++scan;
+    if (scan == start + 1)
+      return fail();
+
+    token.type = XmlNode::ELEMENT;
+    token.name = start + 1;
+    token.name_size = scan - token.name;
+
+    // Attributes, up to a '>' which is not quoted
+    const char * attributes = scan;
+    if (NULL != gt) {
+      scan = gt;
+    } else {
+      char quote = 0;
+      for (; scan != end_; ++scan) {
+        if (0 != quote) {
+          if (quote == *scan)
+            quote = 0;
+        } else if ('\"' == *scan || '\'' == *scan) {
+          quote = *scan;
+        } else if ('>' == *scan) {
+          break;
+        }
+      }
+    }
+    if (scan == end_)
+      return fail();
+
+    const char * attributes_end = scan;
+    token.flag = XmlNode::OPEN_TAG;
+    if (attributes_end != attributes && '/' == *(attributes_end - 1)) {
+      token.flag = XmlNode::SELF_CLOSE_TAG;
+      --attributes_end;
+    }
+    token.value = attributes;
+    token.value_size = attributes_end - attributes;
+
+    pos_ = scan + 1;
+    token.end = pos_ - data_;
+    return true;
+  }
+}
+
+bool XmlTokenizer::SkipElement(std::vector<std::pair<size_t, size_t> > * ends) {
+  open_ends_.clear();
+  openSkipped(ends);
+  if (NULL != index_)
+    return skipIndexedElement(ends);
+
+  int depth = 1;
+
+  while (!failed_) {
+    const char * lt = static_cast<const char *>(memchr(pos_, '<', end_ - pos_));
+    if (NULL == lt)
+      return fail();
+
+    const char * close = NULL;
+    if (startsWith(lt, end_, "<!--", 4)) {
+      close = findStr(lt + 4, end_, "-->", 3);
+      pos_ = (close == end_) ? end_ : close + 3;
+    } else if (startsWith(lt, end_, "<![CDATA[", 9)) {
+      close = findStr(lt + 9, end_, "]]>", 3);
+      pos_ = (close == end_) ? end_ : close + 3;
+    } else if (startsWith(lt, end_, "<?", 2)) {
+      close = findStr(lt + 2, end_, "?>", 2);
+      pos_ = (close == end_) ? end_ : close + 2;
+    } else {
+      // Tags and <!...>, up to a '>' which is not quoted
+      char quote = 0;
+      const char * scan = lt + 1;
+      for (; scan != end_; ++scan) {
+        if (0 != quote) {
+          if (quote == *scan)
+            quote = 0;
+        } else if ('\"' == *scan || '\'' == *scan) {
+          quote = *scan;
+        } else if ('>' == *scan) {
+          break;
+        }
+      }
+      close = scan;
+      pos_ = (close == end_) ? end_ : close + 1;
+
+      if (close != end_ && '!' != lt[1]) {
+        if ('/' == lt[1]) {
+          --depth;
+          closeSkipped(ends);
+        } else if ('/' != *(close - 1)) {
+          ++depth;
+          openSkipped(ends);
+        }
+      }
+    }
+
+    if (close == end_)
+      return fail();
+    if (0 == depth)
+      return true;
+  }
+
+  return false;
+}
+
+bool XmlTokenizer::NextAttribute(const char * & pos, const char * end,
+                                 const char * & name, size_t & name_size,
+                                 const char * & value, size_t & value_size) {
+  while (pos != end) {
+    while (pos != end && XmlNode::isWhiteSpace(*pos))
+      ++pos;
+    if (pos == end)
+      return false;
+
+    // Name, everything up to '=' like SetAttributes
+    name = pos;
+    const char * equal = static_cast<const char *>(memchr(pos, '=', end - pos));
+    if (NULL == equal) {
+      pos = end;
+      return false;
+    }
+    const char * name_end = equal;
+    while (name_end != name && XmlNode::isWhiteSpace(*(name_end - 1)))
+      --name_end;
+    name_size = name_end - name;
+
+    pos = equal + 1;
+    while (pos != end && XmlNode::isWhiteSpace(*pos))
+      ++pos;
+    if (pos == end)
+      return false;
+
+    if ('\"' == *pos || '\'' == *pos) {
+      char quote = *pos++;
+      value = pos;
+      while (pos != end && quote != *pos)
+        ++pos;
+      value_size = pos - value;
+      if (pos != end)
+        ++pos;
+    } else {
+      // Not quoted, up to the next white space
+      value = pos;
+      while (pos != end && !XmlNode::isWhiteSpace(*pos))
+        ++pos;
+      value_size = pos - value;
+    }
+
+    if (0 != name_size)
+      return true;
+  }
+
+  return false;
+}
+
+/*
+  The next markup of the index has to start at start, otherwise the
+  index was not built from this content. Returns NULL then.
+*/
+const char * XmlTokenizer::indexedEnd(const char * start) {
+  const std::vector<uint32_t> & marks = index_->marks();
+  if (mark_ + 1 >= marks.size() || data_ + marks[mark_] != start)
+    return NULL;
+
+  const char * gt = data_ + marks[mark_ + 1];
+  mark_ += 2;
+  return gt;
+}
+
+void XmlTokenizer::Seek(size_t index) {
+  pos_ = data_ + (index < static_cast<size_t>(end_ - data_) ? index : end_ - data_);
+  if (NULL != index_)
+    mark_ = index_->Lower(pos_ - data_);
+}
+
+/*
+  Same depth counting as SkipElement, one step per markup
+*/
+bool XmlTokenizer::skipIndexedElement(std::vector<std::pair<size_t, size_t> > * ends) {
+  const std::vector<uint32_t> & marks = index_->marks();
+  int depth = 1;
+
+  while (!failed_ && mark_ + 1 < marks.size()) {
+    const char * lt = data_ + marks[mark_];
+    const char * gt = data_ + marks[mark_ + 1];
+    mark_ += 2;
+    pos_ = gt + 1;
+
+    if ('/' == lt[1]) {
+      --depth;
+      closeSkipped(ends);
+    } else if ('!' != lt[1] && '?' != lt[1] && '/' != *(gt - 1)) {
+      ++depth;
+      openSkipped(ends);
+    }
+
+    if (0 == depth)
+      return true;
+  }
+
+  pos_ = end_;
+  return fail();
+}
+
+/*
+  An element starts right behind the open tag just skipped. Its end is
+  filled in at its close tag, and stays 0 if there is none.
+*/
+void XmlTokenizer::openSkipped(std::vector<std::pair<size_t, size_t> > * ends) {
+  if (NULL == ends)
+    return;
+  open_ends_.push_back(ends->size());
+  ends->push_back(std::make_pair(static_cast<size_t>(pos_ - data_), static_cast<size_t>(0)));
+}
+
+void XmlTokenizer::closeSkipped(std::vector<std::pair<size_t, size_t> > * ends) {
+  if (NULL == ends || open_ends_.empty())
+    return;
+  (*ends)[open_ends_.back()].second = pos_ - data_;
+  open_ends_.pop_back();
+}
+
+bool XmlTokenizer::fail() {
+  failed_ = true;
+  return false;
+}
+
+/////////////////////////////////////////////
+// ParseProjection
+
+const int ParseProjection::NO_MATCH;
+const int ParseProjection::WHOLE_SUBTREE;
+
+ParseProjection::ParseProjection()
+  : steps_(1) {
+  steps_[0].matched = false;
+}
+
+ParseProjection::ParseProjection(std::initializer_list<std::string> paths)
+  : steps_(1) {
+  steps_[0].matched = false;
+  for (std::initializer_list<std::string>::const_iterator it = paths.begin();
+       it != paths.end();
+       ++it) {
+    Add(*it);
+  }
+}
+
+void ParseProjection::Add(const std::string & path) {
+  std::vector<std::string> tags;
+  size_t start = 0;
+
+  while (start < path.size()) {
+    size_t slash = path.find('/', start);
+    if (std::string::npos == slash)
+      slash = path.size();
+
+    if (slash > start)
+      tags.push_back(path.substr(start, slash - start));
+
+    start = slash + 1;
+  }
+
+  if (tags.empty())
+    return;
+
+  paths_.push_back(tags);
+  rebuild();
+}
+
+bool ParseProjection::Empty() const {
+  return 1 == steps_.size();
+}
+
+/*
+  A named step wins over "*", which is the last one
+*/
+int ParseProjection::next(int step, const char * tag, size_t size) const {
+  const std::vector<int> & children = steps_[step].children;
+  for (size_t index = 0; index < children.size(); ++index) {
+    const std::string & step_tag = steps_[children[index]].tag;
+    if (("*" == step_tag) ||
+        (step_tag.size() == size && 0 == memcmp(step_tag.data(), tag, size))) {
+      return children[index];
+    }
+  }
+
+  return NO_MATCH;
+}
+
+/*
+  Paths share their common prefix, they are kept as a trie. A step
+  stands for all paths which can be where it is, a tag below it goes to
+  one step only, even if it is matched both by name and by "*".
+*/
+void ParseProjection::rebuild() {
+  std::vector<Position> positions;
+  for (size_t index = 0; index < paths_.size(); ++index)
+    positions.push_back(Position(index, 0));
+
+  steps_.clear();
+  addStep("", positions);
+}
+
+int ParseProjection::addStep(const std::string & tag,
+                             const std::vector<Position> & positions) {
+  int step = steps_.size();
+  Step new_step;
+  new_step.tag = tag;
+  new_step.matched = false;
+  steps_.push_back(new_step);
+
+  std::vector<std::string> names;
+  bool any = false;
+  for (size_t index = 0; index < positions.size(); ++index) {
+    const std::vector<std::string> & path = paths_[positions[index].first];
+    size_t taken = positions[index].second;
+    if (taken == path.size()) {
+      // Everything below is taken anyway
+      steps_[step].matched = true;
+      return step;
+    }
+    if ("*" == path[taken])
+      any = true;
+    else if (names.end() == std::find(names.begin(), names.end(), path[taken]))
+      names.push_back(path[taken]);
+  }
+
+  for (size_t name = 0; name <= names.size(); ++name) {
+    if (name == names.size() && !any)
+      break;
+
+    const std::string & next_tag = (name < names.size()) ? names[name] : "*";
+    std::vector<Position> next_positions;
+    for (size_t index = 0; index < positions.size(); ++index) {
+      const std::vector<std::string> & path = paths_[positions[index].first];
+      size_t taken = positions[index].second;
+      if (next_tag == path[taken] || "*" == path[taken])
+        next_positions.push_back(Position(positions[index].first, taken + 1));
+    }
+
+    int child = addStep(next_tag, next_positions);
+    steps_[step].children.push_back(child);
+  }
+
+  return step;
+}
+
+/////////////////////////////////////////////
+// XmlParser
+
+XmlParser::XmlParser(int options)
+  : tokenizer_(options), options_(options), text_run_(NULL), projection_(NULL),
+    lazy_(false), spans_(false), values_(NULL), ends_(NULL) {
+}
+
+XmlParser::~XmlParser() {
+  Reset();
+}
+
+bool XmlParser::Read(const std::string & content, XmlNode & node) {
+  size_t index = 0;
+  return Read(content.data(), content.size(), index, node);
+}
+
+bool XmlParser::Read(const std::string & content, int & index, XmlNode & node) {
+  size_t position = (0 > index) ? 0 : index;
+  bool result = Read(content.data(), content.size(), position, node);
+  index = static_cast<int>(position);
+  return result;
+}
+
+bool XmlParser::Read(const char * data, size_t size, size_t & index, XmlNode & node) {
+  // The old content goes back to the pool
+  Recycle(node);
+
+  // Content in another encoding is converted, and read in one go
+  bool transcoded = false;
+  if (0 != (options_ & PARSE_TRANSCODE)) {
+    size_t bom_size = 0;
+    XmlEncoding encoding = DetectEncoding(data, size, bom_size);
+    if (ENCODING_UTF8 == encoding) {
+      if (index < bom_size)
+        index = bom_size;
+    } else {
+      if (0 != index || !TranscodeToUtf8(data + bom_size, size - bom_size, encoding, transcode_buffer_))
+        return false;
+      data = transcode_buffer_.data();
+      size = transcode_buffer_.size();
+      transcoded = true;
+    }
+  }
+
+  // Lazy nodes and source spans refer to a copy of the content
+  XmlStructuralIndex * structural_index = &index_;
+  lazy_ = (0 != (options_ & PARSE_LAZY) && NULL == projection_);
+  spans_ = (0 != (options_ & PARSE_SOURCE_SPANS));
+  bool dedup = (0 != (options_ & PARSE_DEDUP_VALUES));
+  if (lazy_ || spans_ || dedup) {
+    std::shared_ptr<XmlSource> source = std::make_shared<XmlSource>();
+    source->options = options_;
+    if (lazy_ || spans_) {
+      if (transcoded)
+        source->content.swap(transcode_buffer_);
+      else
+        source->content.assign(data, size);
+      data = source->content.data();
+      structural_index = &source->index;
+    }
+    if (dedup) {
+      source->values = std::make_shared<XmlValuePool>();
+      values_ = source->values.get();
+    }
+    if (lazy_)
+      ends_ = &source->ends;
+    source_ = source;
+  }
+
+  // Converted content is valid UTF-8 anyway. The index checks all
+  // the content while it is built, otherwise the part to read is
+  // checked first.
+  size_t begin = (index < size) ? index : size;
+  bool validate = (0 != (options_ & PARSE_VALIDATE_UTF8) && !transcoded);
+  XmlUtf8Validator validator;
+
+  // Without an index, the tokenizer finds and reports the broken markup
+  if (0 == (options_ & PARSE_STRUCTURAL_INDEX) ||
+      !structural_index->Build(data, size, validate ? &validator : NULL)) {
+    structural_index = NULL;
+    validator.Reset();
+    if (validate)
+      validator.Feed(data + begin, size - begin);
+  }
+
+  bool result = !validate || validator.Finish();
+  if (result) {
+    tokenizer_.Reset(data, size, index, structural_index);
+    result = build(node);
+    index = tokenizer_.index();
+    if (!result)
+      dropOpenSpans(node);
+  }
+
+  // A document spans all it has read, with spans only
+  if (result && spans_ && XmlNode::DOCUMENT == node.type_ && NULL == projection_)
+    setSpan(node, begin, index);
+  // The tree is UTF-8, whatever the content declared
+  if (result && transcoded) {
+    XmlNode * declaration = (XmlNode::DOCUMENT == node.type_) ? node.first_child_ : &node;
+    if (NULL != declaration && XmlNode::DECLARATION == declaration->type_)
+      declaration->SetEncoding("UTF-8");
+  }
+  if (NULL != values_)
+    node.source_ = source_;
+
+  source_.reset();
+  lazy_ = false;
+  spans_ = false;
+  values_ = NULL;
+  ends_ = NULL;
+
+  return result;
+}
+
+bool XmlParser::Read(const std::string & content,
+                     const ParseProjection & projection,
+                     XmlNode & node) {
+  size_t index = 0;
+  projection_ = projection.Empty() ? NULL : &projection;
+  bool result = Read(content.data(), content.size(), index, node);
+  projection_ = NULL;
+
+  return result;
+}
+
+/*
+  The node gets the options of the Read which left it lazy, and is
+  not lazy any more whatever the result.
+*/
+bool XmlParser::Expand(XmlNode & node) {
+  if (!node.lazy_)
+    return true;
+
+  // A node without span does not need the source any more, unless
+  // one of its values or the value pool is there
+  source_ = node.source_;
+  node.lazy_ = false;
+  if (!node.HasRawXml() && !node.hasSlice() && NULL == source_->values)
+    node.source_.reset();
+
+  int options = options_;
+  SetOptions(source_->options);
+  lazy_ = true;
+  spans_ = (0 != (options_ & PARSE_SOURCE_SPANS));
+  values_ = source_->values.get();
+
+  const std::string & content = source_->content;
+  const XmlStructuralIndex & structural_index = source_->index;
+  tokenizer_.Reset(content.data(), content.size(), node.lazy_begin_,
+                   structural_index.Empty() ? NULL : &structural_index);
+  stack_.clear();
+  steps_.clear();
+  text_run_ = NULL;
+  stack_.push_back(&node);
+  steps_.push_back(ParseProjection::WHOLE_SUBTREE);
+  bool result = buildBody(node, XmlNode::DOCUMENT == node.type_);
+  if (!result)
+    dropOpenSpans(node);
+
+  SetOptions(options);
+  source_.reset();
+  lazy_ = false;
+  spans_ = false;
+  values_ = NULL;
+
+  return result;
+}
+
+/*
+  Children are moved to the pool one by one, the stack is borrowed
+  as work list. The node itself keeps its links and its type, only
+  document nodes keep being documents.
+*/
+void XmlParser::Recycle(XmlNode & node) {
+  node.touch();
+  stack_.clear();
+  for (XmlNode * scan = node.first_child_; NULL != scan; scan = scan->next_)
+    stack_.push_back(scan);
+  node.first_child_ = NULL;
+  node.last_child_ = NULL;
+
+  while (!stack_.empty()) {
+    XmlNode * scan = stack_.back();
+    stack_.pop_back();
+
+    for (XmlNode * child = scan->first_child_; NULL != child; child = child->next_)
+      stack_.push_back(child);
+
+    resetNode(*scan);
+    node_pool_.push_back(scan);
+  }
+
+  XmlNode::NodeType type = node.type_;
+  XmlNode * parent = node.parent_;
+  XmlNode * prev = node.prev_;
+  XmlNode * next = node.next_;
+  resetNode(node);
+  node.type_ = (XmlNode::DOCUMENT == type) ? XmlNode::DOCUMENT : XmlNode::ELEMENT;
+  node.parent_ = parent;
+  node.prev_ = prev;
+  node.next_ = next;
+}
+
+void XmlParser::Reset() {
+  for (size_t index = 0; index < node_pool_.size(); ++index)
+    delete node_pool_[index];
+
+  std::vector<XmlNode *>().swap(node_pool_);
+  std::vector<AttributeMap::node_type>().swap(attribute_pool_);
+  std::vector<XmlNode *>().swap(stack_);
+  std::string().swap(name_buffer_);
+  index_ = XmlStructuralIndex();
+}
+
+void XmlParser::SetOptions(int options) {
+  options_ = options;
+  tokenizer_.SetOptions(options);
+}
+
+int XmlParser::options() const {
+  return options_;
+}
+
+size_t XmlParser::NumOfPooledNodes() const {
+  return node_pool_.size();
+}
+
+/////////////////////////////////////////////
+// Private member functions
+
+/*
+  A document takes every top level token as a child. Any other node
+  becomes the first token, and if that is an open tag, everything up
+  to its close tag.
+*/
+bool XmlParser::build(XmlNode & root) {
+  bool is_document = (XmlNode::DOCUMENT == root.type_);
+  XmlToken token;
+
+  stack_.clear();
+  steps_.clear();
+  text_run_ = NULL;
+  if (is_document) {
+    stack_.push_back(&root);
+    steps_.push_back(NULL == projection_ ? ParseProjection::WHOLE_SUBTREE : 0);
+  } else {
+    if (!tokenizer_.Next(token) || XmlNode::CLOSE_TAG == token.flag) {
+      root.type_ = XmlNode::TEXT;
+      return false;
+    }
+
+    fillNode(root, token);
+    if (XmlNode::OPEN_TAG != token.flag) {
+      if (XmlNode::TEXT == token.type) {
+        text_run_ = &root;
+        endTextRun();
+      }
+      return true;
+    }
+
+    // An element off the projection keeps its attributes only.
+    // Above the matched subtrees, elements have no source span.
+    int step = projectedStep(0, token);
+    if (ParseProjection::WHOLE_SUBTREE != step)
+      setSpan(root, 0, 0);
+    if (ParseProjection::NO_MATCH == step)
+      return tokenizer_.SkipElement();
+
+    if (lazy_) {
+      markLazy(root);
+      if (!skipLazy())
+        return false;
+      if (root.HasRawXml())
+        root.span_end_ = tokenizer_.index();
+      return true;
+    }
+
+    stack_.push_back(&root);
+    steps_.push_back(step);
+  }
+
+  return buildBody(root, is_document);
+}
+
+/*
+  Tokens up to the close tag of root, or up to the end for a document.
+  stack_ holds root already. A lazy parse leaves every element it
+  meets lazy and does not go deeper.
+*/
+bool XmlParser::buildBody(XmlNode & root, bool is_document) {
+  XmlToken token;
+
+  while (tokenizer_.Next(token)) {
+    XmlNode * top = stack_.back();
+
+    // Another text right after a text, join them
+    if (XmlNode::TEXT == token.type && NULL != text_run_) {
+      value_buffer_.clear();
+      XmlNode::XmlSpecialCharNormalize(token.value, token.value_size, value_buffer_);
+      text_run_->value_.append(value_buffer_);
+      if (text_run_->HasRawXml())
+        text_run_->span_end_ = token.end;
+      continue;
+    }
+    endTextRun();
+
+    if (XmlNode::CLOSE_TAG == token.flag) {
+      // The document itself has no close tag
+      if (&root == top && is_document)
+        return false;
+
+      const char * begin = token.name;
+      const char * end = token.name + token.name_size;
+      XmlNode::trimRange(begin, end);
+      name_buffer_.clear();
+      XmlNode::XmlSpecialCharNormalize(begin, end - begin, name_buffer_);
+      if (top->value_ != name_buffer_)
+        return false;
+      if (top->HasRawXml())
+        top->span_end_ = token.end;
+
+      int step = steps_.back();
+      stack_.pop_back();
+      steps_.pop_back();
+      if (stack_.empty())
+        return true;
+
+      // A possible ancestor which got no match below it is dropped,
+      // it is still the last child of its parent
+      if (ParseProjection::WHOLE_SUBTREE != step && NULL == top->first_child_) {
+        XmlNode * parent = stack_.back();
+        parent->last_child_ = top->prev_;
+        if (NULL != top->prev_)
+          top->prev_->next_ = NULL;
+        else
+          parent->first_child_ = NULL;
+        resetNode(*top);
+        node_pool_.push_back(top);
+      }
+      continue;
+    }
+
+    // Off the projection, nothing is built. A self closed element
+    // which is not matched has no match below it either.
+    int step = projectedStep(steps_.back(), token);
+    if (ParseProjection::NO_MATCH == step ||
+        (ParseProjection::WHOLE_SUBTREE != step && XmlNode::SELF_CLOSE_TAG == token.flag)) {
+      if (XmlNode::OPEN_TAG == token.flag && !tokenizer_.SkipElement())
+        return false;
+      continue;
+    }
+
+    XmlNode * node = newNode();
+    fillNode(*node, token);
+    appendChild(*top, node);
+    if (ParseProjection::WHOLE_SUBTREE != step)
+      setSpan(*node, 0, 0);
+
+    if (XmlNode::OPEN_TAG == token.flag && lazy_) {
+      markLazy(*node);
+      if (!skipLazy()) {
+        setSpan(*node, 0, 0);
+        return false;
+      }
+      if (node->HasRawXml())
+        node->span_end_ = tokenizer_.index();
+    } else if (XmlNode::OPEN_TAG == token.flag) {
+      stack_.push_back(node);
+      steps_.push_back(step);
+    } else if (XmlNode::TEXT == token.type && 0 != (options_ & PARSE_COALESCE_TEXT)) {
+      text_run_ = node;
+    }
+  }
+  endTextRun();
+
+  // Only a document may end without close tag
+  return !tokenizer_.Failed() && is_document && 1 == stack_.size();
+}
+
+/*
+  Step of a token below an element at parent_step. Inside a matched
+  subtree everything is taken, above it only elements on a path.
+*/
+int XmlParser::projectedStep(int parent_step, const XmlToken & token) const {
+  if (NULL == projection_ || ParseProjection::WHOLE_SUBTREE == parent_step)
+    return ParseProjection::WHOLE_SUBTREE;
+
+  if (XmlNode::ELEMENT != token.type)
+    return ParseProjection::NO_MATCH;
+
+  int step = projection_->next(parent_step, token.name, token.name_size);
+  if (ParseProjection::NO_MATCH != step && projection_->steps_[step].matched)
+    return ParseProjection::WHOLE_SUBTREE;
+
+  return step;
+}
+
+XmlNode * XmlParser::newNode() {
+  if (node_pool_.empty())
+    return new XmlNode(XmlNode::TEXT);
+
+  XmlNode * node = node_pool_.back();
+  node_pool_.pop_back();
+  return node;
+}
+
+/*
+  Values are stored the way set_tag, set_text and SetAttribute store
+  them: trimmed (except attribute values) and encoded.
+*/
+void XmlParser::fillNode(XmlNode & node, const XmlToken & token) {
+  node.type_ = token.type;
+  if (spans_)
+    setSpan(node, token.begin, token.end);
+  // Every node finds the value pool of its document
+  if (NULL != values_)
+    node.source_ = source_;
+
+  const char * begin = token.value;
+  const char * end = token.value + token.value_size;
+
+  switch (token.type) {
+    case XmlNode::TEXT:
+      // A text which may be joined is trimmed by endTextRun
+      if (0 == (options_ & (PARSE_PRESERVE_WHITESPACE | PARSE_COALESCE_TEXT)))
+        XmlNode::trimRange(begin, end);
+      storeValue(node, node.value_, begin, end - begin);
+      break;
+    case XmlNode::COMMENT:
+      XmlNode::trimRange(begin, end);
+      storeValue(node, node.value_, begin, end - begin);
+      break;
+    case XmlNode::DECLARATION:
+      // Defaults of a declaration, overwritten by the given ones
+      addAttribute(node, "version", 7, "1.1", 3);
+      addAttribute(node, "encoding", 8, "UTF-8", 5);
+      fillAttributes(node, begin, end);
+      break;
+    case XmlNode::ELEMENT:
+      storeValue(node, node.value_, token.name, token.name_size);
+      fillAttributes(node, begin, end);
+      break;
+    default:
+      break;
+  }
+}
+
+/*
+  A value of node, its own or an attribute value, goes to stored. A
+  long value which needs no encoding is a slice of the source, if
+  there is one; the node keeps the source then. Other long values are
+  slices of the value pool, if there is one. The rest is copied, into
+  the storage stored already has.
+*/
+void XmlParser::storeValue(XmlNode & node, XmlValue & stored, const char * data, size_t size) {
+  value_buffer_.clear();
+  XmlNode::XmlSpecialCharNormalize(data, size, value_buffer_);
+  if (value_buffer_.size() <= XmlValue::kInlineSize) {
+    stored.assign(value_buffer_);
+  } else if ((lazy_ || spans_) && value_buffer_.size() == size) {
+    stored.slice(data, size);
+    node.source_ = source_;
+  } else if (NULL != values_) {
+    stored.slice(values_->Intern(value_buffer_));
+  } else {
+    stored.assign(value_buffer_);
+  }
+}
+
+void XmlParser::fillAttributes(XmlNode & node, const char * begin, const char * end) {
+  const char * name = NULL;
+  const char * value = NULL;
+  size_t name_size = 0;
+  size_t value_size = 0;
+
+  while (XmlTokenizer::NextAttribute(begin, end, name, name_size, value, value_size))
+    addAttribute(node, name, name_size, value, value_size);
+}
+
+/*
+  Map nodes from the pool are refilled and inserted again, so that
+  a reused element does not allocate for its attributes.
+*/
+void XmlParser::addAttribute(XmlNode & node,
+                             const char * name, size_t name_size,
+                             const char * value, size_t value_size) {
+  if (attribute_pool_.empty()) {
+    name_buffer_.clear();
+    XmlNode::XmlSpecialCharNormalize(name, name_size, name_buffer_);
+    storeValue(node, node.attributes_[name_buffer_], value, value_size);
+    return;
+  }
+
+  AttributeMap::node_type handle = std::move(attribute_pool_.back());
+  attribute_pool_.pop_back();
+  handle.key().clear();
+  XmlNode::XmlSpecialCharNormalize(name, name_size, handle.key());
+  storeValue(node, handle.mapped(), value, value_size);
+
+  // A repeated name, the last value wins
+  AttributeMap::insert_return_type inserted = node.attributes_.insert(std::move(handle));
+  if (!inserted.inserted) {
+    inserted.position->second = inserted.node.mapped();
+    attribute_pool_.push_back(std::move(inserted.node));
+  }
+}
+
+void XmlParser::endTextRun() {
+  if (NULL == text_run_)
+    return;
+
+  if (0 == (options_ & PARSE_PRESERVE_WHITESPACE))
+    trimInPlace(text_run_->value_);
+  if (NULL != values_ && XmlValue::HEAP == text_run_->value_.kind())
+    text_run_->value_.slice(values_->Intern(text_run_->value_));
+  text_run_ = NULL;
+}
+
+/*
+  The body of node starts right behind the open tag just read
+*/
+void XmlParser::markLazy(XmlNode & node) {
+  node.source_ = source_;
+  node.lazy_ = true;
+  node.lazy_begin_ = tokenizer_.index();
+}
+
+/*
+  A Read records where the elements inside end while it skips them,
+  an Expand looks the end up. A body which was not recorded, e.g. of a
+  broken element, is scanned.
+*/
+bool XmlParser::skipLazy() {
+  if (NULL != ends_)
+    return tokenizer_.SkipElement(ends_);
+
+  const std::vector<std::pair<size_t, size_t> > & ends = source_->ends;
+  std::vector<std::pair<size_t, size_t> >::const_iterator found =
+    std::lower_bound(ends.begin(), ends.end(), std::make_pair(tokenizer_.index(), static_cast<size_t>(0)));
+  if (found != ends.end() && found->first == tokenizer_.index() && 0 != found->second) {
+    tokenizer_.Seek(found->second);
+    return true;
+  }
+  return tokenizer_.SkipElement();
+}
+
+/*
+  After a failed parse, the elements which were not closed only span
+  their open tag, they and root get no span
+*/
+void XmlParser::dropOpenSpans(XmlNode & root) {
+  for (size_t index = 0; index < stack_.size(); ++index)
+    setSpan(*stack_[index], 0, 0);
+  setSpan(root, 0, 0);
+}
+
+/*
+  An empty span is no span. The end of an element is set again at
+  its close tag.
+*/
+void XmlParser::setSpan(XmlNode & node, size_t begin, size_t end) {
+  node.span_begin_ = begin;
+  node.span_end_ = end;
+  if (begin != end)
+    node.source_ = source_;
+}
+
+void XmlParser::resetNode(XmlNode & node) {
+  node.type_ = XmlNode::TEXT;
+  node.parent_ = NULL;
+  node.prev_ = NULL;
+  node.next_ = NULL;
+  node.first_child_ = NULL;
+  node.last_child_ = NULL;
+  node.value_.clear();
+  node.source_.reset();
+  node.lazy_ = false;
+  node.span_begin_ = 0;
+  node.span_end_ = 0;
+  node.hash_ = 0;
+
+  while (!node.attributes_.empty())
+    attribute_pool_.push_back(node.attributes_.extract(node.attributes_.begin()));
+}
+
+void XmlParser::appendChild(XmlNode & parent, XmlNode * child) {
+  child->parent_ = &parent;
+  child->prev_ = parent.last_child_;
+  child->next_ = NULL;
+
+  if (NULL != parent.last_child_)
+    parent.last_child_->next_ = child;
+  else
+    parent.first_child_ = child;
+
+  parent.last_child_ = child;
+}
+
+}
@@ -0,0 +1,403 @@
+/*
+SmallXml - Tiny and Simple Xml DOM
+
+www.github.com/theliuy/SmallXml.git
+Author: Yang Liu
+        theliuy.com
+*/
+
+#ifndef SMALLXML_XMLPARSER_H
+#define SMALLXML_XMLPARSER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstddef>
+#include <initializer_list>
+#include <memory>
+#include <utility>
+
+#include "SmallXml.h"
+#include "XmlIndex.h"
+#include "XmlEncoding.h"
+
+namespace SmallXml {
+
+/*
+  Parse options, combined with '|'. They are applied while tokenizing,
+  nodes which are filtered out are never created.
+
+  PARSE_SKIP_COMMENTS          Drop comments
+  PARSE_SKIP_DECLARATIONS      Drop <?xml ...?> declarations
+  PARSE_SKIP_WHITESPACE_TEXT   Drop texts which are only white space
+  PARSE_PRESERVE_WHITESPACE    Keep texts as they are, don't trim them
+  PARSE_COALESCE_TEXT          Join texts which end up next to each
+                               other, for example around a dropped
+                               comment or a CDATA section, into one
+                               node
+  PARSE_LAZY                   Only find where each element ends, its
+                               children are parsed the first time
+                               they are visited, see XmlParser
+  PARSE_STRUCTURAL_INDEX       Index all markup first, then tokenize
+                               along the index. Only pays off when
+                               most of the content is skipped, by a
+                               projection or a lazy read, a full
+                               parse is not faster. See
+                               XmlStructuralIndex
+  PARSE_SOURCE_SPANS           Nodes remember the bytes they were
+                               parsed from, see XmlNode::RawXml
+  PARSE_DEDUP_VALUES           Long tags, texts and attribute values
+                               are kept once per document, in a
+                               XmlValuePool, see XmlNode::ValuePool
+  PARSE_VALIDATE_UTF8          Fail on content which is not valid
+                               UTF-8. With PARSE_STRUCTURAL_INDEX, it
+                               is checked while indexing.
+  PARSE_TRANSCODE              Convert UTF-16 and ISO-8859-1 content
+                               to UTF-8 first, see XmlParser
+
+  PARSE_DEFAULT is what XmlNode::Read does.
+*/
+enum XmlParseOption {
+  PARSE_SKIP_COMMENTS = 1 << 0,
+  PARSE_SKIP_DECLARATIONS = 1 << 1,
+  PARSE_SKIP_WHITESPACE_TEXT = 1 << 2,
+  PARSE_PRESERVE_WHITESPACE = 1 << 3,
+  PARSE_COALESCE_TEXT = 1 << 4,
+  PARSE_LAZY = 1 << 5,
+  PARSE_STRUCTURAL_INDEX = 1 << 6,
+  PARSE_SOURCE_SPANS = 1 << 7,
+  PARSE_DEDUP_VALUES = 1 << 8,
+  PARSE_VALIDATE_UTF8 = 1 << 9,
+  PARSE_TRANSCODE = 1 << 10,
+
+  PARSE_DEFAULT = PARSE_SKIP_WHITESPACE_TEXT
+};
+
+/*
+  A token is one piece of markup or one run of text. It never owns
+  memory, its ranges point into the tokenized content.
+
+  type & flag, as they are used by the parser
+    TEXT, SELF_CLOSE_TAG         value is the raw text (CDATA too)
+    COMMENT, SELF_CLOSE_TAG      value is the raw comment content
+    DECLARATION, SELF_CLOSE_TAG  value is the raw attribute string
+    ELEMENT, OPEN_TAG            name is the tag, value the attributes
+    ELEMENT, SELF_CLOSE_TAG      <tag attributes/>
+    ELEMENT, CLOSE_TAG           name is the tag of </tag>
+
+  begin and end are the offsets of the whole token in the content.
+*/
+struct XmlToken {
+  XmlNode::NodeType type;
+  XmlNode::NodeParseFlag flag;
+
+  const char * name;
+  size_t name_size;
+  const char * value;
+  size_t value_size;
+
+  size_t begin;
+  size_t end;
+};
+
+/*
+  XmlTokenizer splits content into tokens, without allocation.
+  Processing instructions other than <?xml ...?> and <!DOCTYPE ...>
+  are skipped. By default white space between tokens is skipped as
+  well, the comment and white space options of XmlParseOption change
+  what is returned.
+
+  XmlTokenizer tokenizer;
+  tokenizer.Reset(data, size);
+  XmlToken token;
+  while (tokenizer.Next(token)) {
+    ...
+  }
+  if (tokenizer.Failed())
+    ...
+
+  Given a XmlStructuralIndex of the same content, the tokenizer takes
+  the ends of markup from the index instead of scanning for them.
+*/
+class XmlTokenizer {
+ public:
+  explicit XmlTokenizer(int options = PARSE_DEFAULT);
+
+  void Reset(const char * data, size_t size, size_t index = 0,
+             const XmlStructuralIndex * structural_index = NULL);
+  void SetOptions(int options);
+
+  /*
+    Next - Read the next token. Returns false at the end of the
+           content, or on a malformed token. Failed() tells them
+           apart.
+  */
+  bool Next(XmlToken & token);
+  bool Failed() const;
+
+  /*
+    SkipElement - Right after an open tag, move behind its close tag
+                  without returning tokens. It only counts depth,
+                  names of skipped tags are not checked. With ends,
+                  each skipped element, this one first, is appended
+                  to it as a pair of offsets: behind its open tag and
+                  behind its close tag.
+    Seek - Move to index, e.g. behind a close tag found before.
+  */
+  bool SkipElement(std::vector<std::pair<size_t, size_t> > * ends = NULL);
+  void Seek(size_t index);
+
+  // Offset of the first character not consumed yet
+  size_t index() const;
+
+  /*
+    NextAttribute - Read one name="value" pair from an attribute
+                    string and move pos behind it. Returns false
+                    when there is no attribute left.
+  */
+  static bool NextAttribute(const char * & pos, const char * end,
+                            const char * & name, size_t & name_size,
+                            const char * & value, size_t & value_size);
+
+ private:
+  bool fail();
+  // End of the markup starting at start, taken from the index
+  const char * indexedEnd(const char * start);
+  bool skipIndexedElement(std::vector<std::pair<size_t, size_t> > * ends);
+  void openSkipped(std::vector<std::pair<size_t, size_t> > * ends);
+  void closeSkipped(std::vector<std::pair<size_t, size_t> > * ends);
+
+  const char * data_;
+  const char * pos_;
+  const char * end_;
+  bool failed_;
+  int options_;
+
+  // Optional index, and the next markup in it
+  const XmlStructuralIndex * index_;
+  size_t mark_;
+  // Entries of ends for the elements a skip is inside of
+  std::vector<size_t> open_ends_;
+};
+
+/*
+  ParseProjection is a set of absolute paths. Given to a parser, only
+  the elements on those paths are built: the ancestors of matched
+  elements (with their attributes) and the whole subtree of each matched
+  element. Everything else is skipped by a scan which only counts
+  depth.
+
+  The first step of a path names the top level element, "*" matches
+  any tag. A tag matched both by "*" and by name follows both paths.
+
+  XmlNode doc(XmlNode::DOCUMENT);
+  doc.Read(content, ParseProjection{"/catalog/item/price", "/catalog/info"});
+  std::vector<XmlNode *> prices = doc.XPaths("/catalog/item/price");
+*/
+class ParseProjection {
+ public:
+  ParseProjection();
+  ParseProjection(std::initializer_list<std::string> paths);
+
+  void Add(const std::string & path);
+  bool Empty() const;
+
+ private:
+  friend class XmlParser;
+
+  // Step indices used while parsing
+  static const int NO_MATCH = -1;
+  static const int WHOLE_SUBTREE = -2;
+
+  struct Step {
+    std::string tag;
+    bool matched;
+    std::vector<int> children;
+  };
+
+  // Where a path stands: its index in paths_ and the steps taken
+  typedef std::pair<size_t, size_t> Position;
+
+  // Next step from step for tag, or NO_MATCH
+  int next(int step, const char * tag, size_t size) const;
+
+  // Rebuild steps_ from paths_
+  void rebuild();
+  int addStep(const std::string & tag, const std::vector<Position> & positions);
+
+  std::vector<std::vector<std::string> > paths_;
+
+  // steps_[0] is in front of the first tag. A "*" step comes last among
+  // its siblings, and each named sibling follows the "*" paths as well,
+  // so a tag always has at most one next step.
+  std::vector<Step> steps_;
+};
+
+/*
+  Content of a tree read with PARSE_LAZY or PARSE_SOURCE_SPANS, shared
+  by its nodes which are not expanded yet or which keep a source span.
+  The last of them releases it.
+  With PARSE_DEDUP_VALUES, all nodes of the tree share it for values,
+  content is empty unless one of the above is set too.
+*/
+struct XmlSource {
+  std::string content;
+  int options;
+  XmlStructuralIndex index;
+  std::shared_ptr<XmlValuePool> values;
+  // With PARSE_LAZY, where each element ends, as recorded by
+  // XmlTokenizer::SkipElement while reading
+  std::vector<std::pair<size_t, size_t> > ends;
+};
+
+/*
+  XmlParser builds XmlNode trees from strings. Unlike a plain
+  XmlNode::Read, a parser object keeps its parse stack, its scratch
+  buffers and a pool of released nodes across calls. Nodes of the
+  tree being replaced go back to the pool, with their string and
+  attribute storage, and the next parse takes them out again. After
+  a few documents of the same shape, parsing does not allocate at all.
+
+  // One parser per thread, reused for every request
+  XmlParser parser(PARSE_DEFAULT | PARSE_SKIP_COMMENTS);
+  XmlNode node;
+  while (next_request(payload)) {
+    if (parser.Read(payload, node))
+      handle(node);
+  }
+
+  With PARSE_LAZY, Read keeps a copy of the content and builds only
+  the top level. Each element remembers where its body starts, and
+  its closing tag is found by a scan which only counts depth. That
+  scan records where every element inside ends. The children of an
+  element are parsed, one level again, by the first call that visits
+  them: FirstChild, LastChild, NumOfChildren, XPath, ToString... and
+  their own bodies are stepped over by a lookup instead of another
+  scan. All expansions together read the content about twice, and
+  the tree ends up the same as an eagerly read one.
+
+  XmlParser parser(PARSE_DEFAULT | PARSE_LAZY);
+  XmlNode doc(XmlNode::DOCUMENT);
+  parser.Read(huge_content, doc);
+  const XmlNode * id = doc.XPath("/catalog/header/id");
+
+  With PARSE_TRANSCODE, Read finds the encoding of the content by its
+  byte order mark, or by the encoding of its declaration, see
+  DetectEncoding. UTF-16 and ISO-8859-1 content is converted to UTF-8
+  into a buffer of the parser, which is read then; the declaration of
+  the tree says UTF-8, like its nodes. A UTF-8 byte order mark is
+  skipped. Content in other encodings is not read.
+
+  NOTE:
+    A parser is not thread safe. Use one parser per thread.
+    The pooled nodes are released by Reset() or by the destructor.
+    A lazy Read only checks that tags are balanced. Mismatched close
+    tags and broken markup inside an element are found when it is
+    expanded, which gives the children found before the error.
+    Projections are always read eagerly.
+    Converted content is read in one go, from index 0; offsets of
+    source spans are offsets in the UTF-8 content.
+*/
+class XmlParser {
+ public:
+  explicit XmlParser(int options = PARSE_DEFAULT);
+  ~XmlParser();
+
+  // Options for the following Read calls, see XmlParseOption
+  void SetOptions(int options);
+  int options() const;
+
+  /*
+    Read - Same as XmlNode::Read, node is replaced by the parsed
+           content. index is moved behind the last parsed character.
+  */
+  bool Read(const std::string & content, XmlNode & node);
+  bool Read(const std::string & content, int & index, XmlNode & node);
+  bool Read(const char * data, size_t size, size_t & index, XmlNode & node);
+
+  /*
+    Read with a projection, see ParseProjection. Reading a single
+    element which is not on any path gives that element without
+    children.
+  */
+  bool Read(const std::string & content, const ParseProjection & projection, XmlNode & node);
+
+  /*
+    Expand - Parse the children of a lazily read node now. Navigation
+             calls do it by themselves. Returns false if the body of
+             node is malformed.
+  */
+  bool Expand(XmlNode & node);
+
+  /*
+    Recycle - Give a subtree back to the pool. node itself is left
+              an empty element, its children go to the pool.
+    Reset - Release all pooled nodes and scratch buffers.
+  */
+  void Recycle(XmlNode & node);
+  void Reset();
+
+  // Number of pooled nodes, ready for the next parse
+  size_t NumOfPooledNodes() const;
+
+ private:
+  typedef XmlNode::AttributeMap AttributeMap;
+
+  // Not copyable
+  XmlParser(const XmlParser &);
+  XmlParser & operator=(const XmlParser &);
+
+  bool build(XmlNode & root);
+  bool buildBody(XmlNode & root, bool is_document);
+  int projectedStep(int parent_step, const XmlToken & token) const;
+  XmlNode * newNode();
+  void fillNode(XmlNode & node, const XmlToken & token);
+  void storeValue(XmlNode & node, XmlValue & stored, const char * data, size_t size);
+  void fillAttributes(XmlNode & node, const char * begin, const char * end);
+  void addAttribute(XmlNode & node,
+                    const char * name, size_t name_size,
+                    const char * value, size_t value_size);
+  void resetNode(XmlNode & node);
+  void appendChild(XmlNode & parent, XmlNode * child);
+  void endTextRun();
+  void markLazy(XmlNode & node);
+  bool skipLazy();
+  void setSpan(XmlNode & node, size_t begin, size_t end);
+  void dropOpenSpans(XmlNode & root);
+
+  XmlTokenizer tokenizer_;
+  int options_;
+
+  // Text node still taking text, with PARSE_COALESCE_TEXT
+  XmlNode * text_run_;
+
+  // Open elements, the root at the bottom
+  std::vector<XmlNode *> stack_;
+  // Projection step of each open element
+  std::vector<int> steps_;
+  const ParseProjection * projection_;
+  // Index of the content, with PARSE_STRUCTURAL_INDEX
+  XmlStructuralIndex index_;
+  // Copy of the content for lazy nodes and source spans, and what
+  // the Read or Expand going on does with it. The value pool of
+  // source_, with PARSE_DEDUP_VALUES.
+  std::shared_ptr<const XmlSource> source_;
+  bool lazy_;
+  bool spans_;
+  XmlValuePool * values_;
+  // Ends of source_ while a lazy Read records them
+  std::vector<std::pair<size_t, size_t> > * ends_;
+  // Scratch buffers for close tags and attribute names, for node
+  // values before they are stored, and for converted content
+  std::string name_buffer_;
+  std::string value_buffer_;
+  std::string transcode_buffer_;
+
+  // Released nodes and attribute map nodes
+  std::vector<XmlNode *> node_pool_;
+  std::vector<AttributeMap::node_type> attribute_pool_;
+};
+
+}
+
+#endif
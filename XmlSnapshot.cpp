@@ -0,0 +1,758 @@
+#include "XmlSnapshot.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <map>
+#include <vector>
+#include <utility>
+#include <functional>
+#include <atomic>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace SmallXml {
+
+namespace {
+
+const char kSnapshotMagic[8] = {'S', 'X', 'M', 'L', 'S', 'N', 'A', 'P'};
+const uint32_t kSnapshotVersion = 1;
+const uint32_t kByteOrderMark = 0x01020304u;
+
+/*
+  Round a size up to the next multiple of 8
+*/
+uint64_t align8(uint64_t size) {
+  return (size + 7) & ~static_cast<uint64_t>(7);
+}
+
+/*
+  StringTable collects strings while saving. Tags and attribute
+  names repeat a lot, they are stored once. Texts and values are
+  appended as they are.
+*/
+class StringTable {
+ public:
+  uint64_t Add(std::string_view str) {
+    uint64_t offset = data_.size();
+    data_.append(str);
+    data_.push_back('\0');
+    return offset;
+  }
+
+  uint64_t AddShared(std::string_view str) {
+    std::map<std::string, uint64_t, std::less<> >::const_iterator it = shared_.find(str);
+    if (it != shared_.end())
+      return it->second;
+
+    uint64_t offset = Add(str);
+    shared_.emplace(str, offset);
+    return offset;
+  }
+
+  const std::string & data() const {
+    return data_;
+  }
+
+ private:
+  std::string data_;
+  std::map<std::string, uint64_t, std::less<> > shared_;
+};
+
+bool writeAll(FILE * file, const void * data, size_t size) {
+  if (0 == size)
+    return true;
+  return size == fwrite(data, 1, size, file);
+}
+
+/*
+  Same as XmlNode::showIndent, appending in place
+*/
+void appendIndent(std::string & str, int indent) {
+  if (indent > 0)
+    str.append(2 * indent, ' ');
+}
+
+bool writePadding(FILE * file, uint64_t written) {
+  static const char zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  return writeAll(file, zeros, align8(written) - written);
+}
+
+/*
+  A string and its NUL lie inside a string table of size bytes
+*/
+bool hasString(const char * strings, uint64_t size, uint64_t offset, uint32_t str_size) {
+  return offset < size && str_size < size - offset && '\0' == strings[offset + str_size];
+}
+
+}
+
+const uint32_t XmlSnapshot::NPOS;
+
+/////////////////////////////////////////////
+// XmlSnapshot::Node
+
+XmlSnapshot::Node::Node()
+  : snapshot_(NULL), index_(NPOS) {
+}
+
+XmlSnapshot::Node::Node(const XmlSnapshot * snapshot, uint32_t index)
+  : snapshot_(snapshot), index_(index) {
+  if (NPOS == index_)
+    snapshot_ = NULL;
+}
+
+const XmlSnapshot::NodeRecord & XmlSnapshot::Node::record() const {
+  return snapshot_->nodes_[index_];
+}
+
+bool XmlSnapshot::Node::IsNull() const {
+  return NULL == snapshot_;
+}
+
+int XmlSnapshot::Node::type() const {
+  if (IsNull())
+    return XmlNode::UNKNOWN;
+  return record().type;
+}
+
+std::string XmlSnapshot::Node::tag() const {
+  return std::string(tag_data(), tag_size());
+}
+
+std::string XmlSnapshot::Node::text() const {
+  return std::string(text_data(), text_size());
+}
+
+const char * XmlSnapshot::Node::tag_data() const {
+  if (IsNull())
+    return "";
+  return snapshot_->string_at(record().tag_offset);
+}
+
+size_t XmlSnapshot::Node::tag_size() const {
+  if (IsNull())
+    return 0;
+  return record().tag_size;
+}
+
+const char * XmlSnapshot::Node::text_data() const {
+  if (IsNull())
+    return "";
+  return snapshot_->string_at(record().text_offset);
+}
+
+size_t XmlSnapshot::Node::text_size() const {
+  if (IsNull())
+    return 0;
+  return record().text_size;
+}
+
+XmlSnapshot::Node XmlSnapshot::Node::Parent() const {
+  if (IsNull())
+    return Node();
+  return Node(snapshot_, record().parent);
+}
+
+XmlSnapshot::Node XmlSnapshot::Node::FirstChild() const {
+  if (IsNull())
+    return Node();
+  return Node(snapshot_, record().first_child);
+}
+
+XmlSnapshot::Node XmlSnapshot::Node::LastChild() const {
+  if (IsNull())
+    return Node();
+  return Node(snapshot_, record().last_child);
+}
+
+XmlSnapshot::Node XmlSnapshot::Node::PreviousSibling() const {
+  if (IsNull())
+    return Node();
+  return Node(snapshot_, record().prev);
+}
+
+XmlSnapshot::Node XmlSnapshot::Node::NextSibling() const {
+  if (IsNull())
+    return Node();
+  return Node(snapshot_, record().next);
+}
+
+XmlSnapshot::Node XmlSnapshot::Node::NextElement(const std::string & tag) const {
+  for (Node scan = NextSibling(); !scan.IsNull(); scan = scan.NextSibling()) {
+    if (XmlNode::ELEMENT == scan.type() &&
+        scan.tag_size() == tag.size() &&
+        0 == memcmp(scan.tag_data(), tag.data(), tag.size())) {
+      return scan;
+    }
+  }
+
+  return Node();
+}
+
+int XmlSnapshot::Node::NumOfChildren() const {
+  int num = 0;
+  for (Node scan = FirstChild(); !scan.IsNull(); scan = scan.NextSibling())
+    ++num;
+
+  return num;
+}
+
+bool XmlSnapshot::Node::HasChild() const {
+  return !FirstChild().IsNull();
+}
+
+int XmlSnapshot::Node::NumOfAttributes() const {
+  if (IsNull())
+    return 0;
+  return record().attribute_count;
+}
+
+std::string XmlSnapshot::Node::AttributeName(int index) const {
+  if (0 > index || index >= NumOfAttributes())
+    return "";
+
+  const AttributeRecord & attr =
+    snapshot_->attributes_[record().attribute_begin + index];
+  return std::string(snapshot_->string_at(attr.name_offset), attr.name_size);
+}
+
+std::string XmlSnapshot::Node::AttributeValue(int index) const {
+  if (0 > index || index >= NumOfAttributes())
+    return "";
+
+  const AttributeRecord & attr =
+    snapshot_->attributes_[record().attribute_begin + index];
+  return std::string(snapshot_->string_at(attr.value_offset), attr.value_size);
+}
+
+/*
+  Same contract as XmlNode::GetAttribute, the name is encoded
+  before lookup and the value is decoded.
+  Attributes are saved in map order, so a binary search works.
+*/
+std::string XmlSnapshot::Node::GetAttribute(const std::string & name) const {
+  if (IsNull())
+    return "";
+  if (XmlNode::ELEMENT != type() && XmlNode::DECLARATION != type())
+    return "";
+
+  std::string encoded_name = XmlNode::XmlSpecialCharEncode(name);
+  const AttributeRecord * begin =
+    snapshot_->attributes_ + record().attribute_begin;
+  int low = 0;
+  int high = record().attribute_count;
+
+  while (low < high) {
+    int mid = low + (high - low) / 2;
+    std::string mid_name(snapshot_->string_at(begin[mid].name_offset),
+                         begin[mid].name_size);
+    int compared = mid_name.compare(encoded_name);
+    if (0 == compared) {
+      return XmlNode::XmlSpecialCharDecode(
+        std::string(snapshot_->string_at(begin[mid].value_offset),
+                    begin[mid].value_size));
+    }
+    if (compared < 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  return "";
+}
+
+/*
+  Mirrors XmlNode::ToStringAs* for every type. An explicit stack of
+  frames replaces the recursion, so deep snapshots are fine.
+*/
+std::string XmlSnapshot::Node::ToString(int indent) const {
+  std::string result = "";
+  if (IsNull())
+    return result;
+
+  struct Frame {
+    Node node;
+    int indent;
+    bool opened;
+  };
+
+  std::vector<Frame> stack;
+  Frame root = {*this, indent, false};
+  stack.push_back(root);
+
+  while (!stack.empty()) {
+    Frame & frame = stack.back();
+    Node scan = frame.node;
+    int scan_indent = frame.indent;
+    std::string new_line_sep = (-1 == scan_indent) ? "" : "\n";
+
+    // Second visit of a container, close it
+    if (frame.opened) {
+      stack.pop_back();
+      if (XmlNode::ELEMENT == scan.type()) {
+        appendIndent(result, scan_indent);
+        result += "</";
+        result.append(scan.tag_data(), scan.tag_size());
+        result += ">" + new_line_sep;
+      }
+      continue;
+    }
+
+    frame.opened = true;
+    switch (scan.type()) {
+      case XmlNode::ELEMENT:
+        appendIndent(result, scan_indent);
+        result += "<";
+        result.append(scan.tag_data(), scan.tag_size());
+        for (int index = 0; index < scan.NumOfAttributes(); ++index) {
+          result += " " + scan.AttributeName(index) + "=\"" +
+                    scan.AttributeValue(index) + "\"";
+        }
+        result += ">" + new_line_sep;
+        break;
+      case XmlNode::COMMENT:
+        appendIndent(result, scan_indent);
+        result += "<!-- " + scan.text() + " -->" + new_line_sep;
+        break;
+      case XmlNode::DECLARATION: {
+        std::string version_str = scan.GetAttribute("version");
+        version_str = version_str.empty() ? "" : " version=\"" + version_str + "\"";
+        std::string encoding_str = scan.GetAttribute("encoding");
+        encoding_str = encoding_str.empty() ? "" : " encoding=\"" + encoding_str + "\"";
+        result += "<?xml" + version_str + encoding_str + "?>" + new_line_sep;
+        break;
+      }
+      case XmlNode::TEXT:
+        if (0 != scan.text_size()) {
+          appendIndent(result, scan_indent);
+          result.append(scan.text_data(), scan.text_size());
+        }
+        result += new_line_sep;
+        break;
+      case XmlNode::UNKNOWN:
+        if (0 != scan.text_size()) {
+          appendIndent(result, scan_indent);
+          result.append(scan.text_data(), scan.text_size());
+        }
+        result += "\n";
+        break;
+      case XmlNode::DOCUMENT:
+        break;
+    }
+
+    if (XmlNode::ELEMENT != scan.type() && XmlNode::DOCUMENT != scan.type()) {
+      stack.pop_back();
+      continue;
+    }
+
+    // Children of an element are indented one more level,
+    // children of a document are not.
+    int child_indent = scan_indent;
+    if (XmlNode::ELEMENT == scan.type())
+      child_indent = (-1 == scan_indent) ? -1 : scan_indent + 1;
+
+    // Push in reverse order, to pop them in document order
+    for (Node child = scan.LastChild(); !child.IsNull(); child = child.PreviousSibling()) {
+      Frame child_frame = {child, child_indent, false};
+      stack.push_back(child_frame);
+    }
+  }
+
+  return result;
+}
+
+/*
+  Rebuild a XmlNode. The strings are copied as stored, they are
+  already encoded, thus set_text/set_tag are not used here.
+*/
+void XmlSnapshot::Node::ToXmlNode(XmlNode & node) const {
+  node.Clear();
+  if (IsNull())
+    return;
+
+  // Pairs of (snapshot node, its copy)
+  std::vector<std::pair<Node, XmlNode *> > stack;
+  stack.push_back(std::make_pair(*this, &node));
+
+  while (!stack.empty()) {
+    Node from = stack.back().first;
+    XmlNode * to = stack.back().second;
+    stack.pop_back();
+
+    to->type_ = static_cast<XmlNode::NodeType>(from.type());
+    if (XmlNode::ELEMENT == to->type_)
+      to->value_.assign(from.tag_data(), from.tag_size());
+    else
+      to->value_.assign(from.text_data(), from.text_size());
+    for (int index = 0; index < from.NumOfAttributes(); ++index)
+      to->attributes_[from.AttributeName(index)].assign(from.AttributeValue(index));
+
+    // Children are linked here and filled when they are popped
+    for (Node child = from.FirstChild(); !child.IsNull(); child = child.NextSibling()) {
+      XmlNode * p_child = new XmlNode(XmlNode::TEXT);
+      p_child->parent_ = to;
+      p_child->prev_ = to->last_child_;
+      if (NULL != to->last_child_)
+        to->last_child_->next_ = p_child;
+      else
+        to->first_child_ = p_child;
+      to->last_child_ = p_child;
+      stack.push_back(std::make_pair(child, p_child));
+    }
+  }
+}
+
+/////////////////////////////////////////////
+// XmlSnapshot
+
+XmlSnapshot::XmlSnapshot()
+  : data_(NULL), size_(0), mapped_(false),
+    header_(NULL), nodes_(NULL), attributes_(NULL), strings_(NULL) {
+}
+
+XmlSnapshot::~XmlSnapshot() {
+  Unload();
+}
+
+bool XmlSnapshot::SaveSnapshot(const XmlNode & node, const std::string & filename) {
+  std::vector<NodeRecord> nodes;
+  std::vector<AttributeRecord> attributes;
+  StringTable strings;
+
+  // Preorder walk. Pairs of (node, index of its parent record)
+  std::vector<std::pair<const XmlNode *, uint32_t> > stack;
+  stack.push_back(std::make_pair(&node, NPOS));
+
+  while (!stack.empty()) {
+    const XmlNode * scan = stack.back().first;
+    uint32_t parent = stack.back().second;
+    stack.pop_back();
+
+    uint32_t index = static_cast<uint32_t>(nodes.size());
+    NodeRecord record;
+    record.type = scan->type_;
+    record.parent = parent;
+    record.first_child = NPOS;
+    record.last_child = NPOS;
+    record.prev = NPOS;
+    record.next = NPOS;
+    // The value is the tag of an element, the text of other nodes
+    std::string_view tag = (XmlNode::ELEMENT == scan->type_) ? scan->value_.view() : std::string_view();
+    std::string_view text = (XmlNode::ELEMENT == scan->type_) ? std::string_view() : scan->value_.view();
+    record.tag_offset = strings.AddShared(tag);
+    record.tag_size = static_cast<uint32_t>(tag.size());
+    record.text_offset = strings.Add(text);
+    record.text_size = static_cast<uint32_t>(text.size());
+    record.attribute_begin = static_cast<uint32_t>(attributes.size());
+    record.attribute_count = static_cast<uint32_t>(scan->attributes_.size());
+
+    for (XmlNode::AttributeMap::const_iterator it = scan->attributes_.begin();
+         it != scan->attributes_.end();
+         ++it) {
+      AttributeRecord attr;
+      attr.name_offset = strings.AddShared(it->first);
+      attr.name_size = static_cast<uint32_t>(it->first.size());
+      attr.value_offset = strings.Add(it->second);
+      attr.value_size = static_cast<uint32_t>(it->second.size());
+      attributes.push_back(attr);
+    }
+
+    // Link with the parent and the previous sibling
+    if (NPOS != parent) {
+      NodeRecord & parent_record = nodes[parent];
+      record.prev = parent_record.last_child;
+      if (NPOS != record.prev)
+        nodes[record.prev].next = index;
+      else
+        parent_record.first_child = index;
+      parent_record.last_child = index;
+    }
+    nodes.push_back(record);
+
+    // Push children in reverse order, to pop them in document order
+    scan->expand();
+    for (const XmlNode * child = scan->last_child_; NULL != child; child = child->prev_)
+      stack.push_back(std::make_pair(child, index));
+  }
+
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+  header.version = kSnapshotVersion;
+  header.byte_order = kByteOrderMark;
+  header.node_count = static_cast<uint32_t>(nodes.size());
+  header.attribute_count = static_cast<uint32_t>(attributes.size());
+  header.nodes_offset = align8(sizeof(Header));
+  header.attributes_offset =
+    header.nodes_offset + align8(nodes.size() * sizeof(NodeRecord));
+  header.strings_offset =
+    header.attributes_offset + align8(attributes.size() * sizeof(AttributeRecord));
+  header.strings_size = strings.data().size();
+
+  // Written aside and renamed over filename at the end. A reader which
+  // has the old file mapped keeps seeing it, and nobody maps half a file.
+  static std::atomic<unsigned int> num_of_saves(0);
+  char suffix[64];
+#ifndef _WIN32
+  snprintf(suffix, sizeof(suffix), ".%ld.%u.tmp",
+           static_cast<long>(getpid()), num_of_saves.fetch_add(1));
+  std::string temp_name = filename + suffix;
+  int fd = open(temp_name.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+  FILE * file = (0 > fd) ? NULL : fdopen(fd, "wb");
+  if (NULL == file) {
+    if (0 <= fd) {
+      close(fd);
+      remove(temp_name.c_str());
+    }
+    return false;
+  }
+#else
+  snprintf(suffix, sizeof(suffix), ".%u.tmp", num_of_saves.fetch_add(1));
+  std::string temp_name = filename + suffix;
+  FILE * file = fopen(temp_name.c_str(), "wb");
+  if (NULL == file)
+    return false;
+#endif
+
+  bool ok = writeAll(file, &header, sizeof(header)) &&
+            writePadding(file, sizeof(header)) &&
+            writeAll(file, nodes.empty() ? NULL : &nodes[0],
+                     nodes.size() * sizeof(NodeRecord)) &&
+            writePadding(file, nodes.size() * sizeof(NodeRecord)) &&
+            writeAll(file, attributes.empty() ? NULL : &attributes[0],
+                     attributes.size() * sizeof(AttributeRecord)) &&
+            writePadding(file, attributes.size() * sizeof(AttributeRecord)) &&
+            writeAll(file, strings.data().data(), strings.data().size());
+
+  if (0 != fclose(file))
+    ok = false;
+
+#ifdef _WIN32
+  // rename does not replace an existing file here
+  if (ok)
+    remove(filename.c_str());
+#endif
+  if (!ok || 0 != rename(temp_name.c_str(), filename.c_str())) {
+    remove(temp_name.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+bool XmlSnapshot::LoadSnapshot(const std::string & filename) {
+  Unload();
+
+#ifndef _WIN32
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (0 > fd)
+    return false;
+
+  struct stat info;
+  if (0 != fstat(fd, &info) || 0 >= info.st_size) {
+    close(fd);
+    return false;
+  }
+
+  void * mapping = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (MAP_FAILED == mapping)
+    return false;
+
+  data_ = static_cast<const char *>(mapping);
+  size_ = info.st_size;
+  mapped_ = true;
+#else
+  // No mmap here, fall back to reading the file into memory
+  FILE * file = fopen(filename.c_str(), "rb");
+  if (NULL == file)
+    return false;
+
+  fseek(file, 0, SEEK_END);
+  long file_size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if (0 >= file_size) {
+    fclose(file);
+    return false;
+  }
+
+  char * buffer = static_cast<char *>(malloc(file_size));
+  if (NULL == buffer ||
+      static_cast<size_t>(file_size) != fread(buffer, 1, file_size, file)) {
+    free(buffer);
+    fclose(file);
+    return false;
+  }
+  fclose(file);
+
+  data_ = buffer;
+  size_ = file_size;
+  mapped_ = false;
+#endif
+
+  if (!validate()) {
+    Unload();
+    return false;
+  }
+
+  header_ = reinterpret_cast<const Header *>(data_);
+  nodes_ = reinterpret_cast<const NodeRecord *>(data_ + header_->nodes_offset);
+  attributes_ = reinterpret_cast<const AttributeRecord *>(data_ + header_->attributes_offset);
+  strings_ = data_ + header_->strings_offset;
+  return true;
+}
+
+void XmlSnapshot::Unload() {
+  if (NULL != data_) {
+#ifndef _WIN32
+    if (mapped_)
+      munmap(const_cast<char *>(data_), size_);
+    else
+      free(const_cast<char *>(data_));
+#else
+    free(const_cast<char *>(data_));
+#endif
+  }
+
+  data_ = NULL;
+  size_ = 0;
+  mapped_ = false;
+  header_ = NULL;
+  nodes_ = NULL;
+  attributes_ = NULL;
+  strings_ = NULL;
+}
+
+bool XmlSnapshot::IsLoaded() const {
+  return NULL != header_;
+}
+
+XmlSnapshot::Node XmlSnapshot::Root() const {
+  if (!IsLoaded() || 0 == header_->node_count)
+    return Node();
+  return Node(this, 0);
+}
+
+uint32_t XmlSnapshot::NumOfNodes() const {
+  if (!IsLoaded())
+    return 0;
+  return header_->node_count;
+}
+
+/*
+  Nothing read from a loaded file is checked again, so everything is
+  checked here once: the header, that every section lies inside the
+  file, every string and attribute range, and every link.
+
+  Links have to describe the preorder the writer used: a first child
+  comes right after its parent, a parent and a previous sibling come
+  before a node, a next sibling after it, and both ends of each link
+  agree. Following links one way always ends then, there is no cycle
+  for a damaged file to hang on.
+*/
+bool XmlSnapshot::validate() const {
+  if (size_ < sizeof(Header))
+    return false;
+
+  const Header * header = reinterpret_cast<const Header *>(data_);
+  if (0 != memcmp(header->magic, kSnapshotMagic, sizeof(header->magic)) ||
+      kSnapshotVersion != header->version ||
+      kByteOrderMark != header->byte_order) {
+    return false;
+  }
+
+  // Each section starts behind the one before, and sizes are compared
+  // with what is left, so nothing can overflow
+  if (0 != header->nodes_offset % 8 ||
+      0 != header->attributes_offset % 8 ||
+      header->nodes_offset < sizeof(Header) ||
+      header->attributes_offset < header->nodes_offset ||
+      header->strings_offset < header->attributes_offset ||
+      header->strings_offset > size_ ||
+      header->strings_size > size_ - header->strings_offset ||
+      header->node_count > (header->attributes_offset - header->nodes_offset) / sizeof(NodeRecord) ||
+      header->attribute_count > (header->strings_offset - header->attributes_offset) / sizeof(AttributeRecord)) {
+    return false;
+  }
+
+  const NodeRecord * nodes = reinterpret_cast<const NodeRecord *>(data_ + header->nodes_offset);
+  const AttributeRecord * attributes =
+    reinterpret_cast<const AttributeRecord *>(data_ + header->attributes_offset);
+  const char * strings = data_ + header->strings_offset;
+  uint64_t strings_size = header->strings_size;
+  uint32_t node_count = header->node_count;
+
+  for (uint32_t index = 0; index < header->attribute_count; ++index) {
+    if (!hasString(strings, strings_size,
+                   attributes[index].name_offset, attributes[index].name_size) ||
+        !hasString(strings, strings_size,
+                   attributes[index].value_offset, attributes[index].value_size)) {
+      return false;
+    }
+  }
+
+  for (uint32_t index = 0; index < node_count; ++index) {
+    const NodeRecord & record = nodes[index];
+    if (record.type > XmlNode::DOCUMENT ||
+        !hasString(strings, strings_size, record.tag_offset, record.tag_size) ||
+        !hasString(strings, strings_size, record.text_offset, record.text_size) ||
+        record.attribute_begin > header->attribute_count ||
+        record.attribute_count > header->attribute_count - record.attribute_begin) {
+      return false;
+    }
+
+    // Only the root has no parent, and it has no siblings
+    if (0 == index) {
+      if (NPOS != record.parent || NPOS != record.prev || NPOS != record.next)
+        return false;
+    } else if (record.parent >= index) {
+      return false;
+    }
+
+    if (NPOS == record.first_child) {
+      if (NPOS != record.last_child)
+        return false;
+    } else if (record.first_child != index + 1 ||
+               record.first_child >= node_count ||
+               record.last_child >= node_count ||
+               record.last_child < record.first_child ||
+               nodes[record.first_child].parent != index ||
+               nodes[record.first_child].prev != NPOS ||
+               nodes[record.last_child].parent != index ||
+               nodes[record.last_child].next != NPOS) {
+      return false;
+    }
+
+    if (NPOS != record.next &&
+        (record.next <= index || record.next >= node_count ||
+         nodes[record.next].prev != index || nodes[record.next].parent != record.parent)) {
+      return false;
+    }
+
+    if (NPOS != record.prev &&
+        (record.prev >= index || nodes[record.prev].next != index)) {
+      return false;
+    }
+
+    // The ends of a sibling list are where the parent says they are
+    if (0 != index &&
+        ((NPOS == record.prev && nodes[record.parent].first_child != index) ||
+         (NPOS == record.next && nodes[record.parent].last_child != index))) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+const char * XmlSnapshot::string_at(uint64_t offset) const {
+  return strings_ + offset;
+}
+
+}
@@ -0,0 +1,204 @@
+/*
+SmallXml - Tiny and Simple Xml DOM
+
+www.github.com/theliuy/SmallXml.git
+Author: Yang Liu
+        theliuy.com
+*/
+
+#ifndef SMALLXML_XMLSNAPSHOT_H
+#define SMALLXML_XMLSNAPSHOT_H
+
+#include <string>
+#include <cstddef>
+#include <stdint.h>
+
+#include "SmallXml.h"
+
+namespace SmallXml {
+
+/*
+  Binary snapshot of a parsed DOM tree.
+
+  A snapshot file is laid out as
+
+    [header][node records][attribute records][string table]
+
+  Node records are stored in document (preorder) order and refer to
+  each other by index. Tags, texts and attribute names and values are
+  (offset, size) pairs into the string table. Nothing in the file is a
+  pointer, so it can be mapped at any address and navigated in place,
+  and several processes mapping the same file share its pages through
+  the page cache.
+
+  // Write a tree once
+  XmlSnapshot::SaveSnapshot(doc, "reference.sxs");
+
+  // Map it on every start, no parsing
+  XmlSnapshot snapshot;
+  if (snapshot.LoadSnapshot("reference.sxs")) {
+    XmlSnapshot::Node root = snapshot.Root();
+    for (XmlSnapshot::Node scan = root.FirstChild();
+         !scan.IsNull();
+         scan = scan.NextSibling()) {
+      ...
+    }
+  }
+
+  NOTE:
+    Strings are kept exactly as the XmlNode stored them, that is,
+    encoded. ToString of any node returns the same string as ToString
+    of the XmlNode it was saved from.
+    The file uses the byte order of the machine that wrote it, a
+    snapshot written on a different byte order fails to load.
+*/
+
+class XmlSnapshot {
+ public:
+  // Index used for "no such node"
+  static const uint32_t NPOS = 0xFFFFFFFFu;
+
+  /*
+    Records in the mapped file. All of them are 8 bytes aligned.
+  */
+  struct Header {
+    char magic[8];              // "SXMLSNAP"
+    uint32_t version;           // Format version
+    uint32_t byte_order;        // 0x01020304 in writer's byte order
+    uint32_t node_count;
+    uint32_t attribute_count;
+    uint64_t nodes_offset;      // From the start of the file
+    uint64_t attributes_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+  };
+
+  struct NodeRecord {
+    uint32_t type;              // XmlNode::NodeType
+    uint32_t parent;
+    uint32_t first_child;
+    uint32_t last_child;
+    uint32_t prev;
+    uint32_t next;
+    uint32_t attribute_begin;
+    uint32_t attribute_count;
+    uint64_t tag_offset;
+    uint64_t text_offset;
+    uint32_t tag_size;
+    uint32_t text_size;
+  };
+
+  struct AttributeRecord {
+    uint64_t name_offset;
+    uint64_t value_offset;
+    uint32_t name_size;
+    uint32_t value_size;
+  };
+
+  /*
+    A light-weight handle to a node inside a loaded snapshot. It is
+    only valid while the snapshot it came from stays loaded.
+    Copying a Node copies two words.
+  */
+  class Node {
+   public:
+    Node();
+
+    bool IsNull() const;
+    int type() const;
+
+    // Copies, same as XmlNode::tag() and XmlNode::text()
+    std::string tag() const;
+    std::string text() const;
+
+    // Zero-copy access into the mapped string table.
+    // The strings are NUL terminated.
+    const char * tag_data() const;
+    size_t tag_size() const;
+    const char * text_data() const;
+    size_t text_size() const;
+
+    Node Parent() const;
+    Node FirstChild() const;
+    Node LastChild() const;
+    Node PreviousSibling() const;
+    Node NextSibling() const;
+    Node NextElement(const std::string & tag) const;
+
+    int NumOfChildren() const;
+    bool HasChild() const;
+
+    // Attributes, in the same order as XmlNode::GetAttributes()
+    int NumOfAttributes() const;
+    std::string AttributeName(int index) const;
+    std::string AttributeValue(int index) const;
+    std::string GetAttribute(const std::string & name) const;
+
+    /*
+      Same output as XmlNode::ToString(indent) of the saved node.
+    */
+    std::string ToString(int indent = 0) const;
+
+    /*
+      Materialize this node and its subtree as a normal XmlNode.
+    */
+    void ToXmlNode(XmlNode & node) const;
+
+   private:
+    friend class XmlSnapshot;
+    Node(const XmlSnapshot * snapshot, uint32_t index);
+
+    const NodeRecord & record() const;
+
+    const XmlSnapshot * snapshot_;
+    uint32_t index_;
+  };
+
+  XmlSnapshot();
+  ~XmlSnapshot();
+
+  /*
+    SaveSnapshot - Write node and its subtree to filename. It is
+                   written to a new file next to it first, which then
+                   replaces filename, so snapshots loaded from the old
+                   file stay as they are.
+    LoadSnapshot - Map filename read-only. Any previously loaded
+                   snapshot is released first.
+    Unload - Release the mapping. Node handles become invalid.
+
+    All of them return false on I/O failure or, for LoadSnapshot,
+    when the file is not a valid snapshot. Every record is checked
+    while loading, a damaged file fails to load rather than being
+    read out of bounds later. The text itself is not checked.
+  */
+  static bool SaveSnapshot(const XmlNode & node, const std::string & filename);
+  bool LoadSnapshot(const std::string & filename);
+  void Unload();
+
+  bool IsLoaded() const;
+  Node Root() const;
+  uint32_t NumOfNodes() const;
+
+ private:
+  // Not copyable, it owns the mapping
+  XmlSnapshot(const XmlSnapshot &);
+  XmlSnapshot & operator=(const XmlSnapshot &);
+
+  bool validate() const;
+  const char * string_at(uint64_t offset) const;
+
+  // The mapped (or, without mmap, read) file
+  const char * data_;
+  size_t size_;
+  bool mapped_;
+
+  // Views into data_
+  const Header * header_;
+  const NodeRecord * nodes_;
+  const AttributeRecord * attributes_;
+  const char * strings_;
+};
+
+}
+
+#endif
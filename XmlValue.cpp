@@ -0,0 +1,213 @@
+#include "XmlValue.h"
+
+#include <cstring>
+
+namespace SmallXml {
+
+XmlValue::XmlValue() : inline_() {
+}
+
+XmlValue::XmlValue(const char * data, size_t size) : inline_() {
+  assign(data, size);
+}
+
+XmlValue::XmlValue(std::string_view str) : inline_() {
+  assign(str.data(), str.size());
+}
+
+XmlValue::XmlValue(const XmlValue & value) : inline_() {
+  if (kSlice == value.meta())
+    slice(value.slice_.data, value.slice_.size);
+  else
+    assign(value.data(), value.size());
+}
+
+XmlValue & XmlValue::operator=(const XmlValue & value) {
+  if (this == &value)
+    return *this;
+
+  if (kSlice == value.meta())
+    slice(value.slice_.data, value.slice_.size);
+  else
+    assign(value.data(), value.size());
+  return *this;
+}
+
+XmlValue::~XmlValue() {
+  release();
+}
+
+/*
+  A block which is big enough is reused, even for a short value.
+  Otherwise a short value goes inline, and a long one to a new block;
+  data can not be inside the old one then, it is too small.
+*/
+void XmlValue::assign(const char * data, size_t size) {
+  if (kHeap == meta() && size <= heap_.capacity) {
+    memmove(heap_.data, data, size);
+    heap_.data[size] = '\0';
+    heap_.size = size;
+    return;
+  }
+
+  if (size <= kInlineSize) {
+    release();
+    memmove(inline_, data, size);
+    inline_[size] = '\0';
+    set_meta(static_cast<unsigned char>(size));
+    return;
+  }
+
+  char * block = new char[size + 1];
+  memcpy(block, data, size);
+  block[size] = '\0';
+  release();
+  heap_.data = block;
+  heap_.size = size;
+  heap_.capacity = size;
+  set_meta(kHeap);
+}
+
+void XmlValue::append(const char * data, size_t size) {
+  if (0 == size)
+    return;
+
+  size_t old_size = this->size();
+  size_t new_size = old_size + size;
+  // A short heap value stays in its block
+  if (INLINE == kind() && new_size <= kInlineSize) {
+    memcpy(inline_ + old_size, data, size);
+    inline_[new_size] = '\0';
+    set_meta(static_cast<unsigned char>(new_size));
+    return;
+  }
+
+  if (kHeap != meta() || new_size > heap_.capacity) {
+    // data may be in the old block, it is copied before the block goes
+    size_t capacity = (kHeap == meta()) ? 2 * heap_.capacity : 2 * old_size;
+    if (capacity < new_size)
+      capacity = new_size;
+    char * block = new char[capacity + 1];
+    memcpy(block, this->data(), old_size);
+    memcpy(block + old_size, data, size);
+    release();
+    heap_.data = block;
+    heap_.capacity = capacity;
+    set_meta(kHeap);
+  } else {
+    memcpy(heap_.data + old_size, data, size);
+  }
+
+  heap_.data[new_size] = '\0';
+  heap_.size = new_size;
+}
+
+void XmlValue::slice(const char * data, size_t size) {
+  release();
+  slice_.data = data;
+  slice_.size = size;
+  set_meta(kSlice);
+}
+
+void XmlValue::keep(size_t pos, size_t count) {
+  size_t size = this->size();
+  if (pos > size)
+    pos = size;
+  if (count > size - pos)
+    count = size - pos;
+
+  if (kSlice == meta()) {
+    slice_.data += pos;
+    slice_.size = count;
+    return;
+  }
+
+  assign(data() + pos, count);
+}
+
+void XmlValue::clear() {
+  if (kHeap == meta()) {
+    heap_.data[0] = '\0';
+    heap_.size = 0;
+    return;
+  }
+
+  inline_[0] = '\0';
+  set_meta(0);
+}
+
+void XmlValue::release() {
+  if (kHeap == meta())
+    delete [] heap_.data;
+  set_meta(0);
+}
+
+/////////////////////////////////////////////
+// XmlValuePool
+
+XmlValuePool::XmlValuePool()
+  : chunk_pos_(NULL), chunk_left_(0),
+    num_of_values_(0), interned_bytes_(0), stored_bytes_(0) {
+}
+
+std::string_view XmlValuePool::Intern(std::string_view value) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++num_of_values_;
+  interned_bytes_ += value.size();
+
+  std::unordered_set<std::string_view>::const_iterator found = values_.find(value);
+  if (found != values_.end())
+    return *found;
+
+  char * kept = store(value.size());
+  memcpy(kept, value.data(), value.size());
+  stored_bytes_ += value.size();
+  return *values_.insert(std::string_view(kept, value.size())).first;
+}
+
+size_t XmlValuePool::NumOfValues() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_of_values_;
+}
+
+size_t XmlValuePool::NumOfDistinct() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return values_.size();
+}
+
+size_t XmlValuePool::InternedBytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return interned_bytes_;
+}
+
+size_t XmlValuePool::StoredBytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stored_bytes_;
+}
+
+double XmlValuePool::DedupRatio() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (0 == stored_bytes_)
+    return 1.0;
+  return static_cast<double>(interned_bytes_) / stored_bytes_;
+}
+
+char * XmlValuePool::store(size_t size) {
+  if (size > kChunkSize / 4) {
+    chunks_.push_back(std::unique_ptr<char[]>(new char[size]));
+    return chunks_.back().get();
+  }
+
+  if (size > chunk_left_) {
+    chunks_.push_back(std::unique_ptr<char[]>(new char[kChunkSize]));
+    chunk_pos_ = chunks_.back().get();
+    chunk_left_ = kChunkSize;
+  }
+
+  char * kept = chunk_pos_;
+  chunk_pos_ += size;
+  chunk_left_ -= size;
+  return kept;
+}
+
+}
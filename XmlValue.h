@@ -0,0 +1,193 @@
+/*
+SmallXml - Tiny and Simple Xml DOM
+
+www.github.com/theliuy/SmallXml.git
+Author: Yang Liu
+        theliuy.com
+*/
+
+#ifndef SMALLXML_XMLVALUE_H
+#define SMALLXML_XMLVALUE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_set>
+#include <memory>
+#include <mutex>
+#include <cstddef>
+
+namespace SmallXml {
+
+/*
+  XmlValue is the one string of a node: the tag of an element, or the
+  text of a text, comment or unknown node. It takes 32 bytes and is
+  one of
+    INLINE - Up to kInlineSize characters, kept in the value itself.
+    HEAP   - An owned block, kept when the value shrinks or is
+             cleared, so that a reused node does not allocate again.
+    SLICE  - Characters owned by someone else, e.g. the source a node
+             was parsed from. The owner has to outlive the value.
+
+  XmlValue value("title");          // inline
+  value.append(long_text);          // heap
+  value.slice(source.data() + 10, 42);
+  if (value == "title") ...
+
+  NOTE:
+    Like std::string, data() is always NUL terminated except for a
+    slice, which is data() and size() only.
+    Any change to a slice makes it an owned value first.
+    A copy of a slice is the same slice.
+*/
+class XmlValue {
+ public:
+  enum Kind {
+    INLINE,
+    HEAP,
+    SLICE
+  };
+
+  // Longest value kept inline
+  static const size_t kInlineSize = 30;
+
+  XmlValue();
+  XmlValue(const char * data, size_t size);
+  explicit XmlValue(std::string_view str);
+  XmlValue(const XmlValue & value);
+  XmlValue & operator=(const XmlValue & value);
+  ~XmlValue();
+
+  const char * data() const {
+    return (kHeap == meta()) ? heap_.data : (kSlice == meta()) ? slice_.data : inline_;
+  }
+  size_t size() const {
+    return (kHeap == meta()) ? heap_.size : (kSlice == meta()) ? slice_.size : meta();
+  }
+  bool empty() const { return 0 == size(); }
+  Kind kind() const { return (kHeap == meta()) ? HEAP : (kSlice == meta()) ? SLICE : INLINE; }
+
+  std::string_view view() const { return std::string_view(data(), size()); }
+  operator std::string_view() const { return view(); }
+  std::string str() const { return std::string(data(), size()); }
+
+  /*
+    Assign, Append - Copy [data, data + size), which may be a part of
+                     this value.
+    Slice - Refer to [data, data + size) without copying it.
+    Keep - Keep only [pos, pos + count), e.g. to trim it.
+    Clear - Empty, an owned block is kept.
+  */
+  void assign(const char * data, size_t size);
+  void assign(std::string_view str) { assign(str.data(), str.size()); }
+  void append(const char * data, size_t size);
+  void append(std::string_view str) { append(str.data(), str.size()); }
+  void slice(const char * data, size_t size);
+  void slice(std::string_view str) { slice(str.data(), str.size()); }
+  void keep(size_t pos, size_t count);
+  void clear();
+
+  // Owned block size, 0 unless the value is on the heap
+  size_t capacity() const { return (kHeap == meta()) ? heap_.capacity : 0; }
+
+ private:
+  // Meta of an owned block and of a slice, any other is an inline size
+  static const unsigned char kHeap = 0xfe;
+  static const unsigned char kSlice = 0xff;
+
+  struct Heap {
+    char * data;
+    size_t size;
+    size_t capacity;
+  };
+
+  struct Slice {
+    const char * data;
+    size_t size;
+  };
+
+  // The last byte, behind the inline characters and their NUL, and
+  // behind a block or a slice
+  unsigned char meta() const { return static_cast<unsigned char>(inline_[kInlineSize + 1]); }
+  void set_meta(unsigned char meta) { inline_[kInlineSize + 1] = static_cast<char>(meta); }
+
+  // Free an owned block, the content is left undefined
+  void release();
+
+  union {
+    char inline_[kInlineSize + 2];
+    Heap heap_;
+    Slice slice_;
+  };
+};
+
+static_assert(sizeof(XmlValue) == 32, "XmlValue is 32 bytes");
+
+inline bool operator==(const XmlValue & a, const XmlValue & b) { return a.view() == b.view(); }
+inline bool operator!=(const XmlValue & a, const XmlValue & b) { return a.view() != b.view(); }
+inline bool operator==(const XmlValue & a, std::string_view b) { return a.view() == b; }
+inline bool operator!=(const XmlValue & a, std::string_view b) { return a.view() != b; }
+inline bool operator==(std::string_view a, const XmlValue & b) { return a == b.view(); }
+inline bool operator!=(std::string_view a, const XmlValue & b) { return a != b.view(); }
+inline bool operator==(const XmlValue & a, const std::string & b) { return a.view() == b; }
+inline bool operator!=(const XmlValue & a, const std::string & b) { return a.view() != b; }
+inline bool operator==(const std::string & a, const XmlValue & b) { return b.view() == a; }
+inline bool operator!=(const std::string & a, const XmlValue & b) { return b.view() != a; }
+inline bool operator==(const XmlValue & a, const char * b) { return a.view() == b; }
+inline bool operator!=(const XmlValue & a, const char * b) { return a.view() != b; }
+
+/*
+  XmlValuePool keeps each distinct value once, for documents which
+  repeat the same long values over and over. Intern returns the kept
+  copy, which stays where it is as long as the pool lives, so values
+  can be slices of it.
+
+  XmlValuePool pool;
+  value.slice(pool.Intern(text));
+
+  Stats
+    NumOfValues - Values interned, repeated ones too.
+    NumOfDistinct - Values kept.
+    InternedBytes, StoredBytes - Characters interned, and kept.
+    DedupRatio - InternedBytes / StoredBytes, 1 for an empty pool.
+
+  NOTE:
+    Values are never removed, a pool only grows while it lives.
+    Intern may be called from many threads.
+*/
+class XmlValuePool {
+ public:
+  XmlValuePool();
+
+  std::string_view Intern(std::string_view value);
+
+  size_t NumOfValues() const;
+  size_t NumOfDistinct() const;
+  size_t InternedBytes() const;
+  size_t StoredBytes() const;
+  double DedupRatio() const;
+
+ private:
+  // Values are copied into chunks of this size, longer ones get
+  // their own
+  static const size_t kChunkSize = 64 * 1024;
+
+  // Not copyable
+  XmlValuePool(const XmlValuePool &);
+  XmlValuePool & operator=(const XmlValuePool &);
+
+  char * store(size_t size);
+
+  mutable std::mutex mutex_;
+  std::unordered_set<std::string_view> values_;
+  std::vector<std::unique_ptr<char[]> > chunks_;
+  char * chunk_pos_;
+  size_t chunk_left_;
+  size_t num_of_values_;
+  size_t interned_bytes_;
+  size_t stored_bytes_;
+};
+
+}
+
+#endif
@@ -0,0 +1,172 @@
+#include "XmlVersioned.h"
+
+namespace SmallXml {
+
+/////////////////////////////////////////////
+// XmlVersionedDocument
+
+XmlVersionedDocument::XmlVersionedDocument()
+  : current_(new Version),
+    epoch_(1),
+    slots_(NULL) {
+  current_.load()->document.Hash();
+}
+
+XmlVersionedDocument::XmlVersionedDocument(const XmlNode & document)
+  : current_(NULL),
+    epoch_(1),
+    slots_(NULL) {
+  Version * version = new Version;
+  version->document = document;
+  version->document.Hash();
+  current_.store(version);
+}
+
+XmlVersionedDocument::~XmlVersionedDocument() {
+  delete current_.load();
+  for (size_t index = 0; index < retired_.size(); ++index)
+    delete retired_[index];
+
+  Slot * slot = slots_.load();
+  while (NULL != slot) {
+    Slot * next = slot->next;
+    delete slot;
+    slot = next;
+  }
+}
+
+/*
+  The current version is only changed under writer_mutex_, so it can
+  be read plainly here.
+*/
+bool XmlVersionedDocument::Update(const std::function<bool (XmlNode & next)> & update) {
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+  const Version * current = current_.load(std::memory_order_relaxed);
+
+  Version * next = new Version;
+  next->document = current->document;
+  if (!update(next->document)) {
+    delete next;
+    return false;
+  }
+
+  next->number = current->number + 1;
+  publish(next);
+  return true;
+}
+
+void XmlVersionedDocument::Replace(const XmlNode & document) {
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+
+  Version * next = new Version;
+  next->document = document;
+  next->number = current_.load(std::memory_order_relaxed)->number + 1;
+  publish(next);
+}
+
+uint64_t XmlVersionedDocument::version() const {
+  return current_.load(std::memory_order_acquire)->number;
+}
+
+void XmlVersionedDocument::Reclaim() {
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+  reclaim();
+}
+
+size_t XmlVersionedDocument::NumOfRetired() const {
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+  return retired_.size();
+}
+
+/*
+  A free slot of a gone reader is taken over, otherwise a new one is
+  pushed in front of the list.
+*/
+XmlVersionedDocument::Slot * XmlVersionedDocument::acquireSlot() {
+  for (Slot * slot = slots_.load(std::memory_order_acquire); NULL != slot; slot = slot->next) {
+    bool in_use = false;
+    if (slot->in_use.compare_exchange_strong(in_use, true, std::memory_order_acquire))
+      return slot;
+  }
+
+  Slot * slot = new Slot;
+  slot->next = slots_.load(std::memory_order_relaxed);
+  while (!slots_.compare_exchange_weak(slot->next, slot, std::memory_order_release,
+                                       std::memory_order_relaxed)) {
+  }
+  return slot;
+}
+
+/*
+  Hash walks the whole tree, which expands lazy nodes and fills the
+  hash of every node: the only writes a const call would do. After
+  that, readers only read.
+
+  The old version is retired in the epoch which starts after the
+  switch. A reader which sees that epoch, or a later one, already sees
+  the new version.
+*/
+void XmlVersionedDocument::publish(Version * next) {
+  next->document.Hash();
+
+  Version * old = current_.exchange(next, std::memory_order_seq_cst);
+  old->retired_epoch = epoch_.fetch_add(1, std::memory_order_seq_cst) + 1;
+  retired_.push_back(old);
+  reclaim();
+}
+
+/*
+  A reader either shows its epoch here, or it starts after the switch
+  and takes the new version: its slot store and this load are both
+  sequentially consistent, like the switch and its version load.
+*/
+void XmlVersionedDocument::reclaim() {
+  if (retired_.empty())
+    return;
+
+  uint64_t oldest = UINT64_MAX;
+  for (Slot * slot = slots_.load(std::memory_order_acquire); NULL != slot; slot = slot->next) {
+    uint64_t epoch = slot->epoch.load(std::memory_order_seq_cst);
+    if (0 != epoch && epoch < oldest)
+      oldest = epoch;
+  }
+
+  size_t kept = 0;
+  for (size_t index = 0; index < retired_.size(); ++index) {
+    if (retired_[index]->retired_epoch <= oldest)
+      delete retired_[index];
+    else
+      retired_[kept++] = retired_[index];
+  }
+  retired_.resize(kept);
+}
+
+/////////////////////////////////////////////
+// Reader
+
+XmlVersionedDocument::Reader::Reader(XmlVersionedDocument & document)
+  : document_(document),
+    slot_(document.acquireSlot()) {
+}
+
+XmlVersionedDocument::Reader::~Reader() {
+  slot_->epoch.store(0, std::memory_order_release);
+  slot_->in_use.store(false, std::memory_order_release);
+}
+
+/////////////////////////////////////////////
+// Snapshot
+
+XmlVersionedDocument::Snapshot::Snapshot(Reader & reader)
+  : slot_(reader.slot_),
+    version_(NULL) {
+  slot_->epoch.store(reader.document_.epoch_.load(std::memory_order_acquire),
+                     std::memory_order_seq_cst);
+  version_ = reader.document_.current_.load(std::memory_order_seq_cst);
+}
+
+XmlVersionedDocument::Snapshot::~Snapshot() {
+  slot_->epoch.store(0, std::memory_order_release);
+}
+
+}
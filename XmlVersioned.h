@@ -0,0 +1,164 @@
+/*
+SmallXml - Tiny and Simple Xml DOM
+
+www.github.com/theliuy/SmallXml.git
+Author: Yang Liu
+        theliuy.com
+*/
+
+#ifndef SMALLXML_XMLVERSIONED_H
+#define SMALLXML_XMLVERSIONED_H
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <cstddef>
+#include <stdint.h>
+
+#include "SmallXml.h"
+
+namespace SmallXml {
+
+/*
+  XmlVersionedDocument is a document which many threads read while
+  another one changes it. Readers take a snapshot of the current
+  version without locking, and a version never changes once it is
+  published. The writer changes a copy and publishes it in one atomic
+  step. Old versions are deleted once no snapshot taken before the
+  change is left.
+
+  XmlVersionedDocument config(doc);
+
+  // Once per reading thread
+  XmlVersionedDocument::Reader reader(config);
+  ...
+  {
+    XmlVersionedDocument::Snapshot snapshot(reader);
+    const XmlNode * host = snapshot->XPath("config/db/host");
+    ...
+  }
+
+  // The writing thread
+  config.Update([](XmlNode & next) {
+    next.XPath("config/db/host")->FirstChild()->set_text("beta");
+    return true;
+  });
+
+  Reclaiming is epoch based: a snapshot marks its reader with the
+  epoch it started in, every publish starts a new epoch, and a version
+  retired in an epoch is deleted once every reader is idle or in that
+  epoch or a later one.
+
+  NOTE:
+    A Reader belongs to one thread, and takes one snapshot at a time.
+    Writers are serialized; every Update copies the whole document,
+    so it suits documents which are read far more than written.
+    A published version is fully expanded and hashed, so that the
+    const calls of readers never write to it.
+    Snapshot nodes are valid while the snapshot lives. All readers
+    have to be gone before the document is destroyed.
+*/
+class XmlVersionedDocument {
+ public:
+  class Reader;
+  class Snapshot;
+
+  // Version 0 is an empty document, or a copy of document
+  XmlVersionedDocument();
+  explicit XmlVersionedDocument(const XmlNode & document);
+  ~XmlVersionedDocument();
+
+  /*
+    Update - Copy the current version, let update change the copy and
+             publish it, unless update returns false.
+    Replace - Publish a copy of document.
+    Both delete the versions their readers left.
+  */
+  bool Update(const std::function<bool (XmlNode & next)> & update);
+  void Replace(const XmlNode & document);
+
+  // Number of the current version
+  uint64_t version() const;
+
+  /*
+    Reclaim - Delete the retired versions no reader uses anymore.
+    NumOfRetired - Retired versions which are still kept.
+  */
+  void Reclaim();
+  size_t NumOfRetired() const;
+
+ private:
+  struct Version {
+    Version() : document(XmlNode::DOCUMENT), number(0), retired_epoch(0) {}
+
+    XmlNode document;
+    uint64_t number;
+    uint64_t retired_epoch;
+  };
+
+  // One per Reader, reused after it; epoch 0 is idle
+  struct Slot {
+    Slot() : epoch(0), in_use(true), next(NULL) {}
+
+    std::atomic<uint64_t> epoch;
+    std::atomic<bool> in_use;
+    Slot * next;
+  };
+
+  // Not copyable
+  XmlVersionedDocument(const XmlVersionedDocument &);
+  XmlVersionedDocument & operator=(const XmlVersionedDocument &);
+
+  Slot * acquireSlot();
+  // Under writer_mutex_
+  void publish(Version * next);
+  void reclaim();
+
+  std::atomic<Version *> current_;
+  std::atomic<uint64_t> epoch_;
+  // Slots are only added, and deleted with the document
+  std::atomic<Slot *> slots_;
+
+  mutable std::mutex writer_mutex_;
+  std::vector<Version *> retired_;
+};
+
+class XmlVersionedDocument::Reader {
+ public:
+  explicit Reader(XmlVersionedDocument & document);
+  ~Reader();
+
+ private:
+  friend class Snapshot;
+
+  // Not copyable
+  Reader(const Reader &);
+  Reader & operator=(const Reader &);
+
+  XmlVersionedDocument & document_;
+  Slot * slot_;
+};
+
+class XmlVersionedDocument::Snapshot {
+ public:
+  explicit Snapshot(Reader & reader);
+  ~Snapshot();
+
+  const XmlNode & document() const { return version_->document; }
+  const XmlNode & operator*() const { return version_->document; }
+  const XmlNode * operator->() const { return &version_->document; }
+  uint64_t version() const { return version_->number; }
+
+ private:
+  // Not copyable
+  Snapshot(const Snapshot &);
+  Snapshot & operator=(const Snapshot &);
+
+  Slot * slot_;
+  const Version * version_;
+};
+
+}
+
+#endif
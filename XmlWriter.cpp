@@ -0,0 +1,330 @@
+#include "XmlWriter.h"
+#include "SmallXml.h"
+
+#include <cstring>
+
+namespace SmallXml {
+
+/////////////////////////////////////////////
+// Sinks
+
+XmlSink::~XmlSink() {
+}
+
+bool XmlSink::Flush() {
+  return true;
+}
+
+XmlStringSink::XmlStringSink(std::string & out)
+  : out_(out) {
+}
+
+bool XmlStringSink::Write(const char * data, size_t size) {
+  out_.append(data, size);
+  return true;
+}
+
+XmlStreamSink::XmlStreamSink(std::ostream & out)
+  : out_(out) {
+}
+
+bool XmlStreamSink::Write(const char * data, size_t size) {
+  out_.write(data, size);
+  return out_.good();
+}
+
+bool XmlStreamSink::Flush() {
+  out_.flush();
+  return out_.good();
+}
+
+XmlFileSink::XmlFileSink(FILE * file)
+  : file_(file) {
+}
+
+bool XmlFileSink::Write(const char * data, size_t size) {
+  if (NULL == file_)
+    return false;
+  return size == fwrite(data, 1, size, file_);
+}
+
+bool XmlFileSink::Flush() {
+  if (NULL == file_)
+    return false;
+  return 0 == fflush(file_);
+}
+
+/////////////////////////////////////////////
+// XmlWriter
+
+XmlWriter::XmlWriter(XmlSink & sink, int indent, size_t buffer_size)
+  : sink_(sink),
+    indent_(indent),
+    buffer_size_(0 == buffer_size ? 1 : buffer_size),
+    in_start_tag_(false),
+    good_(true) {
+  buffer_.reserve(buffer_size_);
+}
+
+XmlWriter::~XmlWriter() {
+  Flush();
+}
+
+bool XmlWriter::Declaration(const std::string & version,
+                            const std::string & encoding) {
+  if (!good_)
+    return false;
+
+  // Only at the top level, before the root
+  if (!open_offsets_.empty())
+    return fail();
+
+  // Same as ToStringAsDeclaration, without indent
+  buffer_ += "<?xml";
+  if (!version.empty()) {
+    buffer_ += " version=\"";
+    buffer_ += version;
+    buffer_ += "\"";
+  }
+  if (!encoding.empty()) {
+    buffer_ += " encoding=\"";
+    buffer_ += encoding;
+    buffer_ += "\"";
+  }
+  buffer_ += "?>";
+  appendNewLine(indent_);
+
+  return flushIfFull();
+}
+
+bool XmlWriter::StartElement(const std::string & tag) {
+  return startElement(tag.data(), tag.size());
+}
+
+bool XmlWriter::StartElement(const char * tag) {
+  return startElement(tag, NULL == tag ? 0 : strlen(tag));
+}
+
+bool XmlWriter::Attribute(const std::string & name, const std::string & value) {
+  return attribute(name.data(), name.size(), value.data(), value.size());
+}
+
+bool XmlWriter::Attribute(const char * name, const char * value) {
+  return attribute(name, NULL == name ? 0 : strlen(name),
+                   value, NULL == value ? 0 : strlen(value));
+}
+
+bool XmlWriter::Text(const std::string & text) {
+  return this->text(text.data(), text.size());
+}
+
+bool XmlWriter::Text(const char * text) {
+  return this->text(text, NULL == text ? 0 : strlen(text));
+}
+
+bool XmlWriter::Comment(const std::string & text) {
+  return comment(text.data(), text.size());
+}
+
+bool XmlWriter::Comment(const char * text) {
+  return comment(text, NULL == text ? 0 : strlen(text));
+}
+
+bool XmlWriter::EndElement() {
+  if (!good_)
+    return false;
+  if (open_offsets_.empty())
+    return fail();
+
+  closeStartTag();
+
+  size_t offset = open_offsets_.back();
+  int indent = open_indents_.back();
+
+  // Same as the close tag ToString writes
+  appendIndent(indent);
+  buffer_ += "</";
+  buffer_.append(open_tags_, offset, std::string::npos);
+  buffer_ += ">";
+  appendNewLine(indent);
+
+  open_tags_.resize(offset);
+  open_offsets_.pop_back();
+  open_indents_.pop_back();
+
+  return flushIfFull();
+}
+
+bool XmlWriter::Flush() {
+  if (!good_)
+    return false;
+
+  if (!buffer_.empty()) {
+    if (!sink_.Write(buffer_.data(), buffer_.size()))
+      return fail();
+    buffer_.clear();
+  }
+
+  if (!sink_.Flush())
+    return fail();
+
+  return true;
+}
+
+bool XmlWriter::Finish() {
+  if (!good_)
+    return false;
+  if (!open_offsets_.empty())
+    return fail();
+
+  return Flush();
+}
+
+bool XmlWriter::Good() const {
+  return good_;
+}
+
+int XmlWriter::Depth() const {
+  return open_offsets_.size();
+}
+
+/////////////////////////////////////////////
+// Private member functions
+
+bool XmlWriter::startElement(const char * tag, size_t size) {
+  if (!good_)
+    return false;
+
+  const char * begin = tag;
+  const char * end = tag + size;
+  XmlNode::trimRange(begin, end);
+  if (begin == end)
+    return fail();
+
+  closeStartTag();
+
+  int indent = currentIndent();
+  appendIndent(indent);
+  buffer_ += "<";
+
+  // Remember the encoded tag for EndElement
+  size_t offset = open_tags_.size();
+  XmlNode::XmlSpecialCharEncode(begin, end - begin, open_tags_);
+  buffer_.append(open_tags_, offset, std::string::npos);
+
+  open_offsets_.push_back(offset);
+  open_indents_.push_back(indent);
+  in_start_tag_ = true;
+
+  return flushIfFull();
+}
+
+bool XmlWriter::attribute(const char * name, size_t name_size,
+                          const char * value, size_t value_size) {
+  if (!good_)
+    return false;
+
+  // Only right after StartElement or another Attribute
+  if (!in_start_tag_ || 0 == name_size)
+    return fail();
+
+  buffer_ += " ";
+  XmlNode::XmlSpecialCharEncode(name, name_size, buffer_);
+  buffer_ += "=\"";
+  XmlNode::XmlSpecialCharEncode(value, value_size, buffer_);
+  buffer_ += "\"";
+
+  return flushIfFull();
+}
+
+bool XmlWriter::text(const char * text, size_t size) {
+  if (!good_)
+    return false;
+
+  closeStartTag();
+
+  // Same as ToStringAsText
+  const char * begin = text;
+  const char * end = text + size;
+  XmlNode::trimRange(begin, end);
+
+  int indent = currentIndent();
+  if (begin != end) {
+    appendIndent(indent);
+    XmlNode::XmlSpecialCharEncode(begin, end - begin, buffer_);
+  }
+  appendNewLine(indent);
+
+  return flushIfFull();
+}
+
+bool XmlWriter::comment(const char * text, size_t size) {
+  if (!good_)
+    return false;
+
+  closeStartTag();
+
+  // Same as ToStringAsComment
+  const char * begin = text;
+  const char * end = text + size;
+  XmlNode::trimRange(begin, end);
+
+  int indent = currentIndent();
+  appendIndent(indent);
+  buffer_ += "<!-- ";
+  XmlNode::XmlSpecialCharEncode(begin, end - begin, buffer_);
+  buffer_ += " -->";
+  appendNewLine(indent);
+
+  return flushIfFull();
+}
+
+void XmlWriter::closeStartTag() {
+  if (!in_start_tag_)
+    return;
+
+  buffer_ += ">";
+  appendNewLine(open_indents_.back());
+  in_start_tag_ = false;
+}
+
+void XmlWriter::appendIndent(int indent) {
+  if (indent > 0)
+    buffer_.append(2 * indent, ' ');
+}
+
+void XmlWriter::appendNewLine(int indent) {
+  if (-1 != indent)
+    buffer_ += "\n";
+}
+
+/*
+  Children of an element are indented one more level, top level
+  nodes use the indent given to the constructor, like ToString of
+  a document.
+*/
+int XmlWriter::currentIndent() const {
+  if (open_indents_.empty())
+    return indent_;
+
+  int parent_indent = open_indents_.back();
+  return (-1 == parent_indent) ? -1 : parent_indent + 1;
+}
+
+bool XmlWriter::fail() {
+  good_ = false;
+  return false;
+}
+
+bool XmlWriter::flushIfFull() {
+  if (buffer_.size() < buffer_size_)
+    return true;
+
+  if (!sink_.Write(buffer_.data(), buffer_.size()))
+    return fail();
+  buffer_.clear();
+
+  return true;
+}
+
+}
@@ -0,0 +1,162 @@
+/*
+SmallXml - Tiny and Simple Xml DOM
+
+www.github.com/theliuy/SmallXml.git
+Author: Yang Liu
+        theliuy.com
+*/
+
+#ifndef SMALLXML_XMLWRITER_H
+#define SMALLXML_XMLWRITER_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <ostream>
+
+namespace SmallXml {
+
+/*
+  Sinks are where a XmlWriter sends its bytes.
+  Write returns false when the bytes could not be delivered.
+*/
+class XmlSink {
+ public:
+  virtual ~XmlSink();
+  virtual bool Write(const char * data, size_t size) = 0;
+  virtual bool Flush();
+};
+
+// Appends to a std::string owned by the caller
+class XmlStringSink : public XmlSink {
+ public:
+  explicit XmlStringSink(std::string & out);
+  bool Write(const char * data, size_t size);
+
+ private:
+  std::string & out_;
+};
+
+// Writes to a std::ostream owned by the caller
+class XmlStreamSink : public XmlSink {
+ public:
+  explicit XmlStreamSink(std::ostream & out);
+  bool Write(const char * data, size_t size);
+  bool Flush();
+
+ private:
+  std::ostream & out_;
+};
+
+// Writes to a FILE opened by the caller
+class XmlFileSink : public XmlSink {
+ public:
+  explicit XmlFileSink(FILE * file);
+  bool Write(const char * data, size_t size);
+  bool Flush();
+
+ private:
+  FILE * file_;
+};
+
+/*
+  XmlWriter generates a document straight into a sink, without
+  building a DOM. Its output is the same as ToString of the
+  equivalent XmlNode tree: same escaping, same indentation.
+
+  XmlFileSink sink(stdout);
+  XmlWriter writer(sink);
+  writer.Declaration();
+  writer.StartElement("catalog");
+  writer.StartElement("item");
+  writer.Attribute("id", "42");
+  writer.Text("Some Content");
+  writer.EndElement();
+  writer.Comment("end of items");
+  writer.EndElement();
+  writer.Finish();
+
+  Every call returns false if it breaks nesting (an Attribute after
+  content, an EndElement without open element...) or if the sink
+  fails. After the first failure the writer stays failed, check Good().
+
+  NOTE:
+    Tags and texts are trimmed and encoded, like set_tag and set_text.
+    Attribute names and values are encoded, like SetAttribute.
+    Attributes are written in call order. XmlNode keeps them in a map,
+    so call them in name order to get the same output, and don't
+    repeat a name.
+
+    The writer keeps a buffer of buffer_size bytes and the names of the
+    open elements, nothing else. Once those have grown to the size of
+    the largest item and the deepest nesting, calls don't allocate.
+*/
+class XmlWriter {
+ public:
+  /*
+    indent has the same meaning as in ToString, -1 means no new lines.
+  */
+  explicit XmlWriter(XmlSink & sink, int indent = 0, size_t buffer_size = 64 * 1024);
+  ~XmlWriter();
+
+  bool Declaration(const std::string & version = "1.1",
+                   const std::string & encoding = "UTF-8");
+
+  bool StartElement(const std::string & tag);
+  bool StartElement(const char * tag);
+  bool Attribute(const std::string & name, const std::string & value);
+  bool Attribute(const char * name, const char * value);
+  bool Text(const std::string & text);
+  bool Text(const char * text);
+  bool Comment(const std::string & text);
+  bool Comment(const char * text);
+  bool EndElement();
+
+  /*
+    Flush - Push buffered bytes to the sink.
+    Finish - Check that all elements are closed, then Flush.
+  */
+  bool Flush();
+  bool Finish();
+
+  bool Good() const;
+  int Depth() const;
+
+ private:
+  // Not copyable
+  XmlWriter(const XmlWriter &);
+  XmlWriter & operator=(const XmlWriter &);
+
+  bool startElement(const char * tag, size_t size);
+  bool attribute(const char * name, size_t name_size,
+                 const char * value, size_t value_size);
+  bool text(const char * text, size_t size);
+  bool comment(const char * text, size_t size);
+
+  // Close a pending "<tag attr..." with ">"
+  void closeStartTag();
+  void appendIndent(int indent);
+  void appendNewLine(int indent);
+  int currentIndent() const;
+  bool fail();
+  bool flushIfFull();
+
+  XmlSink & sink_;
+  int indent_;
+  size_t buffer_size_;
+  std::string buffer_;
+
+  // Encoded tags of open elements, back to back
+  std::string open_tags_;
+  // Start of each open tag in open_tags_
+  std::vector<size_t> open_offsets_;
+  // Indent of each open element
+  std::vector<int> open_indents_;
+
+  bool in_start_tag_;
+  bool good_;
+};
+
+}
+
+#endif